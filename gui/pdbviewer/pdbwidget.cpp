@@ -444,8 +444,7 @@ void mirror_texels(Buffer<ColorF> &buffer)
   }
 }
 
-const int attrPerVertex = 7; // x, y, z, s, t, r, atom
-const int attrPerAtom = 4 * attrPerVertex;
+const int verticesPerAtom = 4;
 
 vec3 random_normal()
 {
@@ -536,41 +535,32 @@ void PDBWidget::open(const std::string &filename)
     atoms[i].z *= s;
   }
 
+  // x, y, z, s, t, r, atom
+  VertexLayout layout;
+  layout.add(VertexLayout::Float32, 3);
+  layout.add(VertexLayout::Float32, 2);
+  layout.add(VertexLayout::Float32, 1);
+  layout.add(VertexLayout::Float32, 1);
+  m_attributes = VertexBuffer(layout);
+  m_attributes.resize(atoms.size() * verticesPerAtom);
+  m_colors.clear();
+
+  // top-right, top-left, bottom-left and bottom-right corner
+  const Real corners[4][2] = { { 1, 1 }, { -1, 1 }, { -1, -1 }, { 1, -1 } };
+
   for (std::size_t i = 0; i < atoms.size(); ++i) {
     m_colors.push_back(chemistry::atom_color(atoms[i].element));
+    Real pos[3] = { atoms[i].x, atoms[i].y, atoms[i].z };
     Real r = d * chemistry::vdw_radius(atoms[i].element);
-    // top-right corner
-    m_attributes.push_back(atoms[i].x);
-    m_attributes.push_back(atoms[i].y);
-    m_attributes.push_back(atoms[i].z);
-    m_attributes.push_back(1 + m_zeta);
-    m_attributes.push_back(1 + m_zeta);
-    m_attributes.push_back(r);
-    m_attributes.push_back(i);
-    // top-left corner
-    m_attributes.push_back(atoms[i].x);
-    m_attributes.push_back(atoms[i].y);
-    m_attributes.push_back(atoms[i].z);
-    m_attributes.push_back(-1 - m_zeta);
-    m_attributes.push_back(1 + m_zeta);
-    m_attributes.push_back(r);
-    m_attributes.push_back(i);
-    // bottom left-corner
-    m_attributes.push_back(atoms[i].x);
-    m_attributes.push_back(atoms[i].y);
-    m_attributes.push_back(atoms[i].z);
-    m_attributes.push_back(-1 - m_zeta);
-    m_attributes.push_back(-1 - m_zeta);
-    m_attributes.push_back(r);
-    m_attributes.push_back(i);
-    // bottom-right corner
-    m_attributes.push_back(atoms[i].x);
-    m_attributes.push_back(atoms[i].y);
-    m_attributes.push_back(atoms[i].z);
-    m_attributes.push_back(1 + m_zeta);
-    m_attributes.push_back(-1 - m_zeta);
-    m_attributes.push_back(r);
-    m_attributes.push_back(i);
+    Real atom = i;
+    for (int j = 0; j < verticesPerAtom; ++j) {
+      std::size_t v = i * verticesPerAtom + j;
+      Real st[2] = { corners[j][0] * (1 + m_zeta), corners[j][1] * (1 + m_zeta) };
+      m_attributes.set(v, 0, pos);
+      m_attributes.set(v, 1, st);
+      m_attributes.set(v, 2, &r);
+      m_attributes.set(v, 3, &atom);
+    }
   }
 
   m_zeta = zeta;
@@ -578,7 +568,7 @@ void PDBWidget::open(const std::string &filename)
  
 void PDBWidget::computeAmbientOcclusion()
 {
-  m_aoMap = Buffer<ColorF>(m_aoMapSize * m_attributes.size() / attrPerAtom, m_aoMapSize);
+  m_aoMap = Buffer<ColorF>(m_aoMapSize * m_colors.size(), m_aoMapSize);
   for (int i = 0; i < m_aoMap.width(); ++i)
     for (int j = 0; j < m_aoMap.height(); ++j)
       m_aoMap(i, j) = Color::black();
@@ -654,7 +644,7 @@ Buffer<Real> PDBWidget::createDepthMap(const vec3 &dir)
   vertexShader.u_p = project;
   fragmentShader.u_p = project;
 
-  renderer.drawQuads(&m_attributes[0], m_attributes.size(), attrPerVertex);
+  renderer.drawQuads(m_attributes);
 
   return ctx.zBuffer();
 }
@@ -698,7 +688,7 @@ void PDBWidget::createAmbientOcclusionMap(const vec3 &dir)
   fragmentShader.u_inv_mv = (view * rot).inverse();
   fragmentShader.u_p = project;
 
-  renderer.drawQuads(&m_attributes[0], m_attributes.size(), attrPerVertex);
+  renderer.drawQuads(m_attributes);
 }
 
 void PDBWidget::render()
@@ -741,7 +731,7 @@ void PDBWidget::render()
   // draw the atoms
   for (std::size_t i = 0; i < m_colors.size(); ++i) {
     fragmentShader.u_material = Material(m_colors[i], m_colors[i], vec4(1.0, 1.0, 1.0, 1.0));
-    renderer.drawQuads(&m_attributes[i * attrPerAtom], attrPerAtom, attrPerVertex);
+    renderer.drawQuads(m_attributes, i * verticesPerAtom, verticesPerAtom);
   }
 
 
@@ -5,6 +5,7 @@
 
 #include <libgfx/context.h>
 #include <libgfx/texture.h>
+#include <libgfx/vertexbuffer.h>
 
 class PDBWidget : public GfxWidget
 {
@@ -58,7 +59,7 @@ class PDBWidget : public GfxWidget
     GFX::Buffer<GFX::Real> createDepthMap(const GFX::vec3 &dir);
     void createAmbientOcclusionMap(const GFX::vec3 &dir);
 
-    std::vector<double> m_attributes;
+    GFX::VertexBuffer m_attributes;
     std::vector<GFX::vec4> m_colors;
     GFX::Buffer<GFX::ColorF> m_aoMap;
 
@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "EasyImage.h"
+#include "bresenham.h"
 #include <algorithm>
 #include <assert.h>
 #include <math.h>
@@ -205,55 +206,24 @@ img::Color const& img::EasyImage::operator()(unsigned int x, unsigned int y) con
 	return bitmap.at(x * height + y);
 }
 
-void img::EasyImage::draw_line(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, Color color)
+void img::EasyImage::draw_line(int x0, int y0, int x1, int y1, Color color)
 {
-	assert(x0 < this->width && y0 < this->height);
-	assert(x1 < this->width && y1 < this->height);
-	if (x0 == x1)
+	GFX::BresenhamLine line(x0, y0, x1, y1, 0, 0, (int) this->width - 1, (int) this->height - 1);
+	if (line.count == 0)
 	{
-		//special case for x0 == x1
-		for (unsigned int i = std::min(y0, y1); i <= std::max(y0, y1); i++)
-		{
-			(*this)(x0, i) = color;
-		}
+		return;
 	}
-	else if (y0 == y1)
+	//the pixels are stored column by column: write them through a pointer
+	Color* pixel = &bitmap[line.x * height + line.y];
+	const std::ptrdiff_t major = line.xMajor ? line.majorStep * (std::ptrdiff_t) height : line.majorStep;
+	const std::ptrdiff_t minor = line.xMajor ? line.minorStep : line.minorStep * (std::ptrdiff_t) height;
+	for (int i = 0; i < line.count; i++)
 	{
-		//special case for y0 == y1
-		for (unsigned int i = std::min(x0, x1); i <= std::max(x0, x1); i++)
-		{
-			(*this)(i, y0) = color;
-		}
-	}
-	else
-	{
-		if (x0 > x1)
-		{
-			//flip points if x1>x0: we want x0 to have the lowest value
-			std::swap(x0, x1);
-			std::swap(y0, y1);
-		}
-		double m = ((double) y1 - (double) y0) / ((double) x1 - (double) x0);
-		if (-1.0 <= m && m <= 1.0)
-		{
-			for (unsigned int i = 0; i <= (x1 - x0); i++)
-			{
-				(*this)(x0 + i, (unsigned int) round(y0 + m * i)) = color;
-			}
-		}
-		else if (m > 1.0)
+		*pixel = color;
+		pixel += major;
+		if (line.next())
 		{
-			for (unsigned int i = 0; i <= (y1 - y0); i++)
-			{
-				(*this)((unsigned int) round(x0 + (i / m)), y0 + i) = color;
-			}
-		}
-		else if (m < -1.0)
-		{
-			for (unsigned int i = 0; i <= (y0 - y1); i++)
-			{
-				(*this)((unsigned int) round(x0 - (i / m)), y0 - i) = color;
-			}
+			pixel += minor;
 		}
 	}
 }
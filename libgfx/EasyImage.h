@@ -211,14 +211,10 @@ namespace img
 			 * \param x1	the x coordinate of the second pixel
 			 * \param y1	the y coordinate of the second pixel
 			 * \param color	the color of the line
-			 * 
-			 * These assertions apply:
-			 *	assert(x0 < getWidth())
-			 * 	assert(y0 < getHeight())
-			 * 	assert(x1 < getWidth())
-			 * 	assert(y1 < getHeight())
+			 *
+			 * The pixels outside the image are not drawn (see GFX::BresenhamLine)
 			 */
-			void draw_line(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, Color color);
+			void draw_line(int x0, int y0, int x1, int y1, Color color);
 
 		private:
 			friend std::istream& operator>>(std::istream& in, EasyImage & image);
@@ -0,0 +1,215 @@
+#ifndef GFX_BRESENHAM_H
+#define GFX_BRESENHAM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace GFX {
+
+  /**
+   * @brief The pixels of a line between two pixels, clipped to a rectangle.
+   *
+   * Along the major axis (x if |x1 - x0| >= |y1 - y0|, y otherwise) the line
+   * has a pixel for every coordinate from the first to the last pixel. The
+   * minor coordinate is the exact value on the line rounded to the nearest
+   * integer. Bresenham's algorithm computes it incrementally with integers.
+   *
+   * The pixels are the same as the ones of the floating-point line drawers
+   * this replaces. They walk from the end point with the smallest x and
+   * compute the minor coordinate as round(y0 + m * i) along x or as
+   * round(x0 + i / m) (round(x0 - i / m) if y decreases) along y, with
+   * m = (y1 - y0) / (x1 - x0). Only values exactly half way between two
+   * pixels depend on the rounding errors of m, these are the only steps where
+   * the floating-point value is computed.
+   *
+   * Lines completely outside the rectangle are rejected with the
+   * Cohen-Sutherland outcodes. Otherwise the visible steps are found like
+   * Liang-Barsky clipping but for the steps of the line, so the visible
+   * pixels are the same as for the unclipped line.
+   *
+   * Usage:
+   * @code
+   * BresenhamLine line(x0, y0, x1, y1, 0, 0, width - 1, height - 1);
+   * for (int i = 0; i < line.count; ++i, line.next())
+   *   setPixel(line.x, line.y);
+   * @endcode
+   *
+   * The coordinates must be less than 2^30 in absolute value.
+   */
+  struct BresenhamLine
+  {
+    /**
+     * @param x0 The x coordinate of the first pixel.
+     * @param y0 The y coordinate of the first pixel.
+     * @param x1 The x coordinate of the last pixel.
+     * @param y1 The y coordinate of the last pixel.
+     * @param xMin The first visible column.
+     * @param yMin The first visible row.
+     * @param xMax The last visible column.
+     * @param yMax The last visible row.
+     */
+    BresenhamLine(int x0, int y0, int x1, int y1, int xMin, int yMin, int xMax, int yMax)
+      : x(x0), y(y0), first(0), count(0), steps(0), xMajor(std::abs(y1 - y0) <= std::abs(x1 - x0)), majorStep(1),
+        minorStep(1), step(0), back(0), minor0(0), slope(0.0), error(0), errorStep(0), errorMax(0)
+    {
+      // trivial reject: both pixels outside the same edge
+      if (outcode(x0, y0, xMin, yMin, xMax, yMax) & outcode(x1, y1, xMin, yMin, xMax, yMax))
+        return;
+
+      // walk from the smallest x like the floating-point line drawers
+      if (x1 < x0) {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+      }
+
+      const int major0 = xMajor ? x0 : y0, major1 = xMajor ? x1 : y1;
+      minor0 = xMajor ? y0 : x0;
+      const int minor1 = xMajor ? y1 : x1;
+      const int majorMin = xMajor ? xMin : yMin, majorMax = xMajor ? xMax : yMax;
+      const int minorMin = xMajor ? yMin : xMin, minorMax = xMajor ? yMax : xMax;
+
+      steps = std::abs(major1 - major0);
+      majorStep = major1 < major0 ? -1 : 1;
+      minorStep = minor1 < minor0 ? -1 : 1;
+      if (x0 != x1)
+        slope = (static_cast<double>(y1) - static_cast<double>(y0)) / (static_cast<double>(x1) - static_cast<double>(x0));
+
+      // the minor coordinate of step i is minor0 + minorStep * floor((a * i + c) / b)
+      // with a = 2 * |minor1 - minor0|, b = 2 * steps and c = steps, values
+      // half way (a * i + c a multiple of b) are moved back if the
+      // floating-point value rounds them towards minor0 (see offset())
+      errorStep = 2 * static_cast<long long>(std::abs(minor1 - minor0));
+      errorMax = 2 * static_cast<long long>(steps);
+      const long long c = steps;
+
+      // the visible steps along the major axis
+      long long begin = 0, end = steps;
+      if (majorStep > 0) {
+        begin = std::max<long long>(begin, majorMin - major0);
+        end = std::min<long long>(end, majorMax - major0);
+      } else {
+        begin = std::max<long long>(begin, major0 - majorMax);
+        end = std::min<long long>(end, major0 - majorMin);
+      }
+
+      // the visible steps for the minor axis: lo <= offset(i) <= hi
+      const long long lo = minorStep > 0 ? minorMin - minor0 : minor0 - minorMax;
+      const long long hi = minorStep > 0 ? minorMax - minor0 : minor0 - minorMin;
+      if (errorStep) {
+        // the steps for floor((a * i + c) / b), a step half way that is
+        // moved back can leave the range at the start or enter it at the end
+        const long long majorEnd = end;
+        begin = std::max(begin, ceilDiv(errorMax * lo - c, errorStep));
+        end = std::min(end, floorDiv(errorMax * (hi + 1) - 1 - c, errorStep));
+        if (begin <= majorEnd && offset(begin) < lo)
+          ++begin;
+        if (end < majorEnd && end + 1 >= begin && offset(end + 1) <= hi)
+          ++end;
+      } else if (lo > 0 || hi < 0)
+        return;
+
+      if (begin > end)
+        return;
+
+      // the state for the first visible pixel
+      first = static_cast<int>(begin);
+      count = static_cast<int>(end - begin + 1);
+      step = first;
+      long long numerator = errorStep * begin + c;
+      long long minor = errorMax ? numerator / errorMax : 0;
+      error = errorMax ? numerator - minor * errorMax : 0;
+      const long long shown = errorStep ? offset(begin) : minor;
+      back = static_cast<int>(minor - shown) * minorStep;
+      const int major = major0 + majorStep * first;
+      minor = minor0 + minorStep * shown;
+      x = xMajor ? major : static_cast<int>(minor);
+      y = xMajor ? static_cast<int>(minor) : major;
+    }
+
+    /**
+     * @brief Go to the next pixel.
+     *
+     * @return True if the minor coordinate changed (the pixel is diagonal).
+     */
+    bool next()
+    {
+      (xMajor ? x : y) += majorStep;
+      int &minor = xMajor ? y : x;
+      const int previous = minor;
+      minor += back;
+      back = 0;
+      ++step;
+      error += errorStep;
+      if (error >= errorMax) {
+        error -= errorMax;
+        minor += minorStep;
+      }
+      if (!error && errorStep && !roundsAway(step, minor)) {
+        minor -= minorStep;
+        back = minorStep;
+      }
+      return minor != previous;
+    }
+
+    /**
+     * @brief The Cohen-Sutherland outcode of pixel (x, y) (one bit for every
+     * edge of the rectangle the pixel is outside of).
+     */
+    static int outcode(int x, int y, int xMin, int yMin, int xMax, int yMax)
+    {
+      return (x < xMin ? 1 : 0) | (x > xMax ? 2 : 0) | (y < yMin ? 4 : 0) | (y > yMax ? 8 : 0);
+    }
+
+    int x, y; // the current pixel
+    int first; // the step of the first visible pixel (0 for the first pixel of the line, the one with the smallest x)
+    int count; // the number of visible pixels
+    int steps; // the number of steps for the whole line (the number of pixels - 1)
+    bool xMajor; // true if x changes every step
+    int majorStep, minorStep; // +1 or -1
+
+  private:
+    /**
+     * @brief Check if the floating-point value of a step half way between two
+     * pixels rounds to @p minor, the pixel further from minor0.
+     */
+    bool roundsAway(long long i, long long minor) const
+    {
+      const double value = xMajor ? minor0 + slope * i : (majorStep > 0 ? minor0 + i / slope : minor0 - i / slope);
+      return std::round(value) == minor;
+    }
+
+    /**
+     * @brief Get the minor offset (in minorStep units) of step @p i.
+     */
+    long long offset(long long i) const
+    {
+      const long long numerator = errorStep * i + steps;
+      const long long minor = numerator / errorMax;
+      if (numerator % errorMax == 0 && !roundsAway(i, minor0 + minorStep * minor))
+        return minor - 1;
+      return minor;
+    }
+
+    static long long floorDiv(long long a, long long b)
+    {
+      return a / b - (a % b != 0 && (a < 0) != (b < 0));
+    }
+
+    static long long ceilDiv(long long a, long long b)
+    {
+      return -floorDiv(-a, b);
+    }
+
+    int step; // the step of the current pixel
+    int back; // the minor coordinate was moved back by -back for a step half way
+    int minor0; // the minor coordinate of the first pixel of the line
+    double slope; // m = (y1 - y0) / (x1 - x0)
+    long long error; // a * i + c modulo b
+    long long errorStep; // a
+    long long errorMax; // b
+  };
+
+}
+
+#endif
@@ -0,0 +1,62 @@
+#include "depthmap.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace GFX {
+
+  DepthMap::DepthMap(const Buffer<Real> &depth, DepthFormat format, DepthLayout layout)
+    : m_format(format), m_layout(layout), m_width(depth.width()), m_height(depth.height()),
+      m_tilesX((depth.width() + 7) / 8), m_offset(0.0), m_scale(0.0)
+  {
+    const Real empty = std::numeric_limits<Real>::max();
+
+    // the tiles at the right and bottom edge are padded
+    std::size_t size = static_cast<std::size_t>(m_width) * m_height;
+    if (layout == TiledDepthLayout)
+      size = static_cast<std::size_t>(m_tilesX) * ((m_height + 7) / 8) * 64;
+
+    switch (format) {
+      case FloatDepthFormat:
+        m_floats.resize(size, std::numeric_limits<float>::infinity());
+        for (int y = 0; y < m_height; ++y)
+          for (int x = 0; x < m_width; ++x) {
+            Real z = depth(x, y);
+            if (z < empty)
+              m_floats[index(x, y)] = static_cast<float>(z);
+          }
+        break;
+      case Unorm16DepthFormat:
+        {
+          // the range of the values, the largest unorm is used for the empty pixels
+          Real lo = empty, hi = -empty;
+          for (int y = 0; y < m_height; ++y)
+            for (int x = 0; x < m_width; ++x) {
+              Real z = depth(x, y);
+              if (z < empty) {
+                lo = std::min(lo, z);
+                hi = std::max(hi, z);
+              }
+            }
+          m_offset = lo;
+          m_scale = hi > lo ? (hi - lo) / (unormEmpty - 1) : 0.0;
+
+          m_unorms.resize(size, unormEmpty);
+          for (int y = 0; y < m_height; ++y)
+            for (int x = 0; x < m_width; ++x) {
+              Real z = depth(x, y);
+              if (z < empty)
+                m_unorms[index(x, y)] = m_scale > 0.0 ? static_cast<std::uint16_t>(std::lround((z - lo) / m_scale)) : 0;
+            }
+        }
+        break;
+      default:
+        m_doubles.resize(size, empty);
+        for (int y = 0; y < m_height; ++y)
+          for (int x = 0; x < m_width; ++x)
+            m_doubles[index(x, y)] = depth(x, y);
+        break;
+    }
+  }
+
+}
@@ -0,0 +1,182 @@
+#ifndef GFX_DEPTHMAP_H
+#define GFX_DEPTHMAP_H
+
+#include "buffer.h"
+#include "types.h"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace GFX {
+
+  /**
+   * @brief The type used to store the values of a DepthMap.
+   */
+  enum DepthFormat {
+    DoubleDepthFormat, //!< 8 bytes per pixel, the exact values.
+    FloatDepthFormat, //!< 4 bytes per pixel, rounded to float.
+    Unorm16DepthFormat //!< 2 bytes per pixel, quantized between the smallest and largest value.
+  };
+
+  /**
+   * @brief The order of the pixels of a DepthMap in memory.
+   */
+  enum DepthLayout {
+    RowMajorDepthLayout, //!< One row after the other (like Buffer).
+    TiledDepthLayout //!< 8x8 tiles, the pixels in a tile in Morton (Z) order.
+  };
+
+  /**
+   * @brief A read-only z-buffer with compact storage (e.g. a shadow mask).
+   *
+   * The values are converted once when the map is created. The largest Real
+   * (the value for pixels without geometry) is kept as a special value and is
+   * returned unchanged for every format. With the tiled layout, the 2x2 pixels
+   * needed for bilinear interpolation are nearly always in the same 64 byte
+   * cache line (Unorm16DepthFormat) or in two of them.
+   */
+  class DepthMap
+  {
+    public:
+      DepthMap() : m_format(DoubleDepthFormat), m_layout(RowMajorDepthLayout), m_width(0), m_height(0), m_tilesX(0),
+          m_offset(0.0), m_scale(0.0)
+      {
+      }
+
+      DepthMap(const Buffer<Real> &depth, DepthFormat format = DoubleDepthFormat, DepthLayout layout = RowMajorDepthLayout);
+
+      DepthFormat format() const
+      {
+        return m_format;
+      }
+
+      DepthLayout layout() const
+      {
+        return m_layout;
+      }
+
+      int width() const
+      {
+        return m_width;
+      }
+
+      int height() const
+      {
+        return m_height;
+      }
+
+      /**
+       * @brief The number of bytes used for the values (including the padding
+       * for the tiles).
+       */
+      std::size_t memoryUsage() const
+      {
+        return m_doubles.size() * sizeof(Real) + m_floats.size() * sizeof(float) + m_unorms.size() * sizeof(std::uint16_t);
+      }
+
+      Real operator()(int x, int y) const
+      {
+        assert(x >= 0 && x < m_width && y >= 0 && y < m_height);
+        return value(index(x, y));
+      }
+
+      /**
+       * @brief Get the values for pixels (x0, y0), (x1, y0), (x0, y1) and (x1, y1).
+       *
+       * This is the same as using operator() 4 times but the format and layout
+       * are only checked once.
+       */
+      void fetch(int x0, int x1, int y0, int y1, Real z[4]) const
+      {
+        assert(x0 >= 0 && x0 < m_width && y0 >= 0 && y0 < m_height);
+        assert(x1 >= 0 && x1 < m_width && y1 >= 0 && y1 < m_height);
+        std::size_t i[4];
+        if (m_layout == TiledDepthLayout) {
+          i[0] = tiledIndex(x0, y0);
+          i[1] = tiledIndex(x1, y0);
+          i[2] = tiledIndex(x0, y1);
+          i[3] = tiledIndex(x1, y1);
+        } else {
+          i[0] = x0 + m_width * y0;
+          i[1] = x1 + m_width * y0;
+          i[2] = x0 + m_width * y1;
+          i[3] = x1 + m_width * y1;
+        }
+
+        switch (m_format) {
+          case FloatDepthFormat:
+            for (int j = 0; j < 4; ++j)
+              z[j] = decode(m_floats[i[j]]);
+            break;
+          case Unorm16DepthFormat:
+            for (int j = 0; j < 4; ++j)
+              z[j] = decode(m_unorms[i[j]]);
+            break;
+          default:
+            for (int j = 0; j < 4; ++j)
+              z[j] = m_doubles[i[j]];
+            break;
+        }
+      }
+
+    private:
+      std::size_t index(int x, int y) const
+      {
+        return m_layout == TiledDepthLayout ? tiledIndex(x, y) : x + m_width * y;
+      }
+
+      /**
+       * Spread the 3 low bits of @p v to bits 0, 2 and 4.
+       */
+      static std::size_t spread(int v)
+      {
+        return (v & 1) | ((v & 2) << 1) | ((v & 4) << 2);
+      }
+
+      std::size_t tiledIndex(int x, int y) const
+      {
+        std::size_t tile = (x >> 3) + m_tilesX * static_cast<std::size_t>(y >> 3);
+        return (tile << 6) | spread(x) | (spread(y) << 1);
+      }
+
+      Real value(std::size_t i) const
+      {
+        switch (m_format) {
+          case FloatDepthFormat:
+            return decode(m_floats[i]);
+          case Unorm16DepthFormat:
+            return decode(m_unorms[i]);
+          default:
+            return m_doubles[i];
+        }
+      }
+
+      static Real decode(float v)
+      {
+        // infinity marks the pixels without geometry
+        return v < std::numeric_limits<float>::infinity() ? v : std::numeric_limits<Real>::max();
+      }
+
+      Real decode(std::uint16_t v) const
+      {
+        return v < unormEmpty ? m_offset + v * m_scale : std::numeric_limits<Real>::max();
+      }
+
+      enum { unormEmpty = 0xffff }; // the value for pixels without geometry
+
+      std::vector<Real> m_doubles;
+      std::vector<float> m_floats;
+      std::vector<std::uint16_t> m_unorms;
+      DepthFormat m_format;
+      DepthLayout m_layout;
+      int m_width;
+      int m_height;
+      int m_tilesX;
+      Real m_offset; // unorm 0
+      Real m_scale; // unorm step
+  };
+
+}
+
+#endif
@@ -1,11 +1,29 @@
 #include "mesh.h"
 #include "utility.h"
 #include "transform.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <map>
+#include <queue>
+#include <limits>
+#include <set>
+#include <cstdint>
+#include <atomic>
 
 namespace GFX {
 
+  std::size_t Mesh::nextRevision()
+  {
+    // 0 is never used so it can mark data not built from a mesh
+    static std::atomic<std::size_t> revision(0);
+    return ++revision;
+  }
+
   void Mesh::setFaceColor(int index, const Color &color)
   {
+    markModified();
     assert(index < m_faces.size());
 
     if (m_colors.size() < m_vertices.size())
@@ -18,6 +36,7 @@ namespace GFX {
 
   void Mesh::setVertexColor(int index, const Color &color)
   {
+    markModified();
     assert(index < m_vertices.size());
 
     if (m_colors.size() < m_vertices.size())
@@ -28,6 +47,7 @@ namespace GFX {
 
   void Mesh::computeNormals(bool smooth)
   {
+    markModified();
     m_normals.clear();
 
     for (std::size_t i = 0; i < m_faces.size(); ++i) {
@@ -50,25 +70,125 @@ namespace GFX {
     if (!smooth)
       return;
 
-    std::vector<vec4> normals;
+    // sum the normals of the faces in the same order as the vertices and faces
+    std::vector<std::vector<std::size_t> > adjacent = samePositionFaces();
+    std::vector<vec4> normals(m_vertices.size());
     for (std::size_t i = 0; i < m_vertices.size(); ++i) {
       vec4 normal(vec4::Zero());
-      for (std::size_t j = 0; j < m_vertices.size(); ++j) {
-        Real dist = (m_vertices[i] - m_vertices[j]).norm();
-        if (dist < 0.00001)
-          for (std::size_t k = 0; k < m_faces.size(); ++k)
-            if (std::find(m_faces[k].begin(), m_faces[k].end(), j) != m_faces[k].end())
-              normal += m_normals[k];
-      }
+      for (std::size_t k : adjacent[i])
+        normal += m_normals[k];
       normal.normalize();
-      normals.push_back(normal);
+      normals[i] = normal;
     }
 
     m_normals.swap(normals);
   }
 
+  void Mesh::computeCreaseNormals(Real creaseAngle)
+  {
+    markModified();
+    m_normals.clear();
+
+    // the face normals (zero for points and lines)
+    std::vector<vec4> faceNormals(m_faces.size(), vec4::Zero());
+    for (std::size_t f = 0; f < m_faces.size(); ++f)
+      if (m_faces[f].size() >= 3) {
+        vec3 AB = (m_vertices[m_faces[f][1]] - m_vertices[m_faces[f][0]]).head<3>();
+        vec3 AC = (m_vertices[m_faces[f][2]] - m_vertices[m_faces[f][0]]).head<3>();
+        faceNormals[f].head<3>() = AB.cross(AC).normalized();
+      }
+
+    std::vector<std::vector<std::size_t> > adjacent = samePositionFaces();
+    const Real minCos = std::cos(creaseAngle);
+    const bool vertexColors = m_colors.size() == m_vertices.size();
+    const bool vertexTexCoords = m_texCoords.size() == m_vertices.size();
+
+    // the new vertices for every old vertex, one per distinct normal
+    std::vector<std::vector<int> > copies(m_vertices.size());
+    std::vector<vec4> vertices;
+    std::vector<Color> colors;
+    std::vector<vec2> texCoords;
+    for (std::size_t f = 0; f < m_faces.size(); ++f)
+      for (int &v : m_faces[f]) {
+        vec4 normal(vec4::Zero());
+        if (m_faces[f].size() >= 3) {
+          for (std::size_t k : adjacent[v])
+            if (k == f || faceNormals[k].dot(faceNormals[f]) >= minCos)
+              normal += faceNormals[k];
+          normal.normalize();
+        }
+
+        int index = -1;
+        for (int copy : copies[v])
+          if (m_normals[copy] == normal)
+            index = copy;
+
+        if (index < 0) {
+          index = vertices.size();
+          copies[v].push_back(index);
+          vertices.push_back(m_vertices[v]);
+          m_normals.push_back(normal);
+          if (vertexColors)
+            colors.push_back(m_colors[v]);
+          if (vertexTexCoords)
+            texCoords.push_back(m_texCoords[v]);
+        }
+
+        v = index;
+      }
+
+    m_vertices.swap(vertices);
+    if (vertexColors)
+      m_colors.swap(colors);
+    if (vertexTexCoords)
+      m_texCoords.swap(texCoords);
+  }
+
+  std::vector<std::vector<std::size_t> > Mesh::samePositionFaces() const
+  {
+    // the faces containing every vertex
+    std::vector<std::vector<std::size_t> > vertexFaces(m_vertices.size());
+    for (std::size_t k = 0; k < m_faces.size(); ++k)
+      for (std::size_t j = 0; j < m_faces[k].size(); ++j)
+        if (std::find(m_faces[k].begin(), m_faces[k].begin() + j, m_faces[k][j]) == m_faces[k].begin() + j)
+          vertexFaces[m_faces[k][j]].push_back(k);
+
+    // vertices sorted by x to find the vertices at the same position
+    const Real epsilon = 0.00001;
+    std::vector<std::size_t> order(m_vertices.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+      order[i] = i;
+    std::sort(order.begin(), order.end(), [this] (std::size_t a, std::size_t b) {
+      return m_vertices[a].x() < m_vertices[b].x();
+    });
+
+    std::vector<std::vector<std::size_t> > adjacent(m_vertices.size());
+    std::vector<std::size_t> same;
+    for (std::size_t p = 0; p < order.size(); ++p) {
+      std::size_t i = order[p];
+
+      // all vertices within epsilon (including i)
+      std::size_t first = p, last = p + 1;
+      while (first > 0 && m_vertices[i].x() - m_vertices[order[first - 1]].x() < epsilon)
+        --first;
+      while (last < order.size() && m_vertices[order[last]].x() - m_vertices[i].x() < epsilon)
+        ++last;
+      same.clear();
+      for (std::size_t q = first; q < last; ++q)
+        if ((m_vertices[i] - m_vertices[order[q]]).norm() < epsilon)
+          same.push_back(order[q]);
+      std::sort(same.begin(), same.end());
+
+      for (std::size_t j : same)
+        adjacent[i].insert(adjacent[i].end(), vertexFaces[j].begin(), vertexFaces[j].end());
+    }
+
+    return adjacent;
+  }
+
   void Mesh::triangulate()
   {
+    markModified();
     std::size_t numFaces = m_faces.size();
     for (std::size_t i = 0; i < numFaces; ++i) {
       Face face = m_faces[i];
@@ -83,6 +203,174 @@ namespace GFX {
     }
   }
 
+  Real Mesh::averageCacheMissRatio(std::size_t cacheSize) const
+  {
+    if (m_faces.empty())
+      return 0.0;
+
+    // FIFO cache: a vertex is cached if it was loaded less than cacheSize misses ago
+    std::vector<std::size_t> loaded(m_vertices.size(), std::numeric_limits<std::size_t>::max());
+    std::size_t misses = 0;
+    for (std::size_t i = 0; i < m_faces.size(); ++i)
+      for (std::size_t j = 0; j < m_faces[i].size(); ++j) {
+        std::size_t &t = loaded[m_faces[i][j]];
+        if (t == std::numeric_limits<std::size_t>::max() || misses - t >= cacheSize)
+          t = misses++;
+      }
+
+    return static_cast<Real>(misses) / m_faces.size();
+  }
+
+  namespace {
+
+    /**
+     * @brief Vertex score for the vertex cache optimization (Forsyth).
+     *
+     * @param position The position in the LRU cache (-1 if not cached).
+     * @param remaining The number of triangles that still use the vertex.
+     */
+    Real vertexCacheScore(int position, int remaining, std::size_t cacheSize)
+    {
+      if (!remaining)
+        return -1.0;
+
+      Real score = 0.0;
+      if (position >= 0) {
+        if (position < 3)
+          // the vertices of the last triangle get a fixed score so the next
+          // triangle does not simply reuse the same edge
+          score = 0.75;
+        else
+          score = std::pow(1.0 - static_cast<Real>(position - 3) / (cacheSize - 3), 1.5);
+      }
+
+      // boost vertices with few remaining triangles to avoid leaving isolated triangles
+      return score + 2.0 * std::pow(static_cast<Real>(remaining), -0.5);
+    }
+
+  }
+
+  std::pair<Real, Real> Mesh::optimizeVertexCache(std::size_t cacheSize)
+  {
+    Real before = averageCacheMissRatio(cacheSize);
+
+    std::size_t numFaces = m_faces.size();
+    for (std::size_t i = 0; i < numFaces; ++i)
+      if (m_faces[i].size() != 3)
+        return std::make_pair(before, before);
+    cacheSize = std::max<std::size_t>(cacheSize, 4);
+
+    // the triangles for every vertex, the first remaining[v] are not emitted yet
+    std::vector<int> remaining(m_vertices.size(), 0);
+    for (std::size_t i = 0; i < numFaces; ++i)
+      for (int j = 0; j < 3; ++j)
+        ++remaining[m_faces[i][j]];
+
+    std::vector<std::size_t> offsets(m_vertices.size() + 1, 0);
+    for (std::size_t v = 0; v < m_vertices.size(); ++v)
+      offsets[v + 1] = offsets[v] + remaining[v];
+
+    std::vector<int> vertexFaces(offsets.back());
+    std::vector<std::size_t> fill(offsets.begin(), offsets.end() - 1);
+    for (std::size_t i = 0; i < numFaces; ++i)
+      for (int j = 0; j < 3; ++j)
+        vertexFaces[fill[m_faces[i][j]]++] = i;
+
+    std::vector<int> position(m_vertices.size(), -1);
+    std::vector<Real> vertexScores(m_vertices.size());
+    for (std::size_t v = 0; v < m_vertices.size(); ++v)
+      vertexScores[v] = vertexCacheScore(-1, remaining[v], cacheSize);
+
+    std::vector<Real> faceScores(numFaces);
+    std::vector<bool> emitted(numFaces, false);
+    int best = -1;
+    for (std::size_t i = 0; i < numFaces; ++i) {
+      const Face &face = m_faces[i];
+      faceScores[i] = vertexScores[face[0]] + vertexScores[face[1]] + vertexScores[face[2]];
+      if (best < 0 || faceScores[i] > faceScores[best])
+        best = i;
+    }
+
+    std::vector<int> order;
+    order.reserve(numFaces);
+    std::vector<int> cache, nextCache;
+    std::size_t cursor = 0;
+
+    while (order.size() < numFaces) {
+      if (best < 0) {
+        // nothing in the cache can be used, continue with the next triangle
+        while (emitted[cursor])
+          ++cursor;
+        best = cursor;
+      }
+
+      order.push_back(best);
+      emitted[best] = true;
+      const Face &face = m_faces[best];
+
+      // remove the triangle from the remaining triangles of its vertices
+      for (int j = 0; j < 3; ++j) {
+        int v = face[j];
+        int *faces = &vertexFaces[offsets[v]];
+        for (int k = 0; k < remaining[v]; ++k)
+          if (faces[k] == best) {
+            std::swap(faces[k], faces[remaining[v] - 1]);
+            break;
+          }
+        --remaining[v];
+      }
+
+      // the triangle's vertices move to the front of the cache
+      nextCache.assign(face.begin(), face.end());
+      for (std::size_t k = 0; k < cache.size(); ++k)
+        if (cache[k] != face[0] && cache[k] != face[1] && cache[k] != face[2])
+          nextCache.push_back(cache[k]);
+
+      for (std::size_t k = 0; k < nextCache.size(); ++k)
+        position[nextCache[k]] = k < cacheSize ? k : -1;
+
+      // update the scores of all vertices that were or are cached
+      best = -1;
+      Real bestScore = -1.0;
+      for (std::size_t k = 0; k < nextCache.size(); ++k) {
+        int v = nextCache[k];
+        vertexScores[v] = vertexCacheScore(position[v], remaining[v], cacheSize);
+      }
+      for (std::size_t k = 0; k < nextCache.size(); ++k) {
+        int v = nextCache[k];
+        for (int l = 0; l < remaining[v]; ++l) {
+          int f = vertexFaces[offsets[v] + l];
+          const Face &other = m_faces[f];
+          faceScores[f] = vertexScores[other[0]] + vertexScores[other[1]] + vertexScores[other[2]];
+          if (k < cacheSize && faceScores[f] > bestScore) {
+            best = f;
+            bestScore = faceScores[f];
+          }
+        }
+      }
+
+      if (nextCache.size() > cacheSize)
+        nextCache.resize(cacheSize);
+      cache.swap(nextCache);
+    }
+
+    // apply the new order to the faces and the face normals
+    markModified();
+    std::vector<Face> faces(numFaces);
+    for (std::size_t i = 0; i < numFaces; ++i)
+      faces[i].swap(m_faces[order[i]]);
+    m_faces.swap(faces);
+
+    if (m_normals.size() == numFaces) {
+      std::vector<vec4> normals(numFaces);
+      for (std::size_t i = 0; i < numFaces; ++i)
+        normals[i] = m_normals[order[i]];
+      m_normals.swap(normals);
+    }
+
+    return std::make_pair(before, averageCacheMissRatio(cacheSize));
+  }
+
   std::vector<Real> Mesh::triangleAttributes(bool normals, bool colors, bool texCoords, std::size_t extra)
   {
     std::vector<Real> attr;
@@ -520,94 +808,275 @@ namespace GFX {
     return mesh;
   }
 
-  std::shared_ptr<Mesh> Mesh::sphere(int n)
+  std::shared_ptr<Mesh> Mesh::sphere(int n, bool normals)
   {
     std::shared_ptr<Mesh> mesh(new Mesh);
 
+    // a negative n is not subdivided
+    n = std::max(n, 0);
+
+    // an icosahedron subdivided n times has 10 * 4^n + 2 vertices and 20 * 4^n faces
+    // (the vertex indices are ints, more than 13 subdivisions can't be indexed anyway)
+    const int levels = std::min(n, 13);
+    std::size_t numVertices = 10 * (std::size_t(1) << (2 * levels)) + 2;
+    std::size_t numFaces = 20 * (std::size_t(1) << (2 * levels));
+
     Real sqrt_5_2 = std::sqrt(5.0) / 2.0;
     Real pi_2_5 = 2.0 * M_PI / 5.0;
     Real pi_5 = M_PI / 5.0;
 
-    std::vector<GFX::vec3> verts0;
-    verts0.push_back(GFX::vec3(0.0, 0.0, sqrt_5_2));
-    verts0.push_back(GFX::vec3(std::cos(0.0 * pi_2_5), std::sin(0.0 * pi_2_5), 0.5));
-    verts0.push_back(GFX::vec3(std::cos(1.0 * pi_2_5), std::sin(1.0 * pi_2_5), 0.5));
-    verts0.push_back(GFX::vec3(std::cos(2.0 * pi_2_5), std::sin(2.0 * pi_2_5), 0.5));
-    verts0.push_back(GFX::vec3(std::cos(3.0 * pi_2_5), std::sin(3.0 * pi_2_5), 0.5));
-    verts0.push_back(GFX::vec3(std::cos(4.0 * pi_2_5), std::sin(4.0 * pi_2_5), 0.5));
-    verts0.push_back(GFX::vec3(std::cos(pi_5 + 0.0 * pi_2_5), std::sin(pi_5 + 0.0 * pi_2_5), -0.5));
-    verts0.push_back(GFX::vec3(std::cos(pi_5 + 1.0 * pi_2_5), std::sin(pi_5 + 1.0 * pi_2_5), -0.5));
-    verts0.push_back(GFX::vec3(std::cos(pi_5 + 2.0 * pi_2_5), std::sin(pi_5 + 2.0 * pi_2_5), -0.5));
-    verts0.push_back(GFX::vec3(std::cos(pi_5 + 3.0 * pi_2_5), std::sin(pi_5 + 3.0 * pi_2_5), -0.5));
-    verts0.push_back(GFX::vec3(std::cos(pi_5 + 4.0 * pi_2_5), std::sin(pi_5 + 4.0 * pi_2_5), -0.5));
-    verts0.push_back(GFX::vec3(0.0, 0.0, -sqrt_5_2));
-
-    std::vector<GFX::Mesh::Face> faces0;
-    faces0.push_back(GFX::Mesh::make_face(0, 1, 2));
-    faces0.push_back(GFX::Mesh::make_face(0, 2, 3));
-    faces0.push_back(GFX::Mesh::make_face(0, 3, 4));
-    faces0.push_back(GFX::Mesh::make_face(0, 4, 5));
-    faces0.push_back(GFX::Mesh::make_face(0, 5, 1));
-    faces0.push_back(GFX::Mesh::make_face(1, 6, 2));
-    faces0.push_back(GFX::Mesh::make_face(2, 6, 7));
-    faces0.push_back(GFX::Mesh::make_face(2, 7, 3));
-    faces0.push_back(GFX::Mesh::make_face(3, 7, 8));
-    faces0.push_back(GFX::Mesh::make_face(3, 8, 4));
-    faces0.push_back(GFX::Mesh::make_face(4, 8, 9));
-    faces0.push_back(GFX::Mesh::make_face(4, 9, 5));
-    faces0.push_back(GFX::Mesh::make_face(5, 9, 10));
-    faces0.push_back(GFX::Mesh::make_face(5, 10, 1));
-    faces0.push_back(GFX::Mesh::make_face(1, 10, 6));
-    faces0.push_back(GFX::Mesh::make_face(11, 7, 6));
-    faces0.push_back(GFX::Mesh::make_face(11, 8, 7));
-    faces0.push_back(GFX::Mesh::make_face(11, 9, 8));
-    faces0.push_back(GFX::Mesh::make_face(11, 10, 9));
-    faces0.push_back(GFX::Mesh::make_face(11, 6, 10));
-
-    std::vector<GFX::vec3> verts1;
-    std::vector<GFX::Mesh::Face> faces1;
+    std::vector<GFX::vec3> verts;
+    verts.reserve(numVertices);
+    verts.push_back(GFX::vec3(0.0, 0.0, sqrt_5_2));
+    for (int i = 0; i < 5; ++i)
+      verts.push_back(GFX::vec3(std::cos(i * pi_2_5), std::sin(i * pi_2_5), 0.5));
+    for (int i = 0; i < 5; ++i)
+      verts.push_back(GFX::vec3(std::cos(pi_5 + i * pi_2_5), std::sin(pi_5 + i * pi_2_5), -0.5));
+    verts.push_back(GFX::vec3(0.0, 0.0, -sqrt_5_2));
+
+    const int icosahedronFaces[20][3] = {
+      {  0,  1,  2 }, {  0,  2,  3 }, {  0,  3,  4 }, {  0,  4,  5 },
+      {  0,  5,  1 }, {  1,  6,  2 }, {  2,  6,  7 }, {  2,  7,  3 },
+      {  3,  7,  8 }, {  3,  8,  4 }, {  4,  8,  9 }, {  4,  9,  5 },
+      {  5,  9, 10 }, {  5, 10,  1 }, {  1, 10,  6 }, { 11,  7,  6 },
+      { 11,  8,  7 }, { 11,  9,  8 }, { 11, 10,  9 }, { 11,  6, 10 }
+    };
+
+    std::vector<int> faces0, faces1;
+    faces0.reserve(3 * numFaces);
+    faces1.reserve(3 * numFaces);
+    for (int i = 0; i < 20; ++i)
+      faces0.insert(faces0.end(), icosahedronFaces[i], icosahedronFaces[i] + 3);
+
+    // edge (min, max) -> index of the midpoint vertex
+    std::unordered_map<std::uint64_t, int> midpoints;
 
     for (int i = 0; i < n; ++i) {
-      verts1.clear();
       faces1.clear();
+      midpoints.clear();
+      // a closed triangle mesh has 3/2 edges per face
+      midpoints.reserve(faces0.size() / 2);
+
+      auto midpoint = [&] (int a, int b) -> int {
+        std::uint64_t key = (std::uint64_t(std::min(a, b)) << 32) | std::uint32_t(std::max(a, b));
+        auto it = midpoints.find(key);
+        if (it != midpoints.end())
+          return it->second;
+        int v = verts.size();
+        verts.push_back((verts[a] + verts[b]) / 2.0);
+        midpoints[key] = v;
+        return v;
+      };
+
+      for (std::size_t j = 0; j < faces0.size(); j += 3) {
+        int A = faces0[j];
+        int B = faces0[j + 1];
+        int C = faces0[j + 2];
+
+        int D = midpoint(A, B);
+        int E = midpoint(A, C);
+        int F = midpoint(B, C);
+
+        int newFaces[] = { A, D, E, B, F, D, C, E, F, D, F, E };
+        faces1.insert(faces1.end(), newFaces, newFaces + 12);
+      }
 
-      for (std::size_t j = 0; j < faces0.size(); ++j) {
-        const GFX::Mesh::Face &face = faces0[j];
+      faces1.swap(faces0);
+    }
 
-        GFX::vec3 A(verts0[face[0]]);
-        GFX::vec3 B(verts0[face[1]]);
-        GFX::vec3 C(verts0[face[2]]);
+    assert(verts.size() == numVertices);
+    assert(faces0.size() == 3 * numFaces);
 
-        GFX::vec3 D((A + B) / 2.0);
-        GFX::vec3 E((A + C) / 2.0);
-        GFX::vec3 F((B + C) / 2.0);
+    mesh->m_vertices.reserve(numVertices);
+    mesh->m_faces.reserve(numFaces);
+    if (normals)
+      mesh->m_normals.reserve(numVertices);
 
-        int v = verts1.size();
+    for (std::size_t i = 0; i < verts.size(); ++i) {
+      verts[i].normalize();
+      mesh->addVertex(verts[i]);
+      // the normal of a point on the unit sphere is the point itself
+      if (normals)
+        mesh->m_normals.push_back(vec4(verts[i].x(), verts[i].y(), verts[i].z(), 0.0));
+    }
+    for (std::size_t i = 0; i < faces0.size(); i += 3)
+      mesh->addFace(faces0[i], faces0[i + 1], faces0[i + 2]);
 
-        verts1.push_back(A);
-        verts1.push_back(B);
-        verts1.push_back(C);
-        verts1.push_back(D);
-        verts1.push_back(E);
-        verts1.push_back(F);
+    return mesh;
+  }
 
-        faces1.push_back(GFX::Mesh::make_face(v    , v + 3, v + 4));
-        faces1.push_back(GFX::Mesh::make_face(v + 1, v + 5, v + 3));
-        faces1.push_back(GFX::Mesh::make_face(v + 2, v + 4, v + 5));
-        faces1.push_back(GFX::Mesh::make_face(v + 3, v + 5, v + 4));
-      }
+  std::shared_ptr<Mesh> Mesh::mengerSponge(int n)
+  {
+    int size = 1;
+    for (int i = 0; i < n; ++i)
+      size *= 3;
+
+    // bit k of ones[i] is set if base 3 digit k of i is 1
+    std::vector<int> ones(size, 0);
+    for (int i = 0; i < size; ++i)
+      for (int k = 0, j = i; k < n; ++k, j /= 3)
+        if (j % 3 == 1)
+          ones[i] |= 1 << k;
+
+    // a voxel is removed if two of its coordinates have a 1 digit at the same position
+    auto filled = [&] (const int *c) -> bool {
+      for (int i = 0; i < 3; ++i)
+        if (c[i] < 0 || c[i] >= size)
+          return false;
+      int a = ones[c[0]], b = ones[c[1]], d = ones[c[2]];
+      return !((a & b) | (a & d) | (b & d));
+    };
 
-      verts1.swap(verts0);
-      faces1.swap(faces0);
+    std::shared_ptr<Mesh> mesh(new Mesh);
+
+    // grid point -> vertex index
+    std::unordered_map<std::uint64_t, int> indices;
+    auto key = [&] (const int *c) -> std::uint64_t {
+      return (std::uint64_t(c[0]) * (size + 1) + c[1]) * (size + 1) + c[2];
+    };
+    auto vertex = [&] (const int *c) -> int {
+      auto it = indices.find(key(c));
+      if (it != indices.end())
+        return it->second;
+      int index = mesh->m_vertices.size();
+      mesh->addVertex(-1.0 + 2.0 * c[0] / size, -1.0 + 2.0 * c[1] / size, -1.0 + 2.0 * c[2] / size);
+      indices[key(c)] = index;
+      return index;
+    };
+
+    // a merged rectangle [i, i + w] x [j, j + h] in plane p perpendicular to axis d
+    struct Rectangle
+    {
+      int d, p, side, i, j, w, h;
+    };
+    std::vector<Rectangle> rectangles;
+
+    std::vector<char> mask(size * size);
+
+    for (int d = 0; d < 3; ++d) {
+      int u = (d + 1) % 3;
+      int v = (d + 2) % 3;
+
+      // side 0: faces pointing along -d, side 1: faces pointing along +d
+      for (int side = 0; side < 2; ++side)
+        for (int p = 0; p <= size; ++p) {
+          // mark the voxel faces in plane p between a filled and an empty voxel
+          int c[3];
+          c[d] = p;
+          for (int j = 0; j < size; ++j)
+            for (int i = 0; i < size; ++i) {
+              c[u] = i;
+              c[v] = j;
+              c[d] = side ? p - 1 : p;
+              bool inside = filled(c);
+              c[d] = side ? p : p - 1;
+              bool outside = filled(c);
+              mask[j * size + i] = inside && !outside;
+            }
+
+          // merge the marked faces into rectangles
+          for (int j = 0; j < size; ++j)
+            for (int i = 0; i < size; ) {
+              if (!mask[j * size + i]) {
+                ++i;
+                continue;
+              }
+
+              int w = 1;
+              while (i + w < size && mask[j * size + i + w])
+                ++w;
+
+              int h = 1;
+              for (; j + h < size; ++h) {
+                bool row = true;
+                for (int k = 0; k < w && row; ++k)
+                  row = mask[(j + h) * size + i + k];
+                if (!row)
+                  break;
+              }
+
+              for (int l = 0; l < h; ++l)
+                for (int k = 0; k < w; ++k)
+                  mask[(j + l) * size + i + k] = 0;
+
+              const int du[4] = { 0, w, w, 0 };
+              const int dv[4] = { 0, 0, h, h };
+              c[d] = p;
+              for (int k = 0; k < 4; ++k) {
+                c[u] = i + du[k];
+                c[v] = j + dv[k];
+                vertex(c);
+              }
+
+              Rectangle rectangle = { d, p, side, i, j, w, h };
+              rectangles.push_back(rectangle);
+
+              i += w;
+            }
+        }
     }
 
-    for (std::size_t i = 0; i < verts0.size(); ++i)
-      verts0[i].normalize();
+    // A corner of one rectangle can lie on an edge of a larger rectangle (in
+    // the same plane or where two planes meet). Rasterizing such a T-junction
+    // leaves cracks, so every rectangle also gets the vertices on its edges.
+    struct BoundaryVertex
+    {
+      int index, u, v;
+    };
+    std::vector<BoundaryVertex> boundary;
+    for (auto &r : rectangles) {
+      int u = (r.d + 1) % 3;
+      int v = (r.d + 2) % 3;
+
+      // walk the edges counter clockwise in the (u, v) plane
+      const int du[4] = { 1, 0, -1, 0 };
+      const int dv[4] = { 0, 1, 0, -1 };
+      const int length[4] = { r.w, r.h, r.w, r.h };
+      boundary.clear();
+      int c[3];
+      c[r.d] = r.p;
+      c[u] = r.i;
+      c[v] = r.j;
+      for (int k = 0; k < 4; ++k)
+        for (int l = 0; l < length[k]; ++l, c[u] += du[k], c[v] += dv[k]) {
+          auto it = indices.find(key(c));
+          if (it != indices.end()) {
+            BoundaryVertex vertex = { it->second, c[u], c[v] };
+            boundary.push_back(vertex);
+          }
+        }
 
-    for (std::size_t i = 0; i < verts0.size(); ++i)
-      mesh->addVertex(verts0[i]);
-    for (std::size_t i = 0; i < faces0.size(); ++i)
-      mesh->addFace(faces0[i]);
+      // counter clockwise when seen from outside
+      if (!r.side)
+        std::reverse(boundary.begin() + 1, boundary.end());
+
+      if (boundary.size() == 4) {
+        mesh->addFace(boundary[0].index, boundary[1].index, boundary[2].index, boundary[3].index);
+        continue;
+      }
+
+      // the vertices on the edges make a fan degenerate, instead cut off
+      // corners (a, b, c not on a line) until a triangle is left, a corner is
+      // not cut off if the rest would be a line
+      auto collinear = [] (const BoundaryVertex &a, const BoundaryVertex &b, const BoundaryVertex &c) -> bool {
+        return (b.u - a.u) * (c.v - a.v) == (b.v - a.v) * (c.u - a.u);
+      };
+      std::size_t k = 0;
+      while (boundary.size() > 3) {
+        std::size_t m = boundary.size();
+        const BoundaryVertex &prev = boundary[(k + m - 1) % m];
+        const BoundaryVertex &next = boundary[(k + 1) % m];
+        if (collinear(prev, boundary[k], next) || collinear(prev, next, boundary[(k + 2) % m])) {
+          k = (k + 1) % m;
+          continue;
+        }
+        mesh->addFace(prev.index, boundary[k].index, next.index);
+        boundary.erase(boundary.begin() + k);
+        if (k == boundary.size())
+          k = 0;
+      }
+      mesh->addFace(boundary[0].index, boundary[1].index, boundary[2].index);
+    }
 
     return mesh;
   }
@@ -635,98 +1104,582 @@ namespace GFX {
     return mesh;
   }
 
-  std::shared_ptr<Mesh> Mesh::thickFigure(Mesh *figure, Real radius, int n, int m)
+  void Mesh::thickFigureTransforms(const Mesh &figure, Real radius, std::vector<mat4> &spheres, std::vector<mat4> &cylinders)
   {
-    // generate unit sphere
+    // place a sphere on every point of the figure
+    spheres.reserve(spheres.size() + figure.vertices().size());
+    for (std::size_t i = 0; i < figure.vertices().size(); ++i) {
+      const vec4 &p = figure.vertices()[i];
+      spheres.push_back(translationMatrix(p.x(), p.y(), p.z()) * scaleMatrix(radius));
+    }
+
+    // collect the unique edges, edges shared by two faces only get one cylinder
+    std::vector<std::pair<int, int> > edges;
+    std::set<std::pair<int, int> > seen;
+    for (std::size_t i = 0; i < figure.faces().size(); ++i) {
+      const Face &face = figure.faces()[i];
+      for (std::size_t j = 0; j < face.size(); ++j) {
+        int v1 = face[j];
+        int v2 = face[(j + 1) % face.size()];
+        std::pair<int, int> edge(std::min(v1, v2), std::max(v1, v2));
+        if (seen.insert(edge).second)
+          edges.push_back(edge);
+      }
+    }
+
+    // replace face edges with cylinders
+    cylinders.reserve(cylinders.size() + edges.size());
+    for (auto edge : edges) {
+      const vec4 &tmp1 = figure.vertices()[edge.first];
+      const vec4 &tmp2 = figure.vertices()[edge.second];
+      const vec3 p1(tmp1.x(), tmp1.y(), tmp1.z());
+      const vec3 p2(tmp2.x(), tmp2.y(), tmp2.z());
+
+      vec3 axis = vec3(0, 0, 1).cross((p2 - p1).normalized());
+      Real angle = std::acos(vec3(0, 0, 1).dot((p2 - p1).normalized()));
+
+      if (std::abs(angle - M_PI) < 10e-4)
+        axis = vec3(1, 0, 0);
+      else if (std::abs(angle) < 10e-4)
+        axis = vec3(1, 0, 0);
+
+      Real h = (p1 - p2).norm();
+
+      mat4 translation = translationMatrix(p1.x(), p1.y(), p1.z());
+      mat4 rotation = rotationMatrix(angle, axis.x(), axis.y(), axis.z());
+      mat4 scale = scaleMatrix(radius, radius, h);
+      cylinders.push_back(translation * rotation * scale);
+    }
+  }
+
+  std::shared_ptr<Mesh> Mesh::thickFigure(const Mesh *figure, Real radius, int n, int m)
+  {
+    std::vector<mat4> sphereTransforms, cylinderTransforms;
+    thickFigureTransforms(*figure, radius, sphereTransforms, cylinderTransforms);
+
+    // unit sphere and unit height cylinder
     std::shared_ptr<Mesh> sphere = Mesh::sphere(m);
-    // scale using radius
-    for (std::size_t i = 0; i < sphere->vertices().size(); ++i)
-      sphere->vertices()[i] *= radius;
+    std::shared_ptr<Mesh> cylinder = Mesh::cylinder(n, 1.0, false);
 
     std::shared_ptr<Mesh> mesh(new Mesh);
+    mesh->m_vertices.reserve(sphereTransforms.size() * sphere->vertices().size() +
+        cylinderTransforms.size() * cylinder->vertices().size());
+    mesh->m_faces.reserve(sphereTransforms.size() * sphere->faces().size() +
+        cylinderTransforms.size() * cylinder->faces().size());
 
     // replace points in figure with spheres
-    for (std::size_t i = 0; i < figure->vertices().size(); ++i) {
-      std::size_t offset = mesh->vertices().size();
+    for (auto &transform : sphereTransforms)
+      mesh->append(*sphere, transform);
+    // replace face edges with cylinders
+    for (auto &transform : cylinderTransforms)
+      mesh->append(*cylinder, transform);
+
+    return mesh;
+  }
 
-      Real dx = figure->vertices()[i].x();
-      Real dy = figure->vertices()[i].y();
-      Real dz = figure->vertices()[i].z();
+  namespace {
+
+    /**
+     * @brief Generate the points of a 3D fractal.
+     *
+     * @param points0 The points of the (centered) unit figure.
+     * @param nrIterations The number of iterations.
+     * @param scale The fractal scale.
+     * @param points Output: h^nrIterations copies of the h points.
+     */
+    void fractalPoints(const std::vector<vec4> &points0, int nrIterations, Real scale, std::vector<vec4> &points)
+    {
+      std::size_t h = points0.size();
+      std::vector<vec4> lastPoints;
+      std::vector<vec4> scaled(h), translated(h * h);
+
+      points = points0;
+
+      for (int i = 0; i < nrIterations; ++i) {
+        // the scaled figure for this level, translated[j * h + l] is point l
+        // of the small figure translated to have point j in the origin
+        Real f = std::pow(scale, i + 1);
+        for (std::size_t l = 0; l < h; ++l)
+          scaled[l] = points0[l] / f;
+        for (std::size_t j = 0; j < h; ++j)
+          for (std::size_t l = 0; l < h; ++l)
+            translated[j * h + l] = scaled[l] - scaled[j];
+
+        lastPoints.swap(points);
+        points.resize(lastPoints.size() * h);
+
+        // translate small figure to point k on figure from previous iteration
+        parallel_for(0, lastPoints.size(), [&] (std::size_t k) {
+          const vec4 *figure = &translated[(k % h) * h];
+          vec4 *out = &points[k * h];
+          for (std::size_t l = 0; l < h; ++l)
+            out[l] = figure[l] + lastPoints[k];
+        });
+      }
+    }
+
+    std::vector<vec4> centered(const Mesh &unit, vec4 &center)
+    {
+      std::vector<vec4> points0 = unit.vertices();
+
+      // compute center
+      center = vec4::Zero();
+      for (std::size_t i = 0; i < points0.size(); ++i)
+        center += points0[i];
+      // center figure
+      for (std::size_t i = 0; i < points0.size(); ++i)
+        points0[i] -= center;
+
+      return points0;
+    }
 
-      // copy sphere vertices
-      for (auto v : sphere->vertices())
-        mesh->addVertex(v.x() + dx, v.y() + dy, v.z() + dz);
+  }
+
+  std::shared_ptr<Mesh> Mesh::fractal(const Mesh &unit, int nrIterations, Real scale)
+  {
+    vec4 center;
+    std::vector<vec4> points0 = centered(unit, center);
+    std::size_t h = points0.size();
 
-      // copy sphere faces
-      for (auto face : sphere->faces()) {
-        Mesh::Face newFace;
-        for (auto v : face)
-          newFace.push_back(offset + v);
-        mesh->addFace(newFace);
+    std::vector<vec4> points;
+    fractalPoints(points0, nrIterations, scale, points);
+
+    std::size_t numCopies = points.size() / h;
+
+    std::shared_ptr<Mesh> mesh(new Mesh);
+    mesh->m_vertices.resize(points.size());
+    mesh->m_faces.resize(numCopies * unit.faces().size());
+
+    parallel_for(0, points.size(), [&] (std::size_t i) {
+      mesh->m_vertices[i] = vec4(points[i].x(), points[i].y(), points[i].z(), 1.0);
+    });
+
+    // every copy has the faces of the unit figure
+    parallel_for(0, numCopies, [&] (std::size_t c) {
+      std::size_t offset = c * h;
+      for (std::size_t i = 0; i < unit.faces().size(); ++i) {
+        Face &face = mesh->m_faces[c * unit.faces().size() + i];
+        face = unit.faces()[i];
+        for (std::size_t j = 0; j < face.size(); ++j)
+          face[j] += offset;
       }
+    }, 64);
+
+    return mesh;
+  }
+
+  void Mesh::fractalTransforms(const Mesh &unit, int nrIterations, Real scale, std::vector<mat4> &transforms)
+  {
+    vec4 center;
+    std::vector<vec4> points0 = centered(unit, center);
+    std::size_t h = points0.size();
+
+    mat4 unitTransform = translationMatrix(-center.x(), -center.y(), -center.z());
+    if (!nrIterations) {
+      transforms.push_back(unitTransform);
+      return;
     }
 
-    // replace face edges with cylinders
-    for (std::size_t i = 0; i < figure->faces().size(); ++i) {
-      std::vector<std::pair<int, int> > edges;
-      for (std::size_t j = 1; j < figure->faces()[i].size(); ++j) {
-        int v1 = figure->faces()[i][j - 1];
-        int v2 = figure->faces()[i][j];
-        edges.push_back(std::make_pair(std::min(v1, v2), std::max(v1, v2)));
-        //edges.push_back(std::make_pair(v1, v2));
+    // the points of the previous iteration, the small figures are placed on these
+    std::vector<vec4> points;
+    fractalPoints(points0, nrIterations - 1, scale, points);
+
+    Real f = std::pow(scale, nrIterations);
+    unitTransform = scaleMatrix(1.0 / f) * unitTransform;
+
+    std::size_t offset = transforms.size();
+    transforms.resize(offset + points.size());
+
+    // small figure k has its point (k % h) on point k of the previous iteration
+    parallel_for(0, points.size(), [&] (std::size_t k) {
+      vec4 t = points[k] - points0[k % h] / f;
+      transforms[offset + k] = translationMatrix(t.x(), t.y(), t.z()) * unitTransform;
+    });
+  }
+
+  void Mesh::append(const Mesh &mesh, const mat4 &transform)
+  {
+    markModified();
+    std::size_t offset = m_vertices.size();
+
+    // copy transformed vertices
+    for (auto &v : mesh.vertices())
+      m_vertices.push_back(transform * v);
+
+    // copy faces
+    for (auto &face : mesh.faces()) {
+      m_faces.push_back(face);
+      for (auto &v : m_faces.back())
+        v += offset;
+    }
+  }
+
+  namespace {
+
+    /**
+     * @brief Quadric error metric edge collapse (Garland and Heckbert).
+     *
+     * Every vertex has a quadric that measures the squared distance to the
+     * planes of the original faces around it. Edges are collapsed in order of
+     * increasing cost, the merged vertex is placed at the position that
+     * minimizes the sum of both quadrics.
+     */
+    class Simplifier
+    {
+      public:
+        Simplifier(const Mesh &mesh);
+
+        /**
+         * @brief Collapse edges until at most @p numFaces faces are left.
+         */
+        void collapse(std::size_t numFaces);
+
+        std::size_t numFaces() const
+        {
+          return m_numFaces;
+        }
+
+        /**
+         * @brief The largest distance to the original surface (estimated from the quadrics).
+         */
+        Real error() const
+        {
+          return std::sqrt(m_cost);
+        }
+
+        std::shared_ptr<Mesh> mesh() const;
+
+      private:
+        struct Triangle
+        {
+          int v[3];
+        };
+
+        struct Collapse
+        {
+          Real cost;
+          int v1, v2;
+          unsigned int stamp1, stamp2;
+          vec3 target;
+
+          // std::priority_queue puts the largest element first
+          bool operator<(const Collapse &other) const
+          {
+            return cost > other.cost;
+          }
+        };
+
+        vec3 normal(const Triangle &t) const
+        {
+          const vec3 &a = m_positions[t.v[0]];
+          return (m_positions[t.v[1]] - a).cross(m_positions[t.v[2]] - a);
+        }
+
+        Real cost(const mat4 &Q, const vec3 &v) const
+        {
+          vec4 p(v.x(), v.y(), v.z(), 1.0);
+          return std::max<Real>(0.0, p.dot(Q * p));
+        }
+
+        void addPlane(int v, const vec3 &n, const vec3 &p);
+        void push(int v1, int v2);
+        void neighbors(int v, std::set<int> &result) const;
+        bool canCollapse(int v1, int v2, const vec3 &target) const;
+
+        std::vector<vec3> m_positions;
+        std::vector<mat4> m_quadrics;
+        std::vector<Triangle> m_triangles;
+        std::vector<bool> m_removed;
+        std::vector<std::vector<int> > m_vertexFaces;
+        std::vector<unsigned int> m_stamps;
+        std::priority_queue<Collapse> m_heap;
+        std::size_t m_numFaces;
+        Real m_cost;
+    };
+
+    Simplifier::Simplifier(const Mesh &mesh) : m_numFaces(0), m_cost(0.0)
+    {
+      const std::vector<vec4> &vertices = mesh.vertices();
+      m_positions.reserve(vertices.size());
+      for (std::size_t i = 0; i < vertices.size(); ++i)
+        m_positions.push_back(vertices[i].head<3>());
+
+      m_quadrics.resize(vertices.size(), mat4::Zero());
+      m_vertexFaces.resize(vertices.size());
+      m_stamps.resize(vertices.size(), 0);
+
+      // triangulate polygons as a fan
+      for (std::size_t i = 0; i < mesh.faces().size(); ++i) {
+        const Mesh::Face &face = mesh.faces()[i];
+        for (std::size_t j = 1; j + 1 < face.size(); ++j) {
+          Triangle t = { { face[0], face[j], face[j + 1] } };
+          m_triangles.push_back(t);
+        }
       }
-      int v1 = figure->faces()[i][figure->faces()[i].size() - 1];
-      int v2 = figure->faces()[i][0];
-      edges.push_back(std::make_pair(std::min(v1, v2), std::max(v1, v2)));
-      //edges.push_back(std::make_pair(v1, v2));
-
-      edges.resize(std::unique(edges.begin(), edges.end()) - edges.begin());
-
-      for (auto edge : edges) {
-        //std::cout << "edge: " << edge.first << "-" << edge.second << std::endl;
-        const vec4 &tmp1 = figure->vertices()[edge.first];
-        const vec4 &tmp2 = figure->vertices()[edge.second];
-        const vec3 p1(tmp1.x(), tmp1.y(), tmp1.z());
-        const vec3 p2(tmp2.x(), tmp2.y(), tmp2.z());
-
-        vec3 axis = vec3(0, 0, 1).cross((p2 - p1).normalized());
-        Real angle = std::acos(vec3(0, 0, 1).dot((p2 - p1).normalized()));
-
-        if (std::abs(angle - M_PI) < 10e-4)
-          axis = vec3(1, 0, 0);
-        else if (std::abs(angle) < 10e-4)
-          axis = vec3(1, 0, 0);
-
-        //std::cout << "axis: " << axis.x() << ", " << axis.y() << ", " << axis.z() << std::endl;
-        //std::cout << "angle: " << angle << std::endl;
-
-        mat4 rotation = rotationMatrix(angle, axis.x(), axis.y(), axis.z());
-        mat4 scale = scaleMatrix(radius, radius, 1.0);
-        mat4 transform = rotation * scale;
-
-        Real h = (p1 - p2).norm();
-        std::shared_ptr<Mesh> cylinder = Mesh::cylinder(n, h, false);
-        for (std::size_t i = 0; i < cylinder->vertices().size(); ++i)
-          cylinder->vertices()[i] = transform * cylinder->vertices()[i];
-
-        std::size_t offset = mesh->vertices().size();
-
-        // copy cylinder vertices
-        for (auto v : cylinder->vertices())
-          mesh->addVertex(v.x() + p1.x(), v.y() + p1.y(), v.z() + p1.z());
-
-        // copy cylinder faces
-        for (auto face : cylinder->faces()) {
-          Mesh::Face newFace;
-          for (auto v : face)
-            newFace.push_back(offset + v);
-          mesh->addFace(newFace);
+      m_removed.resize(m_triangles.size(), false);
+      m_numFaces = m_triangles.size();
+
+      // face quadrics and edge usage
+      std::map<std::pair<int, int>, int> edges;
+      for (std::size_t i = 0; i < m_triangles.size(); ++i) {
+        const Triangle &t = m_triangles[i];
+        vec3 n = normal(t);
+        if (n.norm() > 0.0) {
+          n.normalize();
+          for (int j = 0; j < 3; ++j)
+            addPlane(t.v[j], n, m_positions[t.v[0]]);
+        }
+
+        for (int j = 0; j < 3; ++j) {
+          m_vertexFaces[t.v[j]].push_back(i);
+          int a = t.v[j], b = t.v[(j + 1) % 3];
+          ++edges[std::make_pair(std::min(a, b), std::max(a, b))];
         }
+      }
 
+      // keep open boundaries in place with planes perpendicular to the boundary faces
+      for (std::size_t i = 0; i < m_triangles.size(); ++i) {
+        const Triangle &t = m_triangles[i];
+        vec3 n = normal(t);
+        for (int j = 0; j < 3; ++j) {
+          int a = t.v[j], b = t.v[(j + 1) % 3];
+          if (edges[std::make_pair(std::min(a, b), std::max(a, b))] != 1)
+            continue;
+          vec3 m = (m_positions[b] - m_positions[a]).cross(n);
+          if (m.norm() == 0.0)
+            continue;
+          m.normalize();
+          addPlane(a, m, m_positions[a]);
+          addPlane(b, m, m_positions[a]);
+        }
       }
+
+      for (auto &edge : edges)
+        push(edge.first.first, edge.first.second);
     }
 
-    return mesh;
+    void Simplifier::addPlane(int v, const vec3 &n, const vec3 &p)
+    {
+      vec4 plane(n.x(), n.y(), n.z(), -n.dot(p));
+      m_quadrics[v] += plane * plane.transpose();
+    }
+
+    void Simplifier::push(int v1, int v2)
+    {
+      mat4 Q = m_quadrics[v1] + m_quadrics[v2];
+      const vec3 &p1 = m_positions[v1];
+      const vec3 &p2 = m_positions[v2];
+
+      Collapse c;
+      c.v1 = v1;
+      c.v2 = v2;
+      c.stamp1 = m_stamps[v1];
+      c.stamp2 = m_stamps[v2];
+      // the midpoint is kept if no candidate below has a lower cost (e.g. NaN
+      // costs for degenerate quadrics)
+      c.target = 0.5 * (p1 + p2);
+      c.cost = std::numeric_limits<Real>::max();
+
+      // the optimal position minimizes v^T Q v
+      mat4 A = Q;
+      A.row(3) << 0.0, 0.0, 0.0, 1.0;
+      Eigen::FullPivLU<mat4> lu(A);
+      bool optimal = false;
+      if (lu.isInvertible()) {
+        vec3 target = lu.solve(vec4(0.0, 0.0, 0.0, 1.0)).head<3>();
+        // reject solutions far away from the edge (nearly singular quadrics)
+        optimal = (target - c.target).norm() <= (p2 - p1).norm();
+        if (optimal) {
+          c.target = target;
+          c.cost = cost(Q, target);
+        }
+      }
+
+      if (!optimal) {
+        // use the best of the end points and the midpoint
+        vec3 candidates[3] = { p1, p2, 0.5 * (p1 + p2) };
+        for (int i = 0; i < 3; ++i) {
+          Real cc = cost(Q, candidates[i]);
+          if (cc < c.cost) {
+            c.cost = cc;
+            c.target = candidates[i];
+          }
+        }
+      }
+
+      m_heap.push(c);
+    }
+
+    void Simplifier::neighbors(int v, std::set<int> &result) const
+    {
+      for (std::size_t i = 0; i < m_vertexFaces[v].size(); ++i) {
+        int f = m_vertexFaces[v][i];
+        if (m_removed[f])
+          continue;
+        for (int j = 0; j < 3; ++j)
+          if (m_triangles[f].v[j] != v)
+            result.insert(m_triangles[f].v[j]);
+      }
+    }
+
+    bool Simplifier::canCollapse(int v1, int v2, const vec3 &target) const
+    {
+      // link condition: the only common neighbors are the opposite vertices
+      // of the faces that share the edge (keeps the mesh manifold)
+      std::set<int> n1, n2;
+      neighbors(v1, n1);
+      neighbors(v2, n2);
+      std::size_t shared = 0;
+      for (std::size_t i = 0; i < m_vertexFaces[v1].size(); ++i) {
+        const Triangle &t = m_triangles[m_vertexFaces[v1][i]];
+        if (!m_removed[m_vertexFaces[v1][i]] && (t.v[0] == v2 || t.v[1] == v2 || t.v[2] == v2))
+          ++shared;
+      }
+      std::size_t common = 0;
+      for (auto v : n1)
+        common += n2.count(v);
+      if (common != shared)
+        return false;
+
+      // the links may not share an edge either: faces (v1, a, b) and (v2, a, b)
+      // would become the same face (e.g. collapsing an edge of a tetrahedron)
+      std::set<std::pair<int, int> > opposite;
+      int ends[2] = { v1, v2 };
+      for (int e = 0; e < 2; ++e)
+        for (std::size_t i = 0; i < m_vertexFaces[ends[e]].size(); ++i) {
+          int f = m_vertexFaces[ends[e]][i];
+          if (m_removed[f])
+            continue;
+          const Triangle &t = m_triangles[f];
+          if (t.v[0] == ends[1 - e] || t.v[1] == ends[1 - e] || t.v[2] == ends[1 - e])
+            continue;
+          int a = -1, b = -1;
+          for (int j = 0; j < 3; ++j)
+            if (t.v[j] != ends[e])
+              (a < 0 ? a : b) = t.v[j];
+          std::pair<int, int> edge(std::min(a, b), std::max(a, b));
+          if (e == 0)
+            opposite.insert(edge);
+          else if (opposite.count(edge))
+            return false;
+        }
+
+      // faces that keep existing may not flip or degenerate
+      for (int e = 0; e < 2; ++e)
+        for (std::size_t i = 0; i < m_vertexFaces[ends[e]].size(); ++i) {
+          int f = m_vertexFaces[ends[e]][i];
+          if (m_removed[f])
+            continue;
+          Triangle t = m_triangles[f];
+          if (t.v[0] == ends[1 - e] || t.v[1] == ends[1 - e] || t.v[2] == ends[1 - e])
+            continue;
+
+          vec3 before = normal(t);
+          vec3 p[3];
+          for (int j = 0; j < 3; ++j)
+            p[j] = t.v[j] == ends[e] ? target : m_positions[t.v[j]];
+          vec3 after = (p[1] - p[0]).cross(p[2] - p[0]);
+          if (after.dot(before) <= 0.0)
+            return false;
+        }
+
+      return true;
+    }
+
+    void Simplifier::collapse(std::size_t numFaces)
+    {
+      while (m_numFaces > numFaces && !m_heap.empty()) {
+        Collapse c = m_heap.top();
+        m_heap.pop();
+
+        // skip edges that changed since they were queued
+        if (c.stamp1 != m_stamps[c.v1] || c.stamp2 != m_stamps[c.v2])
+          continue;
+        if (!canCollapse(c.v1, c.v2, c.target))
+          continue;
+
+        // remove the faces sharing the edge and move the faces of v2 to v1
+        std::vector<int> &faces1 = m_vertexFaces[c.v1];
+        std::vector<int> &faces2 = m_vertexFaces[c.v2];
+        for (std::size_t i = 0; i < faces2.size(); ++i) {
+          int f = faces2[i];
+          if (m_removed[f])
+            continue;
+          Triangle &t = m_triangles[f];
+          if (t.v[0] == c.v1 || t.v[1] == c.v1 || t.v[2] == c.v1) {
+            m_removed[f] = true;
+            --m_numFaces;
+            continue;
+          }
+          for (int j = 0; j < 3; ++j)
+            if (t.v[j] == c.v2)
+              t.v[j] = c.v1;
+          faces1.push_back(f);
+        }
+        faces2.clear();
+
+        std::vector<int> live;
+        for (std::size_t i = 0; i < faces1.size(); ++i)
+          if (!m_removed[faces1[i]])
+            live.push_back(faces1[i]);
+        faces1.swap(live);
+
+        m_positions[c.v1] = c.target;
+        m_quadrics[c.v1] += m_quadrics[c.v2];
+        ++m_stamps[c.v1];
+        ++m_stamps[c.v2];
+        m_cost = std::max(m_cost, c.cost);
+
+        std::set<int> n;
+        neighbors(c.v1, n);
+        for (auto v : n)
+          push(c.v1, v);
+      }
+    }
+
+    std::shared_ptr<Mesh> Simplifier::mesh() const
+    {
+      std::shared_ptr<Mesh> mesh(new Mesh);
+      std::vector<int> indices(m_positions.size(), -1);
+
+      for (std::size_t i = 0; i < m_triangles.size(); ++i) {
+        if (m_removed[i])
+          continue;
+        const Triangle &t = m_triangles[i];
+        for (int j = 0; j < 3; ++j)
+          if (indices[t.v[j]] < 0) {
+            indices[t.v[j]] = mesh->vertices().size();
+            mesh->addVertex(m_positions[t.v[j]]);
+          }
+        mesh->addFace(indices[t.v[0]], indices[t.v[1]], indices[t.v[2]]);
+      }
+
+      return mesh;
+    }
+
+  }
+
+  std::shared_ptr<Mesh> Mesh::simplify(std::size_t numFaces, Real *error) const
+  {
+    Simplifier simplifier(*this);
+    simplifier.collapse(numFaces);
+    if (error)
+      *error = simplifier.error();
+    return simplifier.mesh();
+  }
+
+  void Mesh::levelsOfDetail(std::size_t minFaces, std::vector<std::shared_ptr<Mesh> > &levels, std::vector<Real> &errors) const
+  {
+    Simplifier simplifier(*this);
+    while (simplifier.numFaces() / 2 >= minFaces) {
+      std::size_t numFaces = simplifier.numFaces();
+      simplifier.collapse(numFaces / 2);
+      // stop if no more edges can be collapsed
+      if (simplifier.numFaces() > numFaces * 3 / 4)
+        break;
+      levels.push_back(simplifier.mesh());
+      errors.push_back(simplifier.error());
+    }
   }
 
 }
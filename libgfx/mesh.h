@@ -14,62 +14,73 @@ namespace GFX {
     public:
       typedef std::vector<int> Face;
 
-      Mesh() : m_color(Color::red())
+      Mesh() : m_color(Color::red()), m_revision(nextRevision())
       {
       }
 
       void addVertex(Real x, Real y, Real z)
       {
+        markModified();
         m_vertices.push_back(vec4(x, y, z, 1.0));
       }
 
       void addVertex(const vec3 &v)
       {
+        markModified();
         m_vertices.push_back(vec4(v.x(), v.y(), v.z(), 1.0));
       }
 
       void addVertex(const vec4 &v)
       {
+        markModified();
         m_vertices.push_back(v);
       }
 
       void addVertex(const std::vector<float> &v)
       {
+        markModified();
         m_vertices.push_back(vec4(v[0], v[1], v[2], 1.0));
       }
 
       void addVertex(const std::vector<double> &v)
       {
+        markModified();
         m_vertices.push_back(vec4(v[0], v[1], v[2], 1.0));
       }
 
       void addNormal(Real x, Real y, Real z)
       {
+        markModified();
         m_normals.push_back(vec4(x, y, z, 1.0));
       }
 
       void addNormal(const vec3 &v)
       {
+        markModified();
         m_normals.push_back(vec4(v.x(), v.y(), v.z(), 1.0));
       }
 
       void addNormal(const vec4 &v)
       {
+        markModified();
         m_normals.push_back(v);
       }
 
       void addNormal(const std::vector<float> &v)
       {
+        markModified();
         m_normals.push_back(vec4(v[0], v[1], v[2], 1.0));
       }
 
       void addNormal(const std::vector<double> &v)
       {
+        markModified();
         m_normals.push_back(vec4(v[0], v[1], v[2], 1.0));
       }
 
       void addFace(int i, int j)
       {
+        markModified();
         m_faces.resize(m_faces.size() + 1);
         m_faces.back().push_back(i);
         m_faces.back().push_back(j);
@@ -77,6 +88,7 @@ namespace GFX {
 
       void addFace(int i, int j, int k)
       {
+        markModified();
         m_faces.resize(m_faces.size() + 1);
         m_faces.back().push_back(i);
         m_faces.back().push_back(j);
@@ -85,6 +97,7 @@ namespace GFX {
 
       void addFace(int i, int j, int k, int l)
       {
+        markModified();
         m_faces.resize(m_faces.size() + 1);
         m_faces.back().push_back(i);
         m_faces.back().push_back(j);
@@ -94,6 +107,7 @@ namespace GFX {
 
       void addFace(int i, int j, int k, int l, int m)
       {
+        markModified();
         m_faces.resize(m_faces.size() + 1);
         m_faces.back().push_back(i);
         m_faces.back().push_back(j);
@@ -104,6 +118,7 @@ namespace GFX {
 
       void addFace(const std::vector<int> &face)
       {
+        markModified();
         m_faces.push_back(face);
       }
 
@@ -112,6 +127,9 @@ namespace GFX {
         return m_vertices;
       }
 
+      /**
+       * @brief Get the vertices to modify them, call markModified() after.
+       */
       std::vector<vec4>& vertices()
       {
         return m_vertices;
@@ -122,6 +140,59 @@ namespace GFX {
         return m_faces;
       }
 
+      /**
+       * @brief Get the faces to modify them, call markModified() after.
+       */
+      std::vector<std::vector<int> >& faces()
+      {
+        return m_faces;
+      }
+
+      const std::vector<vec4>& normals() const
+      {
+        return m_normals;
+      }
+
+      const std::vector<Color>& colors() const
+      {
+        return m_colors;
+      }
+
+      const std::vector<vec2>& texCoords() const
+      {
+        return m_texCoords;
+      }
+
+      const Color& color() const
+      {
+        return m_color;
+      }
+
+      /**
+       * @brief Get the revision of the mesh.
+       *
+       * The revision changes every time the mesh is modified by its member
+       * functions or markModified(). It is used to invalidate data derived
+       * from the mesh such as a VertexBuffer. Copies of a mesh share the
+       * revision until one of them is modified.
+       */
+      std::size_t revision() const
+      {
+        return m_revision;
+      }
+
+      /**
+       * @brief Change the revision after writing through the non-const
+       * vertices() or faces().
+       *
+       * Not needed for a new mesh that is filled before it is used, it
+       * already has a revision of its own.
+       */
+      void markModified()
+      {
+        m_revision = nextRevision();
+      }
+
       /**
        * @brief Set a single color for the entire mesh.
        *
@@ -129,6 +200,7 @@ namespace GFX {
        */
       void setColor(const Color &color)
       {
+        markModified();
         m_color = color;
       }
 
@@ -156,8 +228,55 @@ namespace GFX {
        */
       void computeNormals(bool smooth = false);
 
+      /**
+       * @brief Compute vertex normals that are only smooth across edges where
+       * the faces meet at less than @p creaseAngle.
+       *
+       * The normal of a face corner is the average of the normals of the
+       * faces around the vertex within @p creaseAngle of the face (vertices
+       * at the same position are treated as one). Vertices with more than one
+       * normal (e.g. the corners of a cube) are duplicated and vertices
+       * without faces are removed, so afterwards there is one normal per
+       * vertex.
+       *
+       * @param creaseAngle The angle in radians.
+       */
+      void computeCreaseNormals(Real creaseAngle);
+
       void triangulate();
 
+      /**
+       * @brief Compute the average cache miss ratio (ACMR).
+       *
+       * This is the number of vertices that have to be transformed per face
+       * for a FIFO cache of transformed vertices. It ranges from about 0.5
+       * for an optimal order of a large triangle mesh to 3.
+       *
+       * @param cacheSize The number of vertices in the cache.
+       */
+      Real averageCacheMissRatio(std::size_t cacheSize = 32) const;
+
+      /**
+       * @brief Reorder the triangles to reuse transformed vertices (Forsyth).
+       *
+       * Triangles are emitted greedily based on a score for their vertices:
+       * vertices that are recently used and vertices with few remaining
+       * triangles score high. Face normals are reordered with the faces. The
+       * mesh must be triangulated (see triangulate()), otherwise it is not
+       * changed.
+       *
+       * @param cacheSize The number of vertices in the cache.
+       *
+       * @return The average cache miss ratio before and after reordering.
+       */
+      std::pair<Real, Real> optimizeVertexCache(std::size_t cacheSize = 32);
+
+      /**
+       * @brief Get the attributes for the triangles as doubles.
+       *
+       * The attributes are rebuilt on every call, use a VertexBuffer to keep
+       * compact attributes that are only rebuilt when the mesh changes.
+       */
       std::vector<Real> triangleAttributes(bool normals = false, bool colors = false, bool texCoords = false, std::size_t extra = 0);
 
       std::vector<Real> quadAttributes(bool normals = false, bool colors = false, bool texCoords = false, std::size_t extra = 0);
@@ -173,20 +292,138 @@ namespace GFX {
       static std::shared_ptr<Mesh> buckyball();
       static std::shared_ptr<Mesh> cone(int n, Real h);
       static std::shared_ptr<Mesh> cylinder(int n, Real h, bool TandB = true);
-      static std::shared_ptr<Mesh> sphere(int n);
+      /**
+       * @brief Create a unit sphere by subdividing an icosahedron.
+       *
+       * Each subdivision splits every triangle in four. Midpoints are shared
+       * between neighbouring triangles so every vertex is stored once.
+       *
+       * @param n The number of subdivisions (a negative n is the icosahedron).
+       * @param normals Also store per vertex normals (equal to the vertices).
+       */
+      static std::shared_ptr<Mesh> sphere(int n, bool normals = false);
       static std::shared_ptr<Mesh> torus(int n, int m, Real R, Real r);
 
-      static std::shared_ptr<Mesh> thickFigure(Mesh *figure, Real radius, int n, int m);
+      /**
+       * @brief Create a Menger sponge filling the cube [-1, 1]^3.
+       *
+       * The sponge is generated on a voxel grid with 3^n voxels along each
+       * axis. Only the voxel faces between filled and empty space are kept and
+       * coplanar faces are merged into rectangles. This gives far fewer faces
+       * than drawing 20^n cubes. The rectangles are split at the corners of
+       * their neighbours so the surface has no T-junctions (cracks).
+       *
+       * @param n The number of iterations.
+       */
+      static std::shared_ptr<Mesh> mengerSponge(int n);
+
+      /**
+       * @brief Create a 3D fractal.
+       *
+       * In every iteration, each point of the figure is replaced by a copy of
+       * the unit figure scaled by 1 / scale^i. The result has h^nrIterations
+       * copies of the unit figure (with h the number of unit points). The work
+       * per level is split over all cores.
+       *
+       * @param unit The unit figure.
+       * @param nrIterations The number of iterations.
+       * @param scale The fractal scale.
+       */
+      static std::shared_ptr<Mesh> fractal(const Mesh &unit, int nrIterations, Real scale);
+
+      /**
+       * @brief Compute the instance transforms for a 3D fractal.
+       *
+       * Instead of copying the geometry, this computes the transforms to place
+       * the unit figure for every copy in fractal(). The transforms are
+       * appended to @p transforms.
+       *
+       * @param unit The unit figure.
+       * @param nrIterations The number of iterations.
+       * @param scale The fractal scale.
+       * @param transforms Output: the transforms for the unit figure.
+       */
+      static void fractalTransforms(const Mesh &unit, int nrIterations, Real scale, std::vector<mat4> &transforms);
+
+      /**
+       * @brief Append the faces of another mesh.
+       *
+       * @param mesh The mesh to append.
+       * @param transform Transformation applied to the vertices of @p mesh.
+       */
+      void append(const Mesh &mesh, const mat4 &transform);
+
+      /**
+       * @brief Create a thick figure by replacing the points of a figure with
+       * spheres and its edges with cylinders.
+       *
+       * @param figure The figure.
+       * @param radius The radius for the spheres and cylinders.
+       * @param n The number of sides for the cylinders.
+       * @param m The number of subdivisions for the spheres.
+       */
+      static std::shared_ptr<Mesh> thickFigure(const Mesh *figure, Real radius, int n, int m);
+
+      /**
+       * @brief Compute the instance transforms for a thick figure.
+       *
+       * Instead of copying the geometry, this computes the transforms to place
+       * a unit sphere (see sphere()) on every point of the figure and a unit
+       * height cylinder (see cylinder()) along every edge. An edge shared by
+       * two faces gets a single cylinder (the copies would coincide). The
+       * cylinders have no caps, so back faces have to be drawn.
+       *
+       * @param figure The figure.
+       * @param radius The radius for the spheres and cylinders.
+       * @param spheres Output: the transforms for the unit spheres.
+       * @param cylinders Output: the transforms for the unit height cylinders.
+       */
+      static void thickFigureTransforms(const Mesh &figure, Real radius, std::vector<mat4> &spheres, std::vector<mat4> &cylinders);
+
+      /**
+       * @brief Simplify the mesh using quadric error metric edge collapses.
+       *
+       * Polygons are triangulated first. Edges are collapsed in order of
+       * increasing error while keeping the mesh manifold and without flipping
+       * faces. Open boundaries are kept in place as much as possible.
+       *
+       * @param numFaces The target number of triangles.
+       * @param error Output: the largest distance to the original surface
+       * (estimated from the quadrics).
+       */
+      std::shared_ptr<Mesh> simplify(std::size_t numFaces, Real *error = 0) const;
+
+      /**
+       * @brief Compute a chain of simplified meshes.
+       *
+       * Every level has about half the triangles of the previous level. The
+       * quadrics of the original mesh are used for all levels so the errors
+       * are relative to the original surface.
+       *
+       * @param minFaces The minimum number of triangles for the last level.
+       * @param levels Output: the simplified meshes, most detailed first.
+       * @param errors Output: the error for every level (see simplify()).
+       */
+      void levelsOfDetail(std::size_t minFaces, std::vector<std::shared_ptr<Mesh> > &levels, std::vector<Real> &errors) const;
 
     private:
+      static std::size_t nextRevision();
+
+      /**
+       * @brief Get the faces around every vertex, including the faces of
+       * other vertices at the same position.
+       */
+      std::vector<std::vector<std::size_t> > samePositionFaces() const;
+
       void addVertexAttributes(std::vector<Real> &attr, int f, int v, bool normals, bool colors, bool texCoords);
 
       std::vector<vec4> m_vertices; //!< The vertices.
       std::vector<Face> m_faces; //!< The faces.
-      std::vector<vec4> m_normals; //!< The face normals.
+      std::vector<vec4> m_normals; //!< The face normals, or the vertex normals if there is one per vertex.
       std::vector<Color> m_colors; //!< Per vertex colors.
       std::vector<vec2> m_texCoords; //!< Per vertex texture coordinates.
       Color m_color; //!< Single color for entire mesh.
+      std::size_t m_revision; //!< Changes on every modification.
   };
 
 }
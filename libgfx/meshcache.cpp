@@ -0,0 +1,268 @@
+#include "meshcache.h"
+#include "meshio.h"
+
+#include <iterator>
+
+#include <sys/stat.h>
+
+namespace GFX {
+
+  namespace {
+
+    /**
+     * @brief Estimate the memory used by a mesh.
+     */
+    std::size_t meshBytes(const Mesh &mesh)
+    {
+      std::size_t bytes = (mesh.vertices().size() + mesh.normals().size()) * sizeof(vec4) +
+          mesh.colors().size() * sizeof(Color) + mesh.texCoords().size() * sizeof(vec2);
+      for (const Mesh::Face &face : mesh.faces())
+        bytes += sizeof(Mesh::Face) + face.capacity() * sizeof(int);
+      return bytes;
+    }
+
+  }
+
+  MeshCache& MeshCache::instance()
+  {
+    static MeshCache cache;
+    return cache;
+  }
+
+  std::size_t MeshCache::capacity() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_capacity;
+  }
+
+  void MeshCache::setCapacity(std::size_t capacity)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_capacity = capacity;
+    evict();
+  }
+
+  std::size_t MeshCache::fileCapacity() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_fileCapacity;
+  }
+
+  void MeshCache::setFileCapacity(std::size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_fileCapacity = bytes;
+    evict();
+  }
+
+  std::size_t MeshCache::size() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lru.size();
+  }
+
+  void MeshCache::clear()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_lru.clear();
+    m_index.clear();
+    m_meshes.clear();
+    m_fileBytes = 0;
+  }
+
+  void MeshCache::evict()
+  {
+    while (m_lru.size() > m_capacity)
+      erase(std::prev(m_lru.end()));
+
+    // drop the least recently used file meshes
+    List::iterator it = m_lru.end();
+    while (m_fileBytes > m_fileCapacity) {
+      --it;
+      if (it->bytes)
+        erase(it++);
+    }
+  }
+
+  void MeshCache::erase(List::iterator it)
+  {
+    m_index.erase(it->key);
+    m_meshes.erase(it->mesh.get());
+    m_fileBytes -= it->bytes;
+    m_lru.erase(it);
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::get(const Key &key, const std::function<std::shared_ptr<Mesh>()> &create)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto it = m_index.find(key);
+      if (it != m_index.end()) {
+        // move to front
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        return it->second->mesh;
+      }
+    }
+
+    // generate the mesh without holding the lock
+    std::shared_ptr<Mesh> mesh = create();
+    if (!mesh)
+      return mesh;
+    if (key.triangulated)
+      mesh->triangulate();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // another thread may have created the same mesh in the meantime
+    auto it = m_index.find(key);
+    if (it != m_index.end()) {
+      m_lru.splice(m_lru.begin(), m_lru, it->second);
+      return it->second->mesh;
+    }
+
+    m_lru.push_front(Entry(key, mesh, key.type == File ? meshBytes(*mesh) : 0));
+    m_fileBytes += m_lru.front().bytes;
+    m_index[key] = m_lru.begin();
+    m_meshes[mesh.get()] = m_lru.begin();
+    evict();
+
+    return mesh;
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::tetrahedron(bool triangulated)
+  {
+    return get(Key(Tetrahedron, triangulated), &Mesh::tetrahedron);
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::cube(bool triangulated)
+  {
+    return get(Key(Cube, triangulated), &Mesh::cube);
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::octahedron(bool triangulated)
+  {
+    return get(Key(Octahedron, triangulated), &Mesh::octahedron);
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::icosahedron(bool triangulated)
+  {
+    return get(Key(Icosahedron, triangulated), &Mesh::icosahedron);
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::dodecahedron(bool triangulated)
+  {
+    return get(Key(Dodecahedron, triangulated), &Mesh::dodecahedron);
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::buckyball(bool triangulated)
+  {
+    return get(Key(BuckyBall, triangulated), &Mesh::buckyball);
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::cone(int n, Real h, bool triangulated)
+  {
+    Key key(Cone, triangulated);
+    key.params.push_back(n);
+    key.params.push_back(h);
+    return get(key, [=] () { return Mesh::cone(n, h); });
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::cylinder(int n, Real h, bool TandB, bool triangulated)
+  {
+    Key key(Cylinder, triangulated);
+    key.params.push_back(n);
+    key.params.push_back(h);
+    key.params.push_back(TandB);
+    return get(key, [=] () { return Mesh::cylinder(n, h, TandB); });
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::sphere(int n, bool triangulated, bool normals)
+  {
+    Key key(Sphere, triangulated);
+    key.params.push_back(n);
+    key.params.push_back(normals);
+    return get(key, [=] () { return Mesh::sphere(n, normals); });
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::torus(int n, int m, Real R, Real r, bool triangulated)
+  {
+    Key key(Torus, triangulated);
+    key.params.push_back(n);
+    key.params.push_back(m);
+    key.params.push_back(R);
+    key.params.push_back(r);
+    return get(key, [=] () { return Mesh::torus(n, m, R, r); });
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::mengerSponge(int n, bool triangulated)
+  {
+    Key key(MengerSponge, triangulated);
+    key.params.push_back(n);
+    return get(key, [=] () { return Mesh::mengerSponge(n); });
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::file(const std::string &filename, bool triangulated)
+  {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+      return std::shared_ptr<const Mesh>();
+
+    Key key(File, triangulated);
+    key.params.push_back(st.st_size);
+    key.params.push_back(st.st_mtime);
+    key.filename = filename;
+    return get(key, [=] () { return readMesh(filename); });
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::levelOfDetail(const std::shared_ptr<const Mesh> &mesh, Real maxError)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto it = m_meshes.find(mesh.get());
+      if (it == m_meshes.end())
+        return mesh;
+      if (it->second->hasLevels)
+        return select(*it->second, maxError);
+    }
+
+    // simplify the mesh without holding the lock
+    std::vector<std::shared_ptr<Mesh> > levels;
+    std::vector<Real> errors;
+    mesh->levelsOfDetail(64, levels, errors);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_meshes.find(mesh.get());
+    if (it == m_meshes.end())
+      return mesh;
+
+    Entry &entry = *it->second;
+    if (entry.hasLevels)
+      return select(entry, maxError);
+
+    entry.levels.assign(levels.begin(), levels.end());
+    entry.errors = errors;
+    entry.hasLevels = true;
+
+    std::shared_ptr<const Mesh> level = select(entry, maxError);
+    // the levels of a file mesh count for its size
+    if (entry.bytes) {
+      for (const std::shared_ptr<Mesh> &simplified : levels) {
+        std::size_t bytes = meshBytes(*simplified);
+        entry.bytes += bytes;
+        m_fileBytes += bytes;
+      }
+      evict();
+    }
+
+    return level;
+  }
+
+  std::shared_ptr<const Mesh> MeshCache::select(const Entry &entry, Real maxError) const
+  {
+    // the errors increase with the level
+    std::shared_ptr<const Mesh> mesh = entry.mesh;
+    for (std::size_t i = 0; i < entry.levels.size() && entry.errors[i] <= maxError; ++i)
+      mesh = entry.levels[i];
+    return mesh;
+  }
+
+}
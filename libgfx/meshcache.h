@@ -0,0 +1,203 @@
+#ifndef GFX_MESHCACHE_H
+#define GFX_MESHCACHE_H
+
+#include "mesh.h"
+
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+
+namespace GFX {
+
+  /**
+   * @brief Process wide cache for primitive meshes.
+   *
+   * Generating primitives such as spheres and tori is expensive while the
+   * same parameters are often used by several figures (or several *.ini
+   * files rendered by the same process). The cache hands out immutable meshes
+   * that can be shared between figures since the per figure transformation
+   * is stored in the model matrix.
+   *
+   * The cache is thread-safe and holds at most capacity() meshes. When it is
+   * full, the least recently used mesh is dropped (meshes that are still in
+   * use stay alive through their shared_ptr). Meshes loaded from files can be
+   * much larger, their total size is also limited by fileCapacity().
+   */
+  class MeshCache
+  {
+    public:
+      enum Primitive {
+        Tetrahedron,
+        Cube,
+        Octahedron,
+        Icosahedron,
+        Dodecahedron,
+        BuckyBall,
+        Cone,
+        Cylinder,
+        Sphere,
+        Torus,
+        MengerSponge,
+        File
+      };
+
+      /**
+       * @brief Get the process wide cache.
+       */
+      static MeshCache& instance();
+
+      /**
+       * @brief Get the maximum number of cached meshes.
+       */
+      std::size_t capacity() const;
+
+      /**
+       * @brief Set the maximum number of cached meshes.
+       *
+       * Least recently used meshes are dropped if the cache holds more meshes.
+       */
+      void setCapacity(std::size_t capacity);
+
+      /**
+       * @brief Get the maximum number of bytes used by meshes loaded from
+       * files.
+       */
+      std::size_t fileCapacity() const;
+
+      /**
+       * @brief Set the maximum number of bytes used by meshes loaded from
+       * files.
+       *
+       * Least recently used file meshes are dropped if they use more memory.
+       * A single mesh above the limit is not cached at all.
+       */
+      void setFileCapacity(std::size_t bytes);
+
+      /**
+       * @brief Get the current number of cached meshes.
+       */
+      std::size_t size() const;
+
+      /**
+       * @brief Remove all meshes from the cache.
+       */
+      void clear();
+
+      std::shared_ptr<const Mesh> tetrahedron(bool triangulated = false);
+      std::shared_ptr<const Mesh> cube(bool triangulated = false);
+      std::shared_ptr<const Mesh> octahedron(bool triangulated = false);
+      std::shared_ptr<const Mesh> icosahedron(bool triangulated = false);
+      std::shared_ptr<const Mesh> dodecahedron(bool triangulated = false);
+      std::shared_ptr<const Mesh> buckyball(bool triangulated = false);
+      std::shared_ptr<const Mesh> cone(int n, Real h, bool triangulated = false);
+      std::shared_ptr<const Mesh> cylinder(int n, Real h, bool TandB = true, bool triangulated = false);
+
+      /**
+       * @brief Get a sphere (see Mesh::sphere()).
+       *
+       * @param normals Also store the exact per vertex normals.
+       */
+      std::shared_ptr<const Mesh> sphere(int n, bool triangulated = false, bool normals = false);
+      std::shared_ptr<const Mesh> torus(int n, int m, Real R, Real r, bool triangulated = false);
+      std::shared_ptr<const Mesh> mengerSponge(int n, bool triangulated = false);
+
+      /**
+       * @brief Get a mesh loaded from a file (see readMesh()).
+       *
+       * The file is identified by its name, size and modification time, so
+       * a file that changed is read again.
+       *
+       * @return The mesh or a null pointer if the file could not be read.
+       */
+      std::shared_ptr<const Mesh> file(const std::string &filename, bool triangulated = false);
+
+      /**
+       * @brief Get a simplified version of a cached mesh.
+       *
+       * The chain of simplified meshes (see Mesh::levelsOfDetail()) is
+       * computed the first time it is needed and cached together with the
+       * mesh.
+       *
+       * @param mesh A mesh returned by the cache.
+       * @param maxError The maximum distance to the original surface.
+       *
+       * @return The coarsest level with an error below @p maxError or @p mesh
+       * itself if it is not in the cache.
+       */
+      std::shared_ptr<const Mesh> levelOfDetail(const std::shared_ptr<const Mesh> &mesh, Real maxError);
+
+    private:
+      struct Key
+      {
+        Key(Primitive type_, bool triangulated_) : type(type_), triangulated(triangulated_)
+        {
+        }
+
+        bool operator<(const Key &other) const
+        {
+          if (type != other.type)
+            return type < other.type;
+          if (triangulated != other.triangulated)
+            return triangulated < other.triangulated;
+          if (params != other.params)
+            return params < other.params;
+          return filename < other.filename;
+        }
+
+        Primitive type;
+        bool triangulated;
+        std::vector<Real> params;
+        std::string filename;
+      };
+
+      struct Entry
+      {
+        Entry(const Key &key_, const std::shared_ptr<const Mesh> &mesh_, std::size_t bytes_)
+          : key(key_), mesh(mesh_), bytes(bytes_), hasLevels(false)
+        {
+        }
+
+        Key key;
+        std::shared_ptr<const Mesh> mesh;
+        std::size_t bytes; //!< The memory used by a file mesh, 0 for primitives.
+        bool hasLevels; //!< True if levels and errors are computed.
+        std::vector<std::shared_ptr<const Mesh> > levels; //!< Simplified meshes, most detailed first.
+        std::vector<Real> errors; //!< The error for every level.
+      };
+
+      typedef std::list<Entry> List;
+
+      MeshCache(std::size_t capacity = 64, std::size_t fileCapacity = std::size_t(1) << 30)
+        : m_capacity(capacity), m_fileCapacity(fileCapacity), m_fileBytes(0)
+      {
+      }
+
+      MeshCache(const MeshCache&);
+      MeshCache& operator=(const MeshCache&);
+
+      /**
+       * @brief Find the mesh for @p key or create (and cache) it using @p create.
+       */
+      std::shared_ptr<const Mesh> get(const Key &key, const std::function<std::shared_ptr<Mesh>()> &create);
+
+      void evict();
+      void erase(List::iterator it);
+
+      /**
+       * @brief Select the coarsest level of @p entry with an error below @p maxError.
+       */
+      std::shared_ptr<const Mesh> select(const Entry &entry, Real maxError) const;
+
+      mutable std::mutex m_mutex;
+      List m_lru; //!< Cached meshes, most recently used first.
+      std::map<Key, List::iterator> m_index; //!< Key to position in m_lru.
+      std::map<const Mesh*, List::iterator> m_meshes; //!< Mesh to position in m_lru.
+      std::size_t m_capacity;
+      std::size_t m_fileCapacity; //!< Maximum bytes for file meshes.
+      std::size_t m_fileBytes; //!< Bytes used by the cached file meshes.
+  };
+
+}
+
+#endif
@@ -0,0 +1,867 @@
+#include "meshio.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace GFX {
+
+  namespace {
+
+    /**
+     * @brief Read only memory mapped file.
+     */
+    class MappedFile
+    {
+      public:
+        MappedFile(const std::string &filename) : m_data(0), m_size(0)
+        {
+          int fd = ::open(filename.c_str(), O_RDONLY);
+          if (fd < 0)
+            return;
+
+          struct stat st;
+          if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+              m_data = static_cast<const char*>(data);
+              m_size = st.st_size;
+            }
+          }
+
+          ::close(fd);
+        }
+
+        ~MappedFile()
+        {
+          if (m_data)
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+
+        const char* data() const
+        {
+          return m_data;
+        }
+
+        std::size_t size() const
+        {
+          return m_size;
+        }
+
+      private:
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+
+        const char *m_data;
+        std::size_t m_size;
+    };
+
+    /**
+     * @brief Split [begin, end) in at most @p numChunks chunks of complete lines.
+     *
+     * @return The chunk boundaries (numChunks + 1 pointers).
+     */
+    std::vector<const char*> splitLines(const char *begin, const char *end, std::size_t numChunks)
+    {
+      std::vector<const char*> bounds(1, begin);
+      for (std::size_t i = 1; i < numChunks; ++i) {
+        const char *p = std::max(bounds.back(), begin + (end - begin) * i / numChunks);
+        while (p < end && p != begin && p[-1] != '\n')
+          ++p;
+        bounds.push_back(p);
+      }
+      bounds.push_back(end);
+      return bounds;
+    }
+
+    /**
+     * @brief The number of chunks to parse @p size bytes (at least 1 MB per chunk).
+     */
+    std::size_t chunkCount(std::size_t size, unsigned int numThreads)
+    {
+      std::size_t chunks = 4 * threadCount(numThreads);
+      return std::max<std::size_t>(1, std::min<std::size_t>(chunks, size >> 20));
+    }
+
+    inline const char* skipSpace(const char *p, const char *end)
+    {
+      while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        ++p;
+      return p;
+    }
+
+    inline const char* skipToken(const char *p, const char *end)
+    {
+      while (p < end && !std::isspace(static_cast<unsigned char>(*p)))
+        ++p;
+      return p;
+    }
+
+    inline const char* nextLine(const char *p, const char *end)
+    {
+      while (p < end && *p != '\n')
+        ++p;
+      return p < end ? p + 1 : end;
+    }
+
+    /**
+     * @brief Parse a real number on the current line.
+     *
+     * The mapped file is not null terminated so the token is copied before
+     * calling strtod().
+     */
+    bool parseReal(const char *&p, const char *end, Real &value)
+    {
+      p = skipSpace(p, end);
+      char buffer[64];
+      std::size_t n = 0;
+      while (p < end && n < sizeof(buffer) - 1 && !std::isspace(static_cast<unsigned char>(*p)))
+        buffer[n++] = *p++;
+      buffer[n] = 0;
+
+      char *last;
+      value = std::strtod(buffer, &last);
+      return n && last == buffer + n;
+    }
+
+    /**
+     * @brief Parse an integer on the current line.
+     *
+     * Values that don't fit in a long are clamped.
+     */
+    bool parseInt(const char *&p, const char *end, long &value)
+    {
+      p = skipSpace(p, end);
+      bool negative = false;
+      if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+      if (p == end || !std::isdigit(static_cast<unsigned char>(*p)))
+        return false;
+
+      const long max = std::numeric_limits<long>::max();
+      long v = 0;
+      while (p < end && std::isdigit(static_cast<unsigned char>(*p))) {
+        int digit = *p++ - '0';
+        v = v <= (max - digit) / 10 ? 10 * v + digit : max;
+      }
+      value = negative ? -v : v;
+      return true;
+    }
+
+    /**
+     * @brief Convert a vertex index from a file, -1 (invalid) if it is not
+     * a valid int index.
+     */
+    inline int vertexIndex(double index)
+    {
+      return index >= 0.0 && index <= std::numeric_limits<int>::max() ? static_cast<int>(index) : -1;
+    }
+
+    inline bool isKeyword(const char *p, const char *end, char c)
+    {
+      return p + 1 < end && p[0] == c && (p[1] == ' ' || p[1] == '\t');
+    }
+
+    std::string extension(const std::string &filename)
+    {
+      std::size_t dot = filename.rfind('.');
+      if (dot == std::string::npos)
+        return std::string();
+      std::string ext = filename.substr(dot + 1);
+      for (std::size_t i = 0; i < ext.size(); ++i)
+        ext[i] = std::tolower(static_cast<unsigned char>(ext[i]));
+      return ext;
+    }
+
+    //
+    // PLY
+    //
+
+    enum PlyType {
+      PlyInvalid,
+      PlyInt8,
+      PlyUInt8,
+      PlyInt16,
+      PlyUInt16,
+      PlyInt32,
+      PlyUInt32,
+      PlyFloat32,
+      PlyFloat64
+    };
+
+    PlyType plyType(const std::string &name)
+    {
+      if (name == "char" || name == "int8")
+        return PlyInt8;
+      if (name == "uchar" || name == "uint8")
+        return PlyUInt8;
+      if (name == "short" || name == "int16")
+        return PlyInt16;
+      if (name == "ushort" || name == "uint16")
+        return PlyUInt16;
+      if (name == "int" || name == "int32")
+        return PlyInt32;
+      if (name == "uint" || name == "uint32")
+        return PlyUInt32;
+      if (name == "float" || name == "float32")
+        return PlyFloat32;
+      if (name == "double" || name == "float64")
+        return PlyFloat64;
+      return PlyInvalid;
+    }
+
+    std::size_t plySize(PlyType type)
+    {
+      switch (type) {
+        case PlyInt8:
+        case PlyUInt8:
+          return 1;
+        case PlyInt16:
+        case PlyUInt16:
+          return 2;
+        case PlyInt32:
+        case PlyUInt32:
+        case PlyFloat32:
+          return 4;
+        case PlyFloat64:
+          return 8;
+        default:
+          return 0;
+      }
+    }
+
+    template<typename T>
+    T plyCast(const char *p, bool swap)
+    {
+      char bytes[sizeof(T)];
+      std::memcpy(bytes, p, sizeof(T));
+      if (swap)
+        std::reverse(bytes, bytes + sizeof(T));
+      T value;
+      std::memcpy(&value, bytes, sizeof(T));
+      return value;
+    }
+
+    /**
+     * @brief Read a binary value, @p p must have plySize(type) bytes.
+     */
+    double plyValue(const char *p, PlyType type, bool swap)
+    {
+      switch (type) {
+        case PlyInt8:
+          return plyCast<std::int8_t>(p, swap);
+        case PlyUInt8:
+          return plyCast<std::uint8_t>(p, swap);
+        case PlyInt16:
+          return plyCast<std::int16_t>(p, swap);
+        case PlyUInt16:
+          return plyCast<std::uint16_t>(p, swap);
+        case PlyInt32:
+          return plyCast<std::int32_t>(p, swap);
+        case PlyUInt32:
+          return plyCast<std::uint32_t>(p, swap);
+        case PlyFloat32:
+          return plyCast<float>(p, swap);
+        case PlyFloat64:
+          return plyCast<double>(p, swap);
+        default:
+          return 0.0;
+      }
+    }
+
+    struct PlyProperty
+    {
+      std::string name;
+      PlyType type;
+      PlyType countType; //!< Type of the count for list properties.
+      bool list;
+    };
+
+    struct PlyElement
+    {
+      std::string name;
+      std::size_t count;
+      std::vector<PlyProperty> properties;
+
+      /**
+       * @brief The size of a binary element, 0 if it contains lists.
+       */
+      std::size_t stride() const
+      {
+        std::size_t size = 0;
+        for (std::size_t i = 0; i < properties.size(); ++i) {
+          if (properties[i].list)
+            return 0;
+          size += plySize(properties[i].type);
+        }
+        return size;
+      }
+
+      int find(const std::string &name) const
+      {
+        for (std::size_t i = 0; i < properties.size(); ++i)
+          if (properties[i].name == name)
+            return i;
+        return -1;
+      }
+    };
+
+    enum PlyFormat {
+      PlyAscii,
+      PlyBinaryLittleEndian,
+      PlyBinaryBigEndian
+    };
+
+    /**
+     * @brief Parse the PLY header.
+     *
+     * @return A pointer to the data after the header or a null pointer.
+     */
+    const char* readPlyHeader(const char *begin, const char *end, PlyFormat &format, std::vector<PlyElement> &elements)
+    {
+      static const char endHeader[] = "end_header";
+      const char *p = begin;
+      const char *body = 0;
+      while (p < end) {
+        const char *line = p;
+        p = nextLine(p, end);
+        if (std::strncmp(line, endHeader, std::min<std::size_t>(sizeof(endHeader) - 1, end - line)) == 0) {
+          body = p;
+          break;
+        }
+      }
+
+      if (!body || std::strncmp(begin, "ply", std::min<std::size_t>(3, end - begin)) != 0)
+        return 0;
+
+      std::istringstream header(std::string(begin, body));
+      std::string line;
+      bool hasFormat = false;
+      while (std::getline(header, line)) {
+        std::istringstream ss(line);
+        std::string keyword;
+        ss >> keyword;
+
+        if (keyword == "format") {
+          std::string name;
+          ss >> name;
+          if (name == "ascii")
+            format = PlyAscii;
+          else if (name == "binary_little_endian")
+            format = PlyBinaryLittleEndian;
+          else if (name == "binary_big_endian")
+            format = PlyBinaryBigEndian;
+          else
+            return 0;
+          hasFormat = true;
+        } else if (keyword == "element") {
+          PlyElement element;
+          if (!(ss >> element.name >> element.count))
+            return 0;
+          elements.push_back(element);
+        } else if (keyword == "property") {
+          if (elements.empty())
+            return 0;
+          PlyProperty property;
+          std::string type;
+          ss >> type;
+          property.list = type == "list";
+          if (property.list) {
+            std::string countType;
+            ss >> countType >> type;
+            property.countType = plyType(countType);
+            if (property.countType == PlyInvalid)
+              return 0;
+          } else
+            property.countType = PlyInvalid;
+          property.type = plyType(type);
+          if (property.type == PlyInvalid || !(ss >> property.name))
+            return 0;
+          elements.back().properties.push_back(property);
+        }
+      }
+
+      return hasFormat ? body : 0;
+    }
+
+    bool isLittleEndian()
+    {
+      const std::uint16_t one = 1;
+      return *reinterpret_cast<const unsigned char*>(&one) == 1;
+    }
+
+    /**
+     * @brief Read the binary PLY body.
+     */
+    bool readBinaryPly(const char *p, const char *end, bool swap, const std::vector<PlyElement> &elements, Mesh &mesh, unsigned int numThreads)
+    {
+      std::vector<vec4> &vertices = mesh.vertices();
+      std::vector<Mesh::Face> &faces = mesh.faces();
+
+      for (std::size_t e = 0; e < elements.size(); ++e) {
+        const PlyElement &element = elements[e];
+        std::size_t stride = element.stride();
+
+        // the counts are not trusted, compare them with the size of the file
+        // before multiplying (the product could wrap)
+        if (element.name == "vertex" && stride) {
+          // fixed size vertices are read in place
+          if (element.count > static_cast<std::size_t>(end - p) / stride)
+            return false;
+
+          std::size_t offsets[3];
+          PlyType types[3];
+          const char *names[3] = { "x", "y", "z" };
+          for (int i = 0; i < 3; ++i) {
+            int index = element.find(names[i]);
+            if (index < 0)
+              return false;
+            offsets[i] = 0;
+            for (int j = 0; j < index; ++j)
+              offsets[i] += plySize(element.properties[j].type);
+            types[i] = element.properties[index].type;
+          }
+
+          vertices.resize(element.count);
+          parallel_for(0, element.count, [&] (std::size_t i) {
+            const char *v = p + i * stride;
+            vertices[i] = vec4(plyValue(v + offsets[0], types[0], swap),
+                               plyValue(v + offsets[1], types[1], swap),
+                               plyValue(v + offsets[2], types[2], swap), 1.0);
+          }, 1 << 14, numThreads);
+
+          p += element.count * stride;
+          continue;
+        }
+
+        if (stride && element.name != "face") {
+          // skip other fixed size elements
+          if (element.count > static_cast<std::size_t>(end - p) / stride)
+            return false;
+          p += element.count * stride;
+          continue;
+        }
+
+        // elements with lists have to be read sequentially
+        bool isVertex = element.name == "vertex";
+        bool isFace = element.name == "face";
+        int x = element.find("x"), y = element.find("y"), z = element.find("z");
+        int indices = element.find("vertex_indices");
+        if (indices < 0)
+          indices = element.find("vertex_index");
+        if ((isVertex && (x < 0 || y < 0 || z < 0)) || (isFace && indices < 0))
+          return false;
+        // vertices and faces have at least one byte
+        if ((isVertex || isFace) && element.count > static_cast<std::size_t>(end - p))
+          return false;
+
+        if (isVertex)
+          vertices.resize(element.count);
+        if (isFace)
+          faces.resize(element.count);
+
+        for (std::size_t i = 0; i < element.count; ++i) {
+          Real xyz[3] = { 0.0, 0.0, 0.0 };
+
+          for (std::size_t j = 0; j < element.properties.size(); ++j) {
+            const PlyProperty &property = element.properties[j];
+            std::size_t size = plySize(property.type);
+
+            if (property.list) {
+              std::size_t countSize = plySize(property.countType);
+              if (static_cast<std::size_t>(end - p) < countSize)
+                return false;
+              double value = plyValue(p, property.countType, swap);
+              p += countSize;
+              if (!(value >= 0.0 && value <= end - p))
+                return false;
+              std::size_t count = value;
+              if (count > static_cast<std::size_t>(end - p) / size)
+                return false;
+
+              if (isFace && static_cast<int>(j) == indices) {
+                Mesh::Face &face = faces[i];
+                face.resize(count);
+                for (std::size_t k = 0; k < count; ++k)
+                  face[k] = vertexIndex(plyValue(p + k * size, property.type, swap));
+              }
+
+              p += count * size;
+            } else {
+              if (static_cast<std::size_t>(end - p) < size)
+                return false;
+              if (isVertex) {
+                if (static_cast<int>(j) == x)
+                  xyz[0] = plyValue(p, property.type, swap);
+                else if (static_cast<int>(j) == y)
+                  xyz[1] = plyValue(p, property.type, swap);
+                else if (static_cast<int>(j) == z)
+                  xyz[2] = plyValue(p, property.type, swap);
+              }
+              p += size;
+            }
+          }
+
+          if (isVertex)
+            vertices[i] = vec4(xyz[0], xyz[1], xyz[2], 1.0);
+        }
+      }
+
+      return true;
+    }
+
+    /**
+     * @brief Read the ASCII PLY body in parallel chunks.
+     *
+     * Every element is stored on its own line so the line number determines
+     * the element. The first pass counts the lines in every chunk.
+     */
+    bool readAsciiPly(const char *begin, const char *end, const std::vector<PlyElement> &elements, Mesh &mesh, unsigned int numThreads)
+    {
+      std::vector<vec4> &vertices = mesh.vertices();
+      std::vector<Mesh::Face> &faces = mesh.faces();
+
+      // the first line for every element (the body has at most one line per
+      // byte, larger counts are rejected before they are added up)
+      const std::size_t maxLines = end - begin + 1;
+      std::vector<std::size_t> firstLine(1, 0);
+      for (std::size_t e = 0; e < elements.size(); ++e) {
+        if (elements[e].count > maxLines - firstLine.back())
+          return false;
+        firstLine.push_back(firstLine.back() + elements[e].count);
+      }
+
+      std::vector<int> xyz(3 * elements.size(), -1);
+      std::vector<int> indices(elements.size(), -1);
+      for (std::size_t e = 0; e < elements.size(); ++e) {
+        const PlyElement &element = elements[e];
+        if (element.name == "vertex") {
+          xyz[3 * e] = element.find("x");
+          xyz[3 * e + 1] = element.find("y");
+          xyz[3 * e + 2] = element.find("z");
+          if (xyz[3 * e] < 0 || xyz[3 * e + 1] < 0 || xyz[3 * e + 2] < 0)
+            return false;
+          vertices.resize(element.count);
+        } else if (element.name == "face") {
+          indices[e] = element.find("vertex_indices");
+          if (indices[e] < 0)
+            indices[e] = element.find("vertex_index");
+          if (indices[e] < 0)
+            return false;
+          faces.resize(element.count);
+        }
+      }
+
+      std::vector<const char*> chunks = splitLines(begin, end, chunkCount(end - begin, numThreads));
+      std::size_t numChunks = chunks.size() - 1;
+
+      // first pass: count the lines
+      std::vector<std::size_t> lines(numChunks + 1, 0);
+      parallel_for(0, numChunks, [&] (std::size_t c) {
+        lines[c + 1] = std::count(chunks[c], chunks[c + 1], '\n');
+      }, 1, numThreads);
+      for (std::size_t c = 0; c < numChunks; ++c)
+        lines[c + 1] += lines[c];
+
+      // second pass: parse
+      std::atomic<bool> ok(true);
+      parallel_for(0, numChunks, [&] (std::size_t c) {
+        const char *p = chunks[c];
+        std::size_t line = lines[c];
+        std::size_t e = std::upper_bound(firstLine.begin(), firstLine.end(), line) - firstLine.begin() - 1;
+
+        for (; p < chunks[c + 1] && ok; ++line, p = nextLine(p, chunks[c + 1])) {
+          while (e < elements.size() && line >= firstLine[e + 1])
+            ++e;
+          if (e == elements.size())
+            break;
+
+          const PlyElement &element = elements[e];
+          std::size_t i = line - firstLine[e];
+          Real values[3] = { 0.0, 0.0, 0.0 };
+          const char *q = p;
+
+          for (std::size_t j = 0; j < element.properties.size(); ++j) {
+            const PlyProperty &property = element.properties[j];
+
+            if (property.list) {
+              // every value has at least one byte
+              long count;
+              if (!parseInt(q, end, count) || count < 0 || count > end - q) {
+                ok = false;
+                break;
+              }
+              if (static_cast<int>(j) == indices[e]) {
+                Mesh::Face &face = faces[i];
+                face.resize(count);
+                for (long k = 0; k < count; ++k) {
+                  long index;
+                  if (!parseInt(q, end, index)) {
+                    ok = false;
+                    break;
+                  }
+                  face[k] = vertexIndex(index);
+                }
+              } else
+                for (long k = 0; k < count; ++k)
+                  q = skipToken(skipSpace(q, end), end);
+            } else {
+              for (int k = 0; k < 3; ++k)
+                if (static_cast<int>(j) == xyz[3 * e + k] && !parseReal(q, end, values[k]))
+                  ok = false;
+              if (static_cast<int>(j) != xyz[3 * e] && static_cast<int>(j) != xyz[3 * e + 1] && static_cast<int>(j) != xyz[3 * e + 2])
+                q = skipToken(skipSpace(q, end), end);
+            }
+          }
+
+          if (xyz[3 * e] >= 0)
+            vertices[i] = vec4(values[0], values[1], values[2], 1.0);
+        }
+      }, 1, numThreads);
+
+      return ok && lines.back() + (end > begin && end[-1] != '\n') >= firstLine.back();
+    }
+
+    /**
+     * @brief Check that all face indices refer to a vertex.
+     */
+    bool checkIndices(const Mesh &mesh, unsigned int numThreads)
+    {
+      const std::vector<Mesh::Face> &faces = mesh.faces();
+      long numVertices = mesh.vertices().size();
+      std::atomic<bool> ok(true);
+      parallel_for(0, faces.size(), [&] (std::size_t i) {
+        for (std::size_t j = 0; j < faces[i].size(); ++j)
+          if (faces[i][j] < 0 || faces[i][j] >= numVertices)
+            ok = false;
+      }, 1 << 14, numThreads);
+      return ok;
+    }
+
+    //
+    // Native binary format
+    //
+
+    struct BinaryHeader
+    {
+      char magic[4];
+      std::uint32_t version;
+      std::uint64_t numVertices;
+      std::uint64_t numFaces;
+      std::uint64_t numIndices;
+    };
+
+    const std::uint32_t binaryVersion = 1;
+
+  }
+
+  std::shared_ptr<Mesh> readOBJ(const std::string &filename, unsigned int numThreads)
+  {
+    MappedFile file(filename);
+    if (!file.data())
+      return std::shared_ptr<Mesh>();
+
+    const char *begin = file.data();
+    const char *end = begin + file.size();
+    std::vector<const char*> chunks = splitLines(begin, end, chunkCount(file.size(), numThreads));
+    std::size_t numChunks = chunks.size() - 1;
+
+    // first pass: count the vertices and faces in every chunk
+    std::vector<std::size_t> vertexOffsets(numChunks + 1, 0);
+    std::vector<std::size_t> faceOffsets(numChunks + 1, 0);
+    parallel_for(0, numChunks, [&] (std::size_t c) {
+      for (const char *p = chunks[c]; p < chunks[c + 1]; p = nextLine(p, chunks[c + 1])) {
+        const char *q = skipSpace(p, chunks[c + 1]);
+        if (isKeyword(q, chunks[c + 1], 'v'))
+          ++vertexOffsets[c + 1];
+        else if (isKeyword(q, chunks[c + 1], 'f'))
+          ++faceOffsets[c + 1];
+      }
+    }, 1, numThreads);
+
+    for (std::size_t c = 0; c < numChunks; ++c) {
+      vertexOffsets[c + 1] += vertexOffsets[c];
+      faceOffsets[c + 1] += faceOffsets[c];
+    }
+
+    std::shared_ptr<Mesh> mesh(new Mesh);
+    std::vector<vec4> &vertices = mesh->vertices();
+    std::vector<Mesh::Face> &faces = mesh->faces();
+    vertices.resize(vertexOffsets.back());
+    faces.resize(faceOffsets.back());
+
+    // second pass: parse the chunks directly into the mesh
+    std::atomic<bool> ok(true);
+    parallel_for(0, numChunks, [&] (std::size_t c) {
+      std::size_t v = vertexOffsets[c];
+      std::size_t f = faceOffsets[c];
+
+      for (const char *p = chunks[c]; p < chunks[c + 1] && ok; p = nextLine(p, chunks[c + 1])) {
+        const char *q = skipSpace(p, chunks[c + 1]);
+
+        if (isKeyword(q, chunks[c + 1], 'v')) {
+          ++q;
+          Real x, y, z;
+          if (parseReal(q, chunks[c + 1], x) && parseReal(q, chunks[c + 1], y) && parseReal(q, chunks[c + 1], z))
+            vertices[v++] = vec4(x, y, z, 1.0);
+          else
+            ok = false;
+        } else if (isKeyword(q, chunks[c + 1], 'f')) {
+          ++q;
+          Mesh::Face &face = faces[f++];
+          long index;
+          while (parseInt(q, chunks[c + 1], index)) {
+            // negative indices are relative to the last vertex, 0 is invalid
+            face.push_back(vertexIndex(index > 0 ? index - 1 : (index < 0 ? static_cast<long>(v) + index : -1)));
+            // skip texture coordinate and normal indices
+            q = skipToken(q, chunks[c + 1]);
+          }
+        }
+      }
+    }, 1, numThreads);
+
+    if (!ok || !checkIndices(*mesh, numThreads))
+      return std::shared_ptr<Mesh>();
+
+    return mesh;
+  }
+
+  std::shared_ptr<Mesh> readPLY(const std::string &filename, unsigned int numThreads)
+  {
+    MappedFile file(filename);
+    if (!file.data())
+      return std::shared_ptr<Mesh>();
+
+    const char *end = file.data() + file.size();
+    PlyFormat format;
+    std::vector<PlyElement> elements;
+    const char *body = readPlyHeader(file.data(), end, format, elements);
+    if (!body)
+      return std::shared_ptr<Mesh>();
+
+    std::shared_ptr<Mesh> mesh(new Mesh);
+
+    bool ok;
+    if (format == PlyAscii)
+      ok = readAsciiPly(body, end, elements, *mesh, numThreads);
+    else
+      ok = readBinaryPly(body, end, (format == PlyBinaryLittleEndian) != isLittleEndian(), elements, *mesh, numThreads);
+
+    if (!ok || !checkIndices(*mesh, numThreads))
+      return std::shared_ptr<Mesh>();
+
+    return mesh;
+  }
+
+  std::shared_ptr<Mesh> readBinaryMesh(const std::string &filename)
+  {
+    MappedFile file(filename);
+    if (!file.data() || file.size() < sizeof(BinaryHeader))
+      return std::shared_ptr<Mesh>();
+
+    BinaryHeader header;
+    std::memcpy(&header, file.data(), sizeof(BinaryHeader));
+    if (std::strncmp(header.magic, "GFXM", 4) != 0 || header.version != binaryVersion)
+      return std::shared_ptr<Mesh>();
+
+    // the counts are not trusted, a product that wraps could match the file
+    // size so larger counts than fit in the file are rejected first
+    if (header.numVertices > file.size() / (4 * sizeof(double)) ||
+        header.numFaces >= file.size() / sizeof(std::uint64_t) ||
+        header.numIndices > file.size() / sizeof(std::int32_t))
+      return std::shared_ptr<Mesh>();
+
+    std::size_t size = sizeof(BinaryHeader) + header.numVertices * 4 * sizeof(double) +
+        (header.numFaces + 1) * sizeof(std::uint64_t) + header.numIndices * sizeof(std::int32_t);
+    if (file.size() != size)
+      return std::shared_ptr<Mesh>();
+
+    const double *v = reinterpret_cast<const double*>(file.data() + sizeof(BinaryHeader));
+    const std::uint64_t *offsets = reinterpret_cast<const std::uint64_t*>(v + 4 * header.numVertices);
+    const std::int32_t *indices = reinterpret_cast<const std::int32_t*>(offsets + header.numFaces + 1);
+
+    if (offsets[0] != 0 || offsets[header.numFaces] != header.numIndices)
+      return std::shared_ptr<Mesh>();
+
+    std::shared_ptr<Mesh> mesh(new Mesh);
+    std::vector<vec4> &vertices = mesh->vertices();
+    std::vector<Mesh::Face> &faces = mesh->faces();
+
+    // the vertex block has the same layout as std::vector<vec4>
+    static_assert(sizeof(vec4) == 4 * sizeof(double), "unexpected vec4 layout");
+    const vec4 *first = reinterpret_cast<const vec4*>(v);
+    vertices.assign(first, first + header.numVertices);
+
+    std::atomic<bool> ok(true);
+    faces.resize(header.numFaces);
+    parallel_for(0, header.numFaces, [&] (std::size_t i) {
+      if (offsets[i] > offsets[i + 1] || offsets[i + 1] > header.numIndices) {
+        ok = false;
+        return;
+      }
+      faces[i].assign(indices + offsets[i], indices + offsets[i + 1]);
+    }, 1 << 14);
+
+    if (!ok || !checkIndices(*mesh, 0))
+      return std::shared_ptr<Mesh>();
+
+    return mesh;
+  }
+
+  bool writeBinaryMesh(const Mesh &mesh, const std::string &filename)
+  {
+    std::ofstream ofs(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+    if (!ofs)
+      return false;
+
+    const std::vector<vec4> &vertices = mesh.vertices();
+    const std::vector<Mesh::Face> &faces = mesh.faces();
+
+    std::vector<std::uint64_t> offsets(1, 0);
+    offsets.reserve(faces.size() + 1);
+    for (std::size_t i = 0; i < faces.size(); ++i)
+      offsets.push_back(offsets.back() + faces[i].size());
+
+    BinaryHeader header;
+    std::memcpy(header.magic, "GFXM", 4);
+    header.version = binaryVersion;
+    header.numVertices = vertices.size();
+    header.numFaces = faces.size();
+    header.numIndices = offsets.back();
+
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(BinaryHeader));
+    ofs.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(vec4));
+    ofs.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(std::uint64_t));
+    for (std::size_t i = 0; i < faces.size(); ++i) {
+      std::vector<std::int32_t> face(faces[i].begin(), faces[i].end());
+      ofs.write(reinterpret_cast<const char*>(face.data()), face.size() * sizeof(std::int32_t));
+    }
+
+    return static_cast<bool>(ofs);
+  }
+
+  std::shared_ptr<Mesh> readMesh(const std::string &filename, unsigned int numThreads)
+  {
+    std::string ext = extension(filename);
+    if (ext == "obj")
+      return readOBJ(filename, numThreads);
+    if (ext == "ply")
+      return readPLY(filename, numThreads);
+    if (ext == "gfxm")
+      return readBinaryMesh(filename);
+    return std::shared_ptr<Mesh>();
+  }
+
+}
@@ -0,0 +1,68 @@
+#ifndef GFX_MESHIO_H
+#define GFX_MESHIO_H
+
+#include "mesh.h"
+
+#include <string>
+
+namespace GFX {
+
+  /**
+   * @brief Read a mesh from a file.
+   *
+   * The format is determined by the file extension:
+   * - .obj: Wavefront OBJ (only the vertex positions and faces are used)
+   * - .ply: Stanford PLY (ascii, binary_little_endian or binary_big_endian)
+   * - .gfxm: The native binary format (see writeBinaryMesh())
+   *
+   * @param filename The file name.
+   * @param numThreads The number of threads for parsing, 0 to use all cores.
+   *
+   * @return The mesh or a null pointer if the file could not be read.
+   */
+  std::shared_ptr<Mesh> readMesh(const std::string &filename, unsigned int numThreads = 0);
+
+  /**
+   * @brief Read a Wavefront OBJ file.
+   *
+   * The file is memory mapped and split in chunks of complete lines. The
+   * chunks are parsed in parallel: a first pass counts the vertices and faces
+   * in every chunk, the second pass parses the chunks directly into the mesh.
+   * Relative (negative) vertex indices are supported.
+   */
+  std::shared_ptr<Mesh> readOBJ(const std::string &filename, unsigned int numThreads = 0);
+
+  /**
+   * @brief Read a Stanford PLY file.
+   *
+   * ASCII files are parsed in parallel chunks like readOBJ(). For binary
+   * files, vertices with fixed size properties are read in place from the
+   * memory mapped file.
+   */
+  std::shared_ptr<Mesh> readPLY(const std::string &filename, unsigned int numThreads = 0);
+
+  /**
+   * @brief Read a mesh in the native binary format.
+   *
+   * The memory mapped vertex block has the same layout as the vertices in a
+   * Mesh so it is copied in bulk without any parsing.
+   */
+  std::shared_ptr<Mesh> readBinaryMesh(const std::string &filename);
+
+  /**
+   * @brief Write a mesh in the native binary format.
+   *
+   * The file contains (in native byte order):
+   * - header: "GFXM", uint32 version, uint64 number of vertices, faces and
+   *   face indices
+   * - the vertices: 4 doubles (x, y, z, w) per vertex
+   * - the face offsets: number of faces + 1 uint64 offsets in the indices
+   * - the face indices: int32 vertex indices
+   *
+   * @return True if the file was written.
+   */
+  bool writeBinaryMesh(const Mesh &mesh, const std::string &filename);
+
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef GFX_PARALLEL_H
+#define GFX_PARALLEL_H
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+namespace GFX {
+
+  /**
+   * @brief Get the number of threads to use for parallel loops.
+   *
+   * @param numThreads The requested number of threads, 0 to use all cores.
+   */
+  inline unsigned int threadCount(unsigned int numThreads = 0)
+  {
+    if (numThreads)
+      return numThreads;
+    unsigned int cores = std::thread::hardware_concurrency();
+    return cores ? cores : 1;
+  }
+
+  /**
+   * @brief Call @p f(i) for all i in [begin, end) using multiple threads.
+   *
+   * The range is split in one contiguous block per thread. Small ranges
+   * (less than @p grain indices per thread) are handled by fewer threads
+   * to avoid the overhead of starting them.
+   *
+   * @param begin The first index.
+   * @param end One past the last index.
+   * @param f The function to call for each index.
+   * @param grain The minimum number of indices per thread.
+   * @param numThreads The number of threads, 0 to use all cores.
+   */
+  template<typename Function>
+  void parallel_for(std::size_t begin, std::size_t end, const Function &f, std::size_t grain = 1024, unsigned int numThreads = 0)
+  {
+    if (end <= begin)
+      return;
+
+    std::size_t n = end - begin;
+    std::size_t threads = std::min<std::size_t>(threadCount(numThreads), std::max<std::size_t>(1, n / std::max<std::size_t>(1, grain)));
+
+    if (threads <= 1) {
+      for (std::size_t i = begin; i < end; ++i)
+        f(i);
+      return;
+    }
+
+    std::size_t block = (n + threads - 1) / threads;
+
+    std::vector<std::thread> workers;
+    for (std::size_t t = 1; t < threads; ++t) {
+      std::size_t first = begin + t * block;
+      std::size_t last = std::min(end, first + block);
+      workers.push_back(std::thread([&f, first, last] () {
+        for (std::size_t i = first; i < last; ++i)
+          f(i);
+      }));
+    }
+
+    // the calling thread handles the first block
+    for (std::size_t i = begin; i < std::min(end, begin + block); ++i)
+      f(i);
+
+    for (std::size_t t = 0; t < workers.size(); ++t)
+      workers[t].join();
+  }
+
+}
+
+#endif
@@ -1,10 +1,12 @@
 #ifndef GFX_RENDER2D_H
 #define GFX_RENDER2D_H
 
+#include "bresenham.h"
 #include "color.h"
 #include "utility.h"
 
 #include <cmath>
+#include <limits>
 
 namespace GFX {
 
@@ -12,41 +14,25 @@ namespace GFX {
   class Render2D
   {
     public:
-      Render2D(CanvasType &canvas) : m_canvas(canvas)
+      /**
+       * @param width The width of the canvas, lines are clipped to [0, width).
+       * @param height The height of the canvas, lines are clipped to [0, height).
+       */
+      Render2D(CanvasType &canvas, int width = std::numeric_limits<int>::max(), int height = std::numeric_limits<int>::max())
+        : m_canvas(canvas), m_width(width), m_height(height)
       {
       }
 
-      void drawLine(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, const Color &color)
+      /**
+       * @brief Draw a line from pixel (x0, y0) to pixel (x1, y1).
+       *
+       * Only the pixels on the canvas are drawn (see BresenhamLine).
+       */
+      void drawLine(int x0, int y0, int x1, int y1, const Color &color)
       {
-        if (x0 == x1) {
-          for (unsigned int i = std::min(y0, y1); i <= std::max(y0, y1); i++)
-            m_canvas.setPixel(x0, i, color);
-          return;
-        }
-
-        if (y0 == y1) {
-          for (unsigned int i = std::min(x0, x1); i <= std::max(x0, x1); i++)
-            m_canvas.setPixel(i, y0, color);
-          return;
-        }
-
-        if (x0 > x1) {
-          std::swap(x0, x1);
-          std::swap(y0, y1);
-        }
-
-        Real m = ((Real) y1 - (Real) y0) / ((Real) x1 - (Real) x0);
-
-        if (-1.0 <= m && m <= 1.0) {
-          for (unsigned int i = 0; i <= (x1 - x0); i++)
-            m_canvas.setPixel(x0 + i, (unsigned int) round(y0 + m * i), color);
-        } else if (m > 1.0)  {
-          for (unsigned int i = 0; i <= (y1 - y0); i++)
-            m_canvas.setPixel((unsigned int) round(x0 + (i / m)), y0 + i, color);
-        } else if (m < -1.0) {
-          for (unsigned int i = 0; i <= (y0 - y1); i++)
-            m_canvas.setPixel((unsigned int) round(x0 - (i / m)), y0 - i, color);
-        }
+        BresenhamLine line(x0, y0, x1, y1, 0, 0, m_width - 1, m_height - 1);
+        for (int i = 0; i < line.count; ++i, line.next())
+          m_canvas.setPixel(line.x, line.y, color);
       }
 
       void drawCircle(unsigned int cx, unsigned int cy, unsigned int radius, const Color &color)
@@ -189,6 +175,8 @@ namespace GFX {
       }
 
       CanvasType &m_canvas;
+      int m_width;
+      int m_height;
   };
 
 }
@@ -4,6 +4,7 @@
 #include "utility.h"
 #include "context.h"
 #include "transform.h"
+#include "vertexbuffer.h"
 
 #include <limits>
 #include <tuple>
@@ -269,6 +270,61 @@ namespace GFX {
         }
       }
 
+      /**
+       * @brief Draw triangles from a vertex buffer.
+       *
+       * The attributes of every vertex are decoded to Reals before they are
+       * passed to the vertex shader.
+       *
+       * @param buffer The vertex buffer.
+       * @param first The first vertex.
+       * @param count The number of vertices (a multiple of 3).
+       */
+      void drawTriangles(const VertexBuffer &buffer, std::size_t first, std::size_t count)
+      {
+        assert((count % 3) == 0 && first + count <= buffer.size());
+
+        std::size_t n = buffer.layout().numComponents();
+        std::vector<Real> attributes(3 * n);
+        for (std::size_t i = first; i < first + count; i += 3) {
+          buffer.decode(i, &attributes[0]);
+          buffer.decode(i + 1, &attributes[n]);
+          buffer.decode(i + 2, &attributes[2 * n]);
+          drawTriangle(&attributes[0], &attributes[n], &attributes[2 * n]);
+        }
+      }
+
+      void drawTriangles(const VertexBuffer &buffer)
+      {
+        drawTriangles(buffer, 0, buffer.size());
+      }
+
+      /**
+       * @brief Draw quads from a vertex buffer.
+       *
+       * @param buffer The vertex buffer.
+       * @param first The first vertex.
+       * @param count The number of vertices (a multiple of 4).
+       */
+      void drawQuads(const VertexBuffer &buffer, std::size_t first, std::size_t count)
+      {
+        assert((count % 4) == 0 && first + count <= buffer.size());
+
+        std::size_t n = buffer.layout().numComponents();
+        std::vector<Real> attributes(4 * n);
+        for (std::size_t i = first; i < first + count; i += 4) {
+          for (std::size_t j = 0; j < 4; ++j)
+            buffer.decode(i + j, &attributes[j * n]);
+          drawTriangle(&attributes[0], &attributes[n], &attributes[2 * n]);
+          drawTriangle(&attributes[0], &attributes[2 * n], &attributes[3 * n]);
+        }
+      }
+
+      void drawQuads(const VertexBuffer &buffer)
+      {
+        drawQuads(buffer, 0, buffer.size());
+      }
+
     private:
       void screenCoordinates(vec4 &v)
       {
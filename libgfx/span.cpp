@@ -0,0 +1,243 @@
+#include "span.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GFX_SPAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace GFX {
+
+  namespace {
+
+    typedef void (*SpanFunction)(Real*, unsigned char*, std::ptrdiff_t, int, Real, Real, Real, int, const unsigned char*);
+    typedef void (*DepthSpanFunction)(Real*, int, Real, Real, Real, int);
+
+    void drawFlatSpanScalar(Real *depth, unsigned char *pixels, std::ptrdiff_t stride, int n,
+        Real z0, Real w, Real dzdx, int k, const unsigned char *color)
+    {
+      for (int i = 0; i < n; ++i) {
+        Real z = z0 + (w + (k + i) * dzdx);
+        if (z < depth[i]) {
+          depth[i] = z;
+          std::memcpy(pixels + i * stride, color, 3);
+        }
+      }
+    }
+
+    void drawDepthSpanScalar(Real *depth, int n, Real z0, Real w, Real dzdx, int k)
+    {
+      for (int i = 0; i < n; ++i) {
+        Real z = z0 + (w + (k + i) * dzdx);
+        if (z < depth[i])
+          depth[i] = z;
+      }
+    }
+
+#ifdef GFX_SPAN_X86
+
+    /**
+     * Set the color for the pixels with a bit set in @p mask.
+     */
+    inline void storeColors(unsigned char *pixels, std::ptrdiff_t stride, int mask, const unsigned char *color)
+    {
+      for (int i = 0; mask; ++i, mask >>= 1)
+        if (mask & 1)
+          std::memcpy(pixels + i * stride, color, 3);
+    }
+
+    __attribute__((target("sse2")))
+    void drawFlatSpanSSE2(Real *depth, unsigned char *pixels, std::ptrdiff_t stride, int n,
+        Real z0, Real w, Real dzdx, int k, const unsigned char *color)
+    {
+      const __m128d vz0 = _mm_set1_pd(z0);
+      const __m128d vw = _mm_set1_pd(w);
+      const __m128d vdzdx = _mm_set1_pd(dzdx);
+
+      int i = 0;
+      for (; i + 4 <= n; i += 4) {
+        // (k + i) is exact as a double, the operations are the same as for the scalar kernel
+        __m128d lo = _mm_set_pd(k + i + 1, k + i);
+        __m128d hi = _mm_set_pd(k + i + 3, k + i + 2);
+        __m128d zLo = _mm_add_pd(vz0, _mm_add_pd(vw, _mm_mul_pd(lo, vdzdx)));
+        __m128d zHi = _mm_add_pd(vz0, _mm_add_pd(vw, _mm_mul_pd(hi, vdzdx)));
+
+        __m128d dLo = _mm_loadu_pd(depth + i);
+        __m128d dHi = _mm_loadu_pd(depth + i + 2);
+        __m128d mLo = _mm_cmplt_pd(zLo, dLo);
+        __m128d mHi = _mm_cmplt_pd(zHi, dHi);
+
+        int mask = _mm_movemask_pd(mLo) | (_mm_movemask_pd(mHi) << 2);
+        if (!mask)
+          continue;
+
+        _mm_storeu_pd(depth + i, _mm_or_pd(_mm_and_pd(mLo, zLo), _mm_andnot_pd(mLo, dLo)));
+        _mm_storeu_pd(depth + i + 2, _mm_or_pd(_mm_and_pd(mHi, zHi), _mm_andnot_pd(mHi, dHi)));
+        storeColors(pixels + i * stride, stride, mask, color);
+      }
+
+      drawFlatSpanScalar(depth + i, pixels + i * stride, stride, n - i, z0, w, dzdx, k + i, color);
+    }
+
+    __attribute__((target("avx2")))
+    void drawFlatSpanAVX2(Real *depth, unsigned char *pixels, std::ptrdiff_t stride, int n,
+        Real z0, Real w, Real dzdx, int k, const unsigned char *color)
+    {
+      const __m256d vz0 = _mm256_set1_pd(z0);
+      const __m256d vw = _mm256_set1_pd(w);
+      const __m256d vdzdx = _mm256_set1_pd(dzdx);
+      const __m256d lanes = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+      const __m256d four = _mm256_set1_pd(4.0);
+
+      int i = 0;
+      for (; i + 8 <= n; i += 8) {
+        // (k + i + lane) is exact as a double
+        __m256d lo = _mm256_add_pd(_mm256_set1_pd(k + i), lanes);
+        __m256d hi = _mm256_add_pd(lo, four);
+        __m256d zLo = _mm256_add_pd(vz0, _mm256_add_pd(vw, _mm256_mul_pd(lo, vdzdx)));
+        __m256d zHi = _mm256_add_pd(vz0, _mm256_add_pd(vw, _mm256_mul_pd(hi, vdzdx)));
+
+        __m256d dLo = _mm256_loadu_pd(depth + i);
+        __m256d dHi = _mm256_loadu_pd(depth + i + 4);
+        __m256d mLo = _mm256_cmp_pd(zLo, dLo, _CMP_LT_OQ);
+        __m256d mHi = _mm256_cmp_pd(zHi, dHi, _CMP_LT_OQ);
+
+        int mask = _mm256_movemask_pd(mLo) | (_mm256_movemask_pd(mHi) << 4);
+        if (!mask)
+          continue;
+
+        _mm256_storeu_pd(depth + i, _mm256_blendv_pd(dLo, zLo, mLo));
+        _mm256_storeu_pd(depth + i + 4, _mm256_blendv_pd(dHi, zHi, mHi));
+        storeColors(pixels + i * stride, stride, mask, color);
+      }
+
+      drawFlatSpanSSE2(depth + i, pixels + i * stride, stride, n - i, z0, w, dzdx, k + i, color);
+    }
+
+    __attribute__((target("sse2")))
+    void drawDepthSpanSSE2(Real *depth, int n, Real z0, Real w, Real dzdx, int k)
+    {
+      const __m128d vz0 = _mm_set1_pd(z0);
+      const __m128d vw = _mm_set1_pd(w);
+      const __m128d vdzdx = _mm_set1_pd(dzdx);
+
+      int i = 0;
+      for (; i + 2 <= n; i += 2) {
+        __m128d z = _mm_add_pd(vz0, _mm_add_pd(vw, _mm_mul_pd(_mm_set_pd(k + i + 1, k + i), vdzdx)));
+        // (z < depth) ? z : depth
+        _mm_storeu_pd(depth + i, _mm_min_pd(z, _mm_loadu_pd(depth + i)));
+      }
+
+      drawDepthSpanScalar(depth + i, n - i, z0, w, dzdx, k + i);
+    }
+
+    __attribute__((target("avx2")))
+    void drawDepthSpanAVX2(Real *depth, int n, Real z0, Real w, Real dzdx, int k)
+    {
+      const __m256d vz0 = _mm256_set1_pd(z0);
+      const __m256d vw = _mm256_set1_pd(w);
+      const __m256d vdzdx = _mm256_set1_pd(dzdx);
+      const __m256d lanes = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+
+      int i = 0;
+      for (; i + 4 <= n; i += 4) {
+        __m256d z = _mm256_add_pd(vz0, _mm256_add_pd(vw, _mm256_mul_pd(_mm256_add_pd(_mm256_set1_pd(k + i), lanes), vdzdx)));
+        // (z < depth) ? z : depth
+        _mm256_storeu_pd(depth + i, _mm256_min_pd(z, _mm256_loadu_pd(depth + i)));
+      }
+
+      drawDepthSpanSSE2(depth + i, n - i, z0, w, dzdx, k + i);
+    }
+
+#endif
+
+    SpanFunction spanFunction(SpanKernel kernel)
+    {
+      switch (kernel) {
+#ifdef GFX_SPAN_X86
+        case SSE2SpanKernel:
+          return &drawFlatSpanSSE2;
+        case AVX2SpanKernel:
+          return &drawFlatSpanAVX2;
+#endif
+        default:
+          return &drawFlatSpanScalar;
+      }
+    }
+
+    DepthSpanFunction depthSpanFunction(SpanKernel kernel)
+    {
+      switch (kernel) {
+#ifdef GFX_SPAN_X86
+        case SSE2SpanKernel:
+          return &drawDepthSpanSSE2;
+        case AVX2SpanKernel:
+          return &drawDepthSpanAVX2;
+#endif
+        default:
+          return &drawDepthSpanScalar;
+      }
+    }
+
+    SpanKernel currentKernel = bestSpanKernel();
+    SpanFunction currentFunction = spanFunction(currentKernel);
+    DepthSpanFunction currentDepthFunction = depthSpanFunction(currentKernel);
+
+  }
+
+  bool isSpanKernelSupported(SpanKernel kernel)
+  {
+    switch (kernel) {
+      case ScalarSpanKernel:
+        return true;
+#ifdef GFX_SPAN_X86
+      case SSE2SpanKernel:
+        // may be called before the constructors (see currentKernel)
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+      case AVX2SpanKernel:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+      default:
+        return false;
+    }
+  }
+
+  SpanKernel bestSpanKernel()
+  {
+    if (isSpanKernelSupported(AVX2SpanKernel))
+      return AVX2SpanKernel;
+    if (isSpanKernelSupported(SSE2SpanKernel))
+      return SSE2SpanKernel;
+    return ScalarSpanKernel;
+  }
+
+  SpanKernel spanKernel()
+  {
+    return currentKernel;
+  }
+
+  bool setSpanKernel(SpanKernel kernel)
+  {
+    if (!isSpanKernelSupported(kernel))
+      return false;
+    currentKernel = kernel;
+    currentFunction = spanFunction(kernel);
+    currentDepthFunction = depthSpanFunction(kernel);
+    return true;
+  }
+
+  void drawFlatSpan(Real *depth, unsigned char *pixels, std::ptrdiff_t stride, int n,
+      Real z0, Real w, Real dzdx, int k, const unsigned char *color)
+  {
+    currentFunction(depth, pixels, stride, n, z0, w, dzdx, k, color);
+  }
+
+  void drawDepthSpan(Real *depth, int n, Real z0, Real w, Real dzdx, int k)
+  {
+    currentDepthFunction(depth, n, z0, w, dzdx, k);
+  }
+
+}
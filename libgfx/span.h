@@ -0,0 +1,73 @@
+#ifndef GFX_SPAN_H
+#define GFX_SPAN_H
+
+#include "types.h"
+
+#include <cstddef>
+
+namespace GFX {
+
+  /**
+   * @brief Implementations of the span kernels.
+   *
+   * The kernel is selected at runtime based on the CPU features (see
+   * bestSpanKernel()). All kernels produce exactly the same result.
+   */
+  enum SpanKernel {
+    ScalarSpanKernel, //!< One pixel at a time.
+    SSE2SpanKernel, //!< 4 pixels at a time using SSE2.
+    AVX2SpanKernel //!< 8 pixels at a time using AVX2.
+  };
+
+  /**
+   * @brief Check if a kernel can be used on this CPU.
+   */
+  bool isSpanKernelSupported(SpanKernel kernel);
+
+  /**
+   * @brief Get the fastest kernel supported by this CPU.
+   */
+  SpanKernel bestSpanKernel();
+
+  /**
+   * @brief Get the kernel used by drawFlatSpan() and drawDepthSpan().
+   */
+  SpanKernel spanKernel();
+
+  /**
+   * @brief Set the kernel used by drawFlatSpan() and drawDepthSpan().
+   *
+   * This is not thread-safe and should be called before drawing (e.g. to
+   * compare the kernels).
+   *
+   * @return False if @p kernel is not supported (the kernel is not changed).
+   */
+  bool setSpanKernel(SpanKernel kernel);
+
+  /**
+   * @brief Draw a span of flat shaded pixels using a z-buffer.
+   *
+   * The depth for pixel i (0 <= i < n) is z0 + (w + (k + i) * dzdx). If the
+   * depth is less than depth[i], the depth is stored and the pixel is set to
+   * @p color.
+   *
+   * @param depth The z-buffer values for the pixels (consecutive).
+   * @param pixels The first pixel (3 bytes).
+   * @param stride The number of bytes between two pixels.
+   * @param n The number of pixels.
+   * @param color The 3 bytes for the pixels (in the same order as the pixels).
+   */
+  void drawFlatSpan(Real *depth, unsigned char *pixels, std::ptrdiff_t stride, int n,
+      Real z0, Real w, Real dzdx, int k, const unsigned char *color);
+
+  /**
+   * @brief Draw a span of pixels in a z-buffer only.
+   *
+   * This is drawFlatSpan() without the pixels: depth[i] is set to
+   * z0 + (w + (k + i) * dzdx) if that is less.
+   */
+  void drawDepthSpan(Real *depth, int n, Real z0, Real w, Real dzdx, int k);
+
+}
+
+#endif
@@ -0,0 +1,188 @@
+#include "vertexbuffer.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+namespace GFX {
+
+  std::size_t VertexLayout::typeSize(Type type)
+  {
+    switch (type) {
+      case Float32:
+        return 4;
+      case SNorm16:
+        return 2;
+      case UInt8:
+      default:
+        return 1;
+    }
+  }
+
+  std::size_t VertexLayout::add(Type type, int size)
+  {
+    std::size_t align = typeSize(type);
+
+    Attribute attribute;
+    attribute.type = type;
+    attribute.size = size;
+    attribute.offset = (m_stride + align - 1) / align * align;
+    m_attributes.push_back(attribute);
+
+    m_numComponents += size;
+    // keep every vertex 4 byte aligned
+    m_stride = (attribute.offset + size * align + 3) / 4 * 4;
+
+    return m_attributes.size() - 1;
+  }
+
+  VertexBuffer::VertexBuffer(Primitive primitive, bool normals, bool colors, bool texCoords, std::size_t extra)
+    : m_primitive(primitive), m_normals(normals), m_colors(colors), m_texCoords(texCoords),
+      m_extra(extra), m_revision(0)
+  {
+    m_layout.add(VertexLayout::Float32, 3);
+    if (normals)
+      m_layout.add(VertexLayout::SNorm16, 3);
+    if (colors)
+      m_layout.add(VertexLayout::UInt8, 4);
+    if (texCoords)
+      m_layout.add(VertexLayout::Float32, 2);
+    if (extra)
+      m_layout.add(VertexLayout::Float32, extra);
+  }
+
+  void VertexBuffer::set(std::size_t vertex, std::size_t attribute, const Real *values)
+  {
+    const VertexLayout::Attribute &attr = m_layout.attributes()[attribute];
+    unsigned char *p = &m_data[vertex * m_layout.stride() + attr.offset];
+
+    switch (attr.type) {
+      case VertexLayout::Float32:
+        for (int i = 0; i < attr.size; ++i) {
+          float value = values[i];
+          std::memcpy(p + 4 * i, &value, 4);
+        }
+        break;
+      case VertexLayout::SNorm16:
+        for (int i = 0; i < attr.size; ++i) {
+          Real v = std::min(std::max(values[i], Real(-1)), Real(1));
+          int16_t value = static_cast<int16_t>(std::lround(v * 32767));
+          std::memcpy(p + 2 * i, &value, 2);
+        }
+        break;
+      case VertexLayout::UInt8:
+        for (int i = 0; i < attr.size; ++i)
+          p[i] = static_cast<unsigned char>(std::min(std::max(values[i], Real(0)), Real(255)));
+        break;
+    }
+  }
+
+  void VertexBuffer::decode(std::size_t vertex, Real *attributes) const
+  {
+    const unsigned char *v = &m_data[vertex * m_layout.stride()];
+
+    for (auto &attr : m_layout.attributes()) {
+      const unsigned char *p = v + attr.offset;
+
+      switch (attr.type) {
+        case VertexLayout::Float32:
+          for (int i = 0; i < attr.size; ++i) {
+            float value;
+            std::memcpy(&value, p + 4 * i, 4);
+            *attributes++ = value;
+          }
+          break;
+        case VertexLayout::SNorm16:
+          for (int i = 0; i < attr.size; ++i) {
+            int16_t value;
+            std::memcpy(&value, p + 2 * i, 2);
+            *attributes++ = std::max(value / Real(32767), Real(-1));
+          }
+          break;
+        case VertexLayout::UInt8:
+          for (int i = 0; i < attr.size; ++i)
+            *attributes++ = p[i];
+          break;
+      }
+    }
+  }
+
+  bool VertexBuffer::isDirty(const Mesh &mesh) const
+  {
+    return m_revision != mesh.revision();
+  }
+
+  bool VertexBuffer::update(const Mesh &mesh)
+  {
+    if (!isDirty(mesh))
+      return false;
+
+    const std::vector<vec4> &vertices = mesh.vertices();
+    const std::vector<Mesh::Face> &faces = mesh.faces();
+    const std::vector<vec4> &normals = mesh.normals();
+    const std::vector<Color> &colors = mesh.colors();
+    const std::vector<vec2> &texCoords = mesh.texCoords();
+
+    std::size_t corners = m_primitive == Triangles ? 3 : 4;
+    bool faceNormals = normals.size() == faces.size();
+    bool vertexNormals = !faceNormals && normals.size() == vertices.size();
+    bool vertexColors = colors.size() == vertices.size();
+    bool vertexTexCoords = texCoords.size() == vertices.size();
+
+    std::size_t numFaces = 0;
+    for (auto &face : faces)
+      if (face.size() == corners)
+        ++numFaces;
+
+    m_data.clear();
+    resize(numFaces * corners);
+
+    std::vector<Real> extra(m_extra, 0.0);
+    std::size_t vertex = 0;
+    for (std::size_t i = 0; i < faces.size(); ++i) {
+      const Mesh::Face &face = faces[i];
+      if (face.size() != corners)
+        continue;
+
+      vec4 faceNormal(vec4::Zero());
+      if (m_normals && !vertexNormals) {
+        if (faceNormals) {
+          faceNormal = normals[i];
+        } else {
+          // same as Mesh::computeNormals() but without changing the mesh
+          vec3 AB = (vertices[face[1]] - vertices[face[0]]).head<3>();
+          vec3 AC = (vertices[face[2]] - vertices[face[0]]).head<3>();
+          faceNormal.head<3>() = AB.cross(AC).normalized();
+        }
+      }
+
+      for (std::size_t j = 0; j < corners; ++j, ++vertex) {
+        std::size_t attribute = 0;
+        set(vertex, attribute++, vertices[face[j]].data());
+
+        if (m_normals)
+          set(vertex, attribute++, vertexNormals ? normals[face[j]].data() : faceNormal.data());
+
+        if (m_colors) {
+          const Color &color = vertexColors ? colors[face[j]] : mesh.color();
+          Real rgba[4] = { Real(color.r), Real(color.g), Real(color.b), Real(color.a) };
+          set(vertex, attribute++, rgba);
+        }
+
+        if (m_texCoords) {
+          vec2 texCoord = vertexTexCoords ? texCoords[face[j]] : vec2::Zero();
+          set(vertex, attribute++, texCoord.data());
+        }
+
+        if (m_extra)
+          set(vertex, attribute++, &extra[0]);
+      }
+    }
+
+    m_revision = mesh.revision();
+    return true;
+  }
+
+}
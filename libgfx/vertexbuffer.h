@@ -0,0 +1,203 @@
+#ifndef GFX_VERTEXBUFFER_H
+#define GFX_VERTEXBUFFER_H
+
+#include "types.h"
+
+#include <vector>
+#include <cstddef>
+
+namespace GFX {
+
+  class Mesh;
+
+  /**
+   * @brief Description of the interleaved attributes of a vertex.
+   *
+   * Every attribute has a storage type and a number of components. The
+   * attributes are stored in the order they are added, each aligned to the
+   * size of its type. When decoded (see VertexBuffer::decode()), all
+   * components are converted to Real and written consecutively so vertex
+   * shaders see the same attributes as before.
+   */
+  class VertexLayout
+  {
+    public:
+      enum Type {
+        Float32, //!< 32 bit float.
+        SNorm16, //!< Signed 16 bit integer mapped to [-1, 1].
+        UInt8 //!< Unsigned 8 bit integer (e.g. color components in [0, 255]).
+      };
+
+      struct Attribute
+      {
+        Type type; //!< The storage type.
+        int size; //!< The number of components.
+        std::size_t offset; //!< Offset in bytes from the start of the vertex.
+      };
+
+      VertexLayout() : m_stride(0), m_numComponents(0)
+      {
+      }
+
+      /**
+       * @brief Append an attribute.
+       *
+       * @param type The storage type.
+       * @param size The number of components.
+       *
+       * @return The attribute index.
+       */
+      std::size_t add(Type type, int size);
+
+      const std::vector<Attribute>& attributes() const
+      {
+        return m_attributes;
+      }
+
+      /**
+       * @brief Get the number of bytes per vertex.
+       */
+      std::size_t stride() const
+      {
+        return m_stride;
+      }
+
+      /**
+       * @brief Get the total number of components (i.e. the number of Reals
+       * per decoded vertex).
+       */
+      std::size_t numComponents() const
+      {
+        return m_numComponents;
+      }
+
+      /**
+       * @brief Get the number of bytes for a single component of @p type.
+       */
+      static std::size_t typeSize(Type type);
+
+    private:
+      std::vector<Attribute> m_attributes;
+      std::size_t m_stride;
+      std::size_t m_numComponents;
+  };
+
+  /**
+   * @brief Vertex attributes in a compact, typed and interleaved layout.
+   *
+   * A vertex buffer for a mesh stores the attributes for the corners of all
+   * triangles (or quads) of the mesh, like Mesh::triangleAttributes(), but
+   * using 32 bit float positions, 16 bit normals and 8 bit colors. This is
+   * 24 bytes per vertex instead of 80 bytes for the same attributes as
+   * doubles. Only the storage is smaller: the renderer decodes every vertex
+   * back to Reals, which takes longer than reading the doubles directly.
+   *
+   * The buffer remembers the revision of the mesh it was built from (see
+   * Mesh::revision()). It is kept together with the mesh and update() only
+   * rebuilds it when the mesh was changed in the meantime.
+   */
+  class VertexBuffer
+  {
+    public:
+      enum Primitive {
+        Triangles,
+        Quads
+      };
+
+      /**
+       * @brief Constructor for a vertex buffer with a custom layout.
+       *
+       * The attributes are set using resize() and set().
+       */
+      VertexBuffer(const VertexLayout &layout = VertexLayout()) : m_layout(layout),
+          m_primitive(Triangles), m_normals(false), m_colors(false), m_texCoords(false),
+          m_extra(0), m_revision(0)
+      {
+      }
+
+      /**
+       * @brief Constructor for a mesh vertex buffer.
+       *
+       * The layout contains the position (3 x Float32), followed by the
+       * optional normal (3 x SNorm16), color (4 x UInt8), texture coordinates
+       * (2 x Float32) and @p extra attributes (Float32, set to 0). The
+       * attributes are the same as the ones from Mesh::triangleAttributes().
+       *
+       * @param primitive Store the triangles or the quads of the mesh.
+       */
+      VertexBuffer(Primitive primitive, bool normals = false, bool colors = false, bool texCoords = false, std::size_t extra = 0);
+
+      const VertexLayout& layout() const
+      {
+        return m_layout;
+      }
+
+      Primitive primitive() const
+      {
+        return m_primitive;
+      }
+
+      /**
+       * @brief Check if the buffer has to be rebuilt for @p mesh.
+       */
+      bool isDirty(const Mesh &mesh) const;
+
+      /**
+       * @brief Rebuild the buffer from @p mesh if it is dirty.
+       *
+       * @return True if the buffer was rebuilt.
+       */
+      bool update(const Mesh &mesh);
+
+      /**
+       * @brief Get the number of vertices.
+       */
+      std::size_t size() const
+      {
+        return m_layout.stride() ? m_data.size() / m_layout.stride() : 0;
+      }
+
+      /**
+       * @brief Resize the buffer to @p numVertices vertices.
+       */
+      void resize(std::size_t numVertices)
+      {
+        m_data.resize(numVertices * m_layout.stride());
+      }
+
+      /**
+       * @brief Encode the components of an attribute.
+       *
+       * @param vertex The vertex index.
+       * @param attribute The attribute index in the layout.
+       * @param values The attribute components.
+       */
+      void set(std::size_t vertex, std::size_t attribute, const Real *values);
+
+      /**
+       * @brief Decode all attributes of a vertex.
+       *
+       * @param vertex The vertex index.
+       * @param attributes Output: layout().numComponents() Reals.
+       */
+      void decode(std::size_t vertex, Real *attributes) const;
+
+      const unsigned char* data() const
+      {
+        return m_data.empty() ? 0 : &m_data[0];
+      }
+
+    private:
+      VertexLayout m_layout;
+      std::vector<unsigned char> m_data;
+      Primitive m_primitive;
+      bool m_normals;
+      bool m_colors;
+      bool m_texCoords;
+      std::size_t m_extra;
+      std::size_t m_revision; //!< The mesh revision, 0 if not built from a mesh.
+  };
+
+}
+
+#endif
@@ -6,6 +6,7 @@
 
 #include <libgfx/transform.h>
 #include <libgfx/mesh.h>
+#include <libgfx/meshcache.h>
 #include <libgfx/utility.h>
 
 namespace CG {
@@ -81,69 +82,6 @@ namespace CG {
         return true;
       }
 
-      std::shared_ptr<GFX::Mesh> createFractal(std::vector<GFX::vec4> &points0, std::vector<GFX::Mesh::Face> &faces,
-          int nrIterations, double fractalScale)
-      {
-        // compute center
-        GFX::vec4 center(GFX::vec4::Zero());
-        for (std::size_t i = 0; i < points0.size(); ++i)
-          center += points0[i];
-        // center figure
-        for (std::size_t i = 0; i < points0.size(); ++i)
-          points0[i] -= center;
-
-        std::size_t h = points0.size();
-        std::vector<GFX::vec4> lastPoints = points0, points;
-
-        for (int i = 0; i < nrIterations; ++i) {
-          points.clear();
-
-          for (std::size_t k = 0; k < lastPoints.size(); ++k) {
-            std::size_t j = (k % h);
-
-            // scale initial points
-            std::vector<GFX::vec4> addPoints;
-            for (std::size_t l = 0; l < h; ++l)
-              addPoints.push_back(points0[l] / std::pow(fractalScale, i + 1));
-
-            // translate small figure to origin
-            GFX::vec4 point_j = addPoints[j];
-            for (std::size_t l = 0; l < addPoints.size(); ++l)
-              addPoints[l] -= point_j;
-
-            // translate small figure to point on figure from previous iteration
-            for (std::size_t l = 0; l < addPoints.size(); ++l)
-              points.push_back(addPoints[l] + lastPoints[k]);
-          }
-
-          lastPoints.swap(points);
-        }
-
-        std::size_t offset = points0.size();
-
-        std::size_t f = faces.size();
-        std::size_t numFaces = f * std::pow(h, nrIterations);
-        while (faces.size() < numFaces) {
-
-          for (std::size_t i = 0; i < f; ++i) {
-            faces.resize(faces.size() + 1);
-            for (std::size_t j = 0; j < faces[i].size(); ++j) {
-              faces.back().push_back(offset + faces[i][j]);
-            }
-          }
-
-          offset += points0.size();
-        }
-
-        std::shared_ptr<GFX::Mesh> mesh(new GFX::Mesh);
-        for (std::size_t i = 0; i < lastPoints.size(); ++i)
-          mesh->addVertex(lastPoints[i].x(), lastPoints[i].y(), lastPoints[i].z());
-        for (std::size_t i = 0; i < faces.size(); ++i)
-          mesh->addFace(faces[i]);
-
-        return mesh;
-      }
-
       img::EasyImage image(const ini::Configuration &conf)
       {
         int size;
@@ -182,44 +120,44 @@ namespace CG {
 
             } else if (type == "Cube") {
 
-              mesh_to_lines2d(*GFX::Mesh::cube(), color, project * model, lines);
+              mesh_to_lines2d(*GFX::MeshCache::instance().cube(), color, project * model, lines);
 
             } else if (type == "Tetrahedron") {
 
-              mesh_to_lines2d(*GFX::Mesh::tetrahedron(), color, project * model, lines);
+              mesh_to_lines2d(*GFX::MeshCache::instance().tetrahedron(), color, project * model, lines);
 
             } else if (type == "Octahedron") {
 
-              mesh_to_lines2d(*GFX::Mesh::octahedron(), color, project * model, lines);
+              mesh_to_lines2d(*GFX::MeshCache::instance().octahedron(), color, project * model, lines);
 
             } else if (type == "Icosahedron") {
 
-              mesh_to_lines2d(*GFX::Mesh::icosahedron(), color, project * model, lines);
+              mesh_to_lines2d(*GFX::MeshCache::instance().icosahedron(), color, project * model, lines);
 
             } else if (type == "Dodecahedron") {
 
-              mesh_to_lines2d(*GFX::Mesh::dodecahedron(), color, project * model, lines);
+              mesh_to_lines2d(*GFX::MeshCache::instance().dodecahedron(), color, project * model, lines);
 
             } else if (type == "BuckyBall") {
 
-              mesh_to_lines2d(*GFX::Mesh::buckyball(), color, project * model, lines);
+              mesh_to_lines2d(*GFX::MeshCache::instance().buckyball(), color, project * model, lines);
 
             } else if (type == "Cone") {
 
               int n = conf[figureName]["n"];
               GFX::Real h = conf[figureName]["height"].as_double_or_die();
-              mesh_to_lines2d(*GFX::Mesh::cone(n, h), color, project * model, lines);
+              mesh_to_lines2d(*GFX::MeshCache::instance().cone(n, h), color, project * model, lines);
 
             } else if (type == "Cylinder") {
 
               int n = conf[figureName]["n"];
               GFX::Real h = conf[figureName]["height"].as_double_or_die();
-              mesh_to_lines2d(*GFX::Mesh::cylinder(n, h), color, project * model, lines);
+              mesh_to_lines2d(*GFX::MeshCache::instance().cylinder(n, h), color, project * model, lines);
 
             } else if (type == "Sphere") {
 
               int n = conf[figureName]["n"];
-              mesh_to_lines2d(*GFX::Mesh::sphere(n), color, project * model, lines);
+              mesh_to_lines2d(*GFX::MeshCache::instance().sphere(n), color, project * model, lines);
 
             } else if (type == "Torus") {
 
@@ -227,7 +165,17 @@ namespace CG {
               int m = conf[figureName]["m"];
               GFX::Real R = conf[figureName]["R"].as_double_or_die();
               GFX::Real r = conf[figureName]["r"].as_double_or_die();
-              mesh_to_lines2d(*GFX::Mesh::torus(n, m, R, r), color, project * model, lines);
+              mesh_to_lines2d(*GFX::MeshCache::instance().torus(n, m, R, r), color, project * model, lines);
+
+            } else if (type == "MeshFile") {
+
+              std::string filename = conf[figureName]["file"].as_string_or_die();
+              std::shared_ptr<const GFX::Mesh> mesh = GFX::MeshCache::instance().file(filename);
+              if (!mesh) {
+                std::cerr << "Could not read mesh file: " << filename << std::endl;
+                return img::EasyImage();
+              }
+              mesh_to_lines2d(*mesh, color, project * model, lines);
 
             } else if (type == "3DLSystem") {
 
@@ -247,25 +195,22 @@ namespace CG {
               int nrIterations = conf[figureName]["nrIterations"];
               double fractalScale = conf[figureName]["fractalScale"];
 
-              std::shared_ptr<GFX::Mesh> unit;
+              std::shared_ptr<const GFX::Mesh> unit;
 
               if (type == "FractalTetrahedron")
-                unit = GFX::Mesh::tetrahedron();
+                unit = GFX::MeshCache::instance().tetrahedron();
               else if (type == "FractalCube")
-                unit = GFX::Mesh::cube();
+                unit = GFX::MeshCache::instance().cube();
               else if (type == "FractalIcosahedron")
-                unit = GFX::Mesh::icosahedron();
+                unit = GFX::MeshCache::instance().icosahedron();
               else if (type == "FractalOctahedron")
-                unit = GFX::Mesh::octahedron();
+                unit = GFX::MeshCache::instance().octahedron();
               else if (type == "FractalDodecahedron")
-                unit = GFX::Mesh::dodecahedron();
+                unit = GFX::MeshCache::instance().dodecahedron();
               else if (type == "FractalBuckyBall")
-                unit = GFX::Mesh::buckyball();
-
-              std::vector<GFX::vec4> points0 = unit->vertices();
-              std::vector<GFX::Mesh::Face> faces = unit->faces();
+                unit = GFX::MeshCache::instance().buckyball();
 
-              std::shared_ptr<GFX::Mesh> mesh = createFractal(points0, faces, nrIterations, fractalScale);
+              std::shared_ptr<GFX::Mesh> mesh = GFX::Mesh::fractal(*unit, nrIterations, fractalScale);
 
               mesh_to_lines2d(*mesh, color, project * model, lines);
 
@@ -358,20 +303,20 @@ namespace CG {
               int n = conf[figureName]["n"]; // cylinder quality
               int m = conf[figureName]["m"]; // sphere quality
 
-              std::shared_ptr<GFX::Mesh> figure;
+              std::shared_ptr<const GFX::Mesh> figure;
 
               if (type == "ThickTetrahedron")
-                figure = GFX::Mesh::tetrahedron();
+                figure = GFX::MeshCache::instance().tetrahedron();
               else if (type == "ThickCube")
-                figure = GFX::Mesh::cube();
+                figure = GFX::MeshCache::instance().cube();
               else if (type == "ThickDodecahedron")
-                figure = GFX::Mesh::dodecahedron();
+                figure = GFX::MeshCache::instance().dodecahedron();
               else if (type == "ThickIcosahedron")
-                figure = GFX::Mesh::icosahedron();
+                figure = GFX::MeshCache::instance().icosahedron();
               else if (type == "ThickOctahedron")
-                figure = GFX::Mesh::octahedron();
+                figure = GFX::MeshCache::instance().octahedron();
               else if (type == "ThickBuckyBall")
-                figure = GFX::Mesh::buckyball();
+                figure = GFX::MeshCache::instance().buckyball();
               else if (type == "Thick3DLSystem") {
                 std::string inputfile = conf[figureName]["inputfile"].as_string_or_die();
                 figure = LSystem3D::generateMesh(inputfile);
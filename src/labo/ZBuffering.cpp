@@ -3,6 +3,7 @@
 
 #include <libgfx/transform.h>
 #include <libgfx/mesh.h>
+#include <libgfx/meshcache.h>
 #include <libgfx/utility.h>
 
 #include "LSystem3D.h"
@@ -49,69 +50,6 @@ namespace CG {
         return m;
       }
 
-      std::shared_ptr<GFX::Mesh> createFractal(std::vector<GFX::vec4> &points0, std::vector<GFX::Mesh::Face> &faces,
-          int nrIterations, double fractalScale)
-      {
-        // compute center
-        GFX::vec4 center(GFX::vec4::Zero());
-        for (std::size_t i = 0; i < points0.size(); ++i)
-          center += points0[i];
-        // center figure
-        for (std::size_t i = 0; i < points0.size(); ++i)
-          points0[i] -= center;
-
-        std::size_t h = points0.size();
-        std::vector<GFX::vec4> lastPoints = points0, points;
-
-        for (int i = 0; i < nrIterations; ++i) {
-          points.clear();
-
-          for (std::size_t k = 0; k < lastPoints.size(); ++k) {
-            std::size_t j = (k % h);
-
-            // scale initial points
-            std::vector<GFX::vec4> addPoints;
-            for (std::size_t l = 0; l < h; ++l)
-              addPoints.push_back(points0[l] / std::pow(fractalScale, i + 1));
-
-            // translate small figure to origin
-            GFX::vec4 point_j = addPoints[j];
-            for (std::size_t l = 0; l < addPoints.size(); ++l)
-              addPoints[l] -= point_j;
-
-            // translate small figure to point on figure from previous iteration
-            for (std::size_t l = 0; l < addPoints.size(); ++l)
-              points.push_back(addPoints[l] + lastPoints[k]);
-          }
-
-          lastPoints.swap(points);
-        }
-
-        std::size_t offset = points0.size();
-
-        std::size_t f = faces.size();
-        std::size_t numFaces = f * std::pow(h, nrIterations);
-        while (faces.size() < numFaces) {
-
-          for (std::size_t i = 0; i < f; ++i) {
-            faces.resize(faces.size() + 1);
-            for (std::size_t j = 0; j < faces[i].size(); ++j) {
-              faces.back().push_back(offset + faces[i][j]);
-            }
-          }
-
-          offset += points0.size();
-        }
-
-        std::shared_ptr<GFX::Mesh> mesh(new GFX::Mesh);
-        for (std::size_t i = 0; i < lastPoints.size(); ++i)
-          mesh->addVertex(lastPoints[i].x(), lastPoints[i].y(), lastPoints[i].z());
-        for (std::size_t i = 0; i < faces.size(); ++i)
-          mesh->addFace(faces[i]);
-
-        return mesh;
-      }
-
       img::EasyImage image(const ini::Configuration &conf)
       {
         int size;
@@ -130,11 +68,24 @@ namespace CG {
           return img::EasyImage();
         }
 
+        // allowed error (in pixels) for simplified meshes, 0 to disable
+        double lodTolerance = 0.0;
+        try {
+          lodTolerance = conf["General"]["lodTolerance"];
+        } catch (...) {}
+
+        // number of threads for drawing, 0 to use all cores
+        int threads = 0;
+        try {
+          threads = conf["General"]["threads"];
+        } catch (...) {}
+
         GFX::mat4 project = GFX::projectionMatrix(eye[0], eye[1], eye[2]);
 
-        std::vector<std::shared_ptr<GFX::Mesh> > meshes;
-        std::vector<GFX::mat4> modelMatrices;
+        std::vector<std::shared_ptr<const GFX::Mesh> > meshes;
+        std::vector<Instances> instances;
         std::vector<GFX::Color> colors;
+        std::vector<bool> culling;
 
         for (int i = 0; i < nrFigures; ++i) {
           std::string figureName = make_string("Figure", i);
@@ -145,67 +96,56 @@ namespace CG {
             colors.push_back(color);
 
             GFX::mat4 model = modelMatrix(figureName, conf);
-            modelMatrices.push_back(model);
+            instances.push_back(Instances(1, model));
+
+            // skip the back facing triangles, the mesh from a file may not be closed
+            bool backFaceCulling = type != "MeshFile";
+            try {
+              backFaceCulling = conf[figureName]["backFaceCulling"];
+            } catch (...) {}
+            culling.push_back(backFaceCulling);
 
             if (type == "Cube") {
 
-              std::shared_ptr<GFX::Mesh> mesh = GFX::Mesh::cube();
-              mesh->triangulate();
-              meshes.push_back(mesh);
+              meshes.push_back(GFX::MeshCache::instance().cube(true));
 
             } else if (type == "Tetrahedron") {
 
-              std::shared_ptr<GFX::Mesh> mesh = GFX::Mesh::tetrahedron();
-              mesh->triangulate();
-              meshes.push_back(mesh);
+              meshes.push_back(GFX::MeshCache::instance().tetrahedron(true));
 
             } else if (type == "Octahedron") {
 
-              std::shared_ptr<GFX::Mesh> mesh = GFX::Mesh::octahedron();
-              mesh->triangulate();
-              meshes.push_back(mesh);
+              meshes.push_back(GFX::MeshCache::instance().octahedron(true));
 
             } else if (type == "Icosahedron") {
 
-              std::shared_ptr<GFX::Mesh> mesh = GFX::Mesh::icosahedron();
-              mesh->triangulate();
-              meshes.push_back(mesh);
+              meshes.push_back(GFX::MeshCache::instance().icosahedron(true));
 
             } else if (type == "Dodecahedron") {
 
-              std::shared_ptr<GFX::Mesh> mesh = GFX::Mesh::dodecahedron();
-              mesh->triangulate();
-              meshes.push_back(mesh);
+              meshes.push_back(GFX::MeshCache::instance().dodecahedron(true));
 
             } else if (type == "BuckyBall") {
 
-              std::shared_ptr<GFX::Mesh> mesh = GFX::Mesh::buckyball();
-              mesh->triangulate();
-              meshes.push_back(mesh);
+              meshes.push_back(GFX::MeshCache::instance().buckyball(true));
 
             } else if (type == "Cone") {
 
               int n = conf[figureName]["n"];
               GFX::Real h = conf[figureName]["height"].as_double_or_die();
-              std::shared_ptr<GFX::Mesh> mesh = GFX::Mesh::cone(n, h);
-              mesh->triangulate();
-              meshes.push_back(mesh);
+              meshes.push_back(GFX::MeshCache::instance().cone(n, h, true));
 
             } else if (type == "Cylinder") {
 
               int n = conf[figureName]["n"];
               GFX::Real h = conf[figureName]["height"].as_double_or_die();
-              std::shared_ptr<GFX::Mesh> mesh = GFX::Mesh::cylinder(n, h);
-              mesh->triangulate();
-              meshes.push_back(mesh);
+              meshes.push_back(GFX::MeshCache::instance().cylinder(n, h, true, true));
 
             } else if (type == "Sphere") {
 
               int n = conf[figureName]["n"];
               //renderMesh(*GFX::Mesh::sphere(n), color, project * model, lines);
-              std::shared_ptr<GFX::Mesh> mesh = GFX::Mesh::sphere(n);
-              mesh->triangulate();
-              meshes.push_back(mesh);
+              meshes.push_back(GFX::MeshCache::instance().sphere(n, true));
 
             } else if (type == "Torus") {
 
@@ -213,8 +153,16 @@ namespace CG {
               int m = conf[figureName]["m"];
               GFX::Real R = conf[figureName]["R"].as_double_or_die();
               GFX::Real r = conf[figureName]["r"].as_double_or_die();
-              std::shared_ptr<GFX::Mesh> mesh = GFX::Mesh::torus(n, m, R, r);
-              mesh->triangulate();
+              meshes.push_back(GFX::MeshCache::instance().torus(n, m, R, r, true));
+
+            } else if (type == "MeshFile") {
+
+              std::string filename = conf[figureName]["file"].as_string_or_die();
+              std::shared_ptr<const GFX::Mesh> mesh = GFX::MeshCache::instance().file(filename, true);
+              if (!mesh) {
+                std::cerr << "Could not read mesh file: " << filename << std::endl;
+                return img::EasyImage();
+              }
               meshes.push_back(mesh);
 
             } else if (type.substr(0, 7) == "Fractal") {
@@ -226,28 +174,29 @@ namespace CG {
               int nrIterations = conf[figureName]["nrIterations"];
               double fractalScale = conf[figureName]["fractalScale"];
 
-              std::shared_ptr<GFX::Mesh> unit;
+              std::shared_ptr<const GFX::Mesh> unit;
 
               if (type == "FractalTetrahedron")
-                unit = GFX::Mesh::tetrahedron();
+                unit = GFX::MeshCache::instance().tetrahedron(true);
               else if (type == "FractalCube")
-                unit = GFX::Mesh::cube();
+                unit = GFX::MeshCache::instance().cube(true);
               else if (type == "FractalIcosahedron")
-                unit = GFX::Mesh::icosahedron();
+                unit = GFX::MeshCache::instance().icosahedron(true);
               else if (type == "FractalOctahedron")
-                unit = GFX::Mesh::octahedron();
+                unit = GFX::MeshCache::instance().octahedron(true);
               else if (type == "FractalDodecahedron")
-                unit = GFX::Mesh::dodecahedron();
+                unit = GFX::MeshCache::instance().dodecahedron(true);
               else if (type == "FractalBuckyBall")
-                unit = GFX::Mesh::buckyball();
+                unit = GFX::MeshCache::instance().buckyball(true);
 
-              std::vector<GFX::vec4> points0 = unit->vertices();
-              std::vector<GFX::Mesh::Face> faces = unit->faces();
+              // draw the unit figure once for every copy in the fractal
+              Instances &transforms = instances.back();
+              transforms.clear();
+              GFX::Mesh::fractalTransforms(*unit, nrIterations, fractalScale, transforms);
+              for (std::size_t j = 0; j < transforms.size(); ++j)
+                transforms[j] = model * transforms[j];
 
-              std::shared_ptr<GFX::Mesh> mesh = createFractal(points0, faces, nrIterations, fractalScale);
-              mesh->triangulate();
-
-              meshes.push_back(mesh);
+              meshes.push_back(unit);
 
             } else if (type == "MengerSponge") {
 
@@ -257,84 +206,8 @@ namespace CG {
 
               int nrIterations = conf[figureName]["nrIterations"];
 
-              std::vector<std::pair<GFX::vec3, GFX::vec3> > cubes(1, std::make_pair(GFX::vec3(-1, -1, -1), GFX::vec3(1, 1, 1)));
-
-              for (int i = 0; i < nrIterations; ++i) {
-                assert(cubes.size());
-                std::vector<std::pair<GFX::vec3, GFX::vec3> > nextCubes;
-
-
-                // the new cube size
-                GFX::Real delta = (cubes.front().second.x() - cubes.front().first.x()) / 3.0;
-
-
-                for (auto cube : cubes) {
-                  // the reference point
-                  GFX::vec3 p = cube.first;
-
-                  // front, bottom
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 0 * delta, p.y() + 0 * delta, p.z() + 0 * delta), GFX::vec3(p.x() + 1 * delta, p.y() + 1 * delta, p.z() + 1 * delta)));
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 1 * delta, p.y() + 0 * delta, p.z() + 0 * delta), GFX::vec3(p.x() + 2 * delta, p.y() + 1 * delta, p.z() + 1 * delta)));
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 2 * delta, p.y() + 0 * delta, p.z() + 0 * delta), GFX::vec3(p.x() + 3 * delta, p.y() + 1 * delta, p.z() + 1 * delta)));
-                  // front, middle
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 0 * delta, p.y() + 1 * delta, p.z() + 0 * delta), GFX::vec3(p.x() + 1 * delta, p.y() + 2 * delta, p.z() + 1 * delta)));
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 2 * delta, p.y() + 1 * delta, p.z() + 0 * delta), GFX::vec3(p.x() + 3 * delta, p.y() + 2 * delta, p.z() + 1 * delta)));
-                  // front, top
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 0 * delta, p.y() + 2 * delta, p.z() + 0 * delta), GFX::vec3(p.x() + 1 * delta, p.y() + 3 * delta, p.z() + 1 * delta)));
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 1 * delta, p.y() + 2 * delta, p.z() + 0 * delta), GFX::vec3(p.x() + 2 * delta, p.y() + 3 * delta, p.z() + 1 * delta)));
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 2 * delta, p.y() + 2 * delta, p.z() + 0 * delta), GFX::vec3(p.x() + 3 * delta, p.y() + 3 * delta, p.z() + 1 * delta)));
-
-                  // middle, bottom
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 0 * delta, p.y() + 0 * delta, p.z() + 1 * delta), GFX::vec3(p.x() + 1 * delta, p.y() + 1 * delta, p.z() + 2 * delta)));
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 2 * delta, p.y() + 0 * delta, p.z() + 1 * delta), GFX::vec3(p.x() + 3 * delta, p.y() + 1 * delta, p.z() + 2 * delta)));
-                  // middle, top
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 0 * delta, p.y() + 2 * delta, p.z() + 1 * delta), GFX::vec3(p.x() + 1 * delta, p.y() + 3 * delta, p.z() + 2 * delta)));
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 2 * delta, p.y() + 2 * delta, p.z() + 1 * delta), GFX::vec3(p.x() + 3 * delta, p.y() + 3 * delta, p.z() + 2 * delta)));
-
-                  // back, bottom
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 0 * delta, p.y() + 0 * delta, p.z() + 2 * delta), GFX::vec3(p.x() + 1 * delta, p.y() + 1 * delta, p.z() + 3 * delta)));
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 1 * delta, p.y() + 0 * delta, p.z() + 2 * delta), GFX::vec3(p.x() + 2 * delta, p.y() + 1 * delta, p.z() + 3 * delta)));
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 2 * delta, p.y() + 0 * delta, p.z() + 2 * delta), GFX::vec3(p.x() + 3 * delta, p.y() + 1 * delta, p.z() + 3 * delta)));
-                  // back, middle
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 0 * delta, p.y() + 1 * delta, p.z() + 2 * delta), GFX::vec3(p.x() + 1 * delta, p.y() + 2 * delta, p.z() + 3 * delta)));
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 2 * delta, p.y() + 1 * delta, p.z() + 2 * delta), GFX::vec3(p.x() + 3 * delta, p.y() + 2 * delta, p.z() + 3 * delta)));
-                  // back, top
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 0 * delta, p.y() + 2 * delta, p.z() + 2 * delta), GFX::vec3(p.x() + 1 * delta, p.y() + 3 * delta, p.z() + 3 * delta)));
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 1 * delta, p.y() + 2 * delta, p.z() + 2 * delta), GFX::vec3(p.x() + 2 * delta, p.y() + 3 * delta, p.z() + 3 * delta)));
-                  nextCubes.push_back(std::make_pair(GFX::vec3(p.x() + 2 * delta, p.y() + 2 * delta, p.z() + 2 * delta), GFX::vec3(p.x() + 3 * delta, p.y() + 3 * delta, p.z() + 3 * delta)));
-
-                }
-
-                cubes.swap(nextCubes);
-              }
-
-              for (auto cube : cubes) {
-                std::shared_ptr<GFX::Mesh> mesh = GFX::Mesh::cube();
-
-                // scale the cube mesh
-                GFX::Real s = (cube.second.x() - cube.first.x()) / 2.0;
-                for (GFX::vec4 &v : mesh->vertices()) {
-                  v.x() *= s;
-                  v.y() *= s;
-                  v.z() *= s;
-                }
-
-                // translate the cube mesh
-                GFX::vec3 c = (cube.first + cube.second) / 2.0;
-                for (GFX::vec4 &v : mesh->vertices()) {
-                  v.x() -= c.x();
-                  v.y() -= c.y();
-                  v.z() -= c.z();
-                }
-
-                mesh->triangulate();
-                meshes.push_back(mesh);
-              }
-
-              while (modelMatrices.size() < meshes.size())
-                modelMatrices.push_back(modelMatrices.back());
-              while (colors.size() < meshes.size())
-                colors.push_back(colors.back());
+              // only the outside of the sponge, hidden cube faces are never generated
+              meshes.push_back(GFX::MeshCache::instance().mengerSponge(nrIterations, true));
 
             } else if (type.substr(0, 5) == "Thick") {
 
@@ -346,29 +219,40 @@ namespace CG {
               int n = conf[figureName]["n"]; // cylinder quality
               int m = conf[figureName]["m"]; // sphere quality
 
-              std::shared_ptr<GFX::Mesh> figure;
+              std::shared_ptr<const GFX::Mesh> figure;
 
               if (type == "ThickTetrahedron")
-                figure = GFX::Mesh::tetrahedron();
+                figure = GFX::MeshCache::instance().tetrahedron();
               else if (type == "ThickCube")
-                figure = GFX::Mesh::cube();
+                figure = GFX::MeshCache::instance().cube();
               else if (type == "ThickDodecahedron")
-                figure = GFX::Mesh::dodecahedron();
+                figure = GFX::MeshCache::instance().dodecahedron();
               else if (type == "ThickIcosahedron")
-                figure = GFX::Mesh::icosahedron();
+                figure = GFX::MeshCache::instance().icosahedron();
               else if (type == "ThickOctahedron")
-                figure = GFX::Mesh::octahedron();
+                figure = GFX::MeshCache::instance().octahedron();
               else if (type == "ThickBuckyBall")
-                figure = GFX::Mesh::buckyball();
+                figure = GFX::MeshCache::instance().buckyball();
               else if (type == "Thick3DLSystem") {
                 std::string inputfile = conf[figureName]["inputfile"].as_string_or_die();
                 figure = LSystem3D::generateMesh(inputfile);
               }
 
-              std::shared_ptr<GFX::Mesh> mesh = GFX::Mesh::thickFigure(figure.get(), radius, n, m);
-
-              mesh->triangulate();
-              meshes.push_back(mesh);
+              // draw a unit sphere for every point and a unit height cylinder for every edge
+              Instances cylinders;
+              instances.back().clear();
+              GFX::Mesh::thickFigureTransforms(*figure, radius, instances.back(), cylinders);
+              for (std::size_t j = 0; j < instances.back().size(); ++j)
+                instances.back()[j] = model * instances.back()[j];
+              for (std::size_t j = 0; j < cylinders.size(); ++j)
+                cylinders[j] = model * cylinders[j];
+
+              meshes.push_back(GFX::MeshCache::instance().sphere(m, true));
+              meshes.push_back(GFX::MeshCache::instance().cylinder(n, 1.0, false, true));
+              instances.push_back(cylinders);
+              colors.push_back(colors.back());
+              // the cylinders are open, their back faces show through the ends
+              culling.push_back(false);
             }
 
           } catch (const std::exception &e) {
@@ -377,7 +261,7 @@ namespace CG {
           }
         }
 
-        return draw_zbuffered_meshes(meshes, project, modelMatrices, colors, size, img::Color(255 * bgColor.r, 255 * bgColor.g, 255 * bgColor.b));
+        return draw_zbuffered_meshes(meshes, project, instances, colors, size, img::Color(255 * bgColor.r, 255 * bgColor.g, 255 * bgColor.b), lodTolerance, std::max(0, threads), culling);
       }
 
   };
@@ -1,12 +1,24 @@
 #include "render.h"
 
 #include <libgfx/mesh.h>
+#include <libgfx/meshcache.h>
 #include <libgfx/buffer.h>
 #include <libgfx/utility.h>
 #include <libgfx/render3d.h>
+#include <libgfx/parallel.h>
+#include <libgfx/span.h>
+#include <libgfx/transform.h>
+#include <libgfx/bresenham.h>
 
 #include <limits>
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace GFX;
 
@@ -129,6 +141,18 @@ img::EasyImage draw_lines(Lines2D &lines, int size, const img::Color &bgColor)
   return image;
 }
 
+/**
+ * @brief A rectangle of pixels [x0, x1) x [y0, y1).
+ */
+struct Tile
+{
+  Tile(int x0_, int y0_, int x1_, int y1_) : x0(x0_), y0(y0_), x1(x1_), y1(y1_)
+  {
+  }
+
+  int x0, y0, x1, y1;
+};
+
 struct Ctx
 {
   Ctx(int width, int height, const img::Color &bgColor) : image(width, height, bgColor), zBuffer(width, height)
@@ -136,6 +160,14 @@ struct Ctx
     zBuffer.clear(std::numeric_limits<Real>::max());
   }
 
+  /**
+   * @brief Get the tile containing the whole image.
+   */
+  Tile area() const
+  {
+    return Tile(0, 0, zBuffer.width(), zBuffer.height());
+  }
+
   void drawPixel(int x, int y, Real z, const Color &color)
   {
     if (z < zBuffer(x, y)) {
@@ -144,76 +176,79 @@ struct Ctx
     }
   }
 
+  /**
+   * @brief Draw a span of flat shaded pixels starting at (x, y) (see
+   * GFX::drawFlatSpan()).
+   */
+  void drawSpan(int x, int y, int n, Real z0, Real w, Real dzdx, int k, const img::Color &color)
+  {
+    // the image is stored column by column
+    GFX::drawFlatSpan(&zBuffer(x, y), reinterpret_cast<unsigned char*>(&image(x, y)),
+        image.get_height() * sizeof(img::Color), n, z0, w, dzdx, k, &color.blue);
+  }
+
   img::EasyImage image;
   GFX::Buffer<Real> zBuffer;
 };
 
-void draw_pixel(Ctx &ctx, int x, int y, Real z0, Real z1, Real i, Real a, const Color &color)
-{
-  Real p = i / a;
-  Real z = (1.0 - p) / z0 + p / z1;
-  ctx.drawPixel(x, y, z, color);
-}
-
+/**
+ * @brief Draw a line using the z-buffer.
+ *
+ * The pixels follow from GFX::BresenhamLine, 1/z is interpolated linearly
+ * along the line.
+ */
 void draw_zbuf_line(Ctx &ctx, const Point3D &p1, const Point3D &p2, const Color &color)
 {
+  // the end points are truncated, except along the line for vertical and
+  // horizontal lines, 1/z is interpolated from the end point the line is
+  // walked from (the smallest y for vertical lines, the smallest x otherwise)
+  int x0 = p1.x, y0 = p1.y, x1 = p2.x, y1 = p2.y;
+  Real z0 = p1.z, z1 = p2.z;
   if (p1.x == p2.x) {
-    // special case for p1.x == p2.x
-    int minY = nearest(std::min(p1.y, p2.y));
-    int maxY = nearest(std::max(p1.y, p2.y));
-    int numY = maxY - minY;
-
-    for (int i = 0; i <= (maxY - minY); ++i)
-      draw_pixel(ctx, p1.x, minY + i, p1.z, p2.z, i, numY, color);
-    return;
-  }
-
-  if (p1.y == p2.y) {
-    // special case for p1.y == p2.y
-    int minX = nearest(std::min(p1.x, p2.x));
-    int maxX = nearest(std::max(p1.x, p2.x));
-    int numX = maxX - minX;
-
-    for (int i = 0; i <= (maxX - minX); ++i)
-      draw_pixel(ctx, minX + i, p1.y, p1.z, p2.z, i, numX, color);
-    return;
-  }
-
-  int x0 = p1.x;
-  int y0 = p1.y;
-  Real z0 = p1.z;
-  int x1 = p2.x;
-  int y1 = p2.y;
-  Real z1 = p2.z;
-
-  if (p1.x > p2.x) {
-    // flip points if p2.x > p1.x: we want p1.x to have the lowest value
+    y0 = nearest(std::min(p1.y, p2.y));
+    y1 = nearest(std::max(p1.y, p2.y));
+    if (p1.y > p2.y)
+      std::swap(z0, z1);
+  } else if (p1.y == p2.y) {
+    x0 = nearest(p1.x);
+    x1 = nearest(p2.x);
+    if (p1.x > p2.x)
+      std::swap(z0, z1);
+  } else if (p1.x > p2.x) {
     std::swap(x0, x1);
     std::swap(y0, y1);
     std::swap(z0, z1);
   }
 
-  Real m = ((Real) y1 - (Real) y0) / ((Real) x1 - (Real) x0);
-  if (-1.0 <= m && m <= 1.0) {
-    int num = x1 - x0;
-    for (int i = 0; i <= (x1 - x0); ++i) {
-      int x = x0 + i;
-      int y = round(y0 + m * i);
-      draw_pixel(ctx, x, y, z0, z1, i, num, color);
-    }
-  } else if (m > 1.0) {
-    int num = y1 - y0;
-    for (int i = 0; i <= (y1 - y0); ++i) {
-      int x = round(x0 + i / m);
-      int y = y0 + i;
-      draw_pixel(ctx, x, y, z0, z1, i, num, color);
+  GFX::BresenhamLine line(x0, y0, x1, y1, 0, 0, ctx.zBuffer.width() - 1, ctx.zBuffer.height() - 1);
+  if (!line.count)
+    return;
+
+  // the image is stored column by column, the z-buffer row by row
+  const std::ptrdiff_t height = ctx.image.get_height(), width = ctx.zBuffer.width();
+  const std::ptrdiff_t pixelMajor = line.xMajor ? line.majorStep * height : line.majorStep;
+  const std::ptrdiff_t pixelMinor = line.xMajor ? line.minorStep : line.minorStep * height;
+  const std::ptrdiff_t depthMajor = line.xMajor ? line.majorStep : line.majorStep * width;
+  const std::ptrdiff_t depthMinor = line.xMajor ? line.minorStep * width : line.minorStep;
+
+  const img::Color c(color.r, color.g, color.b);
+  img::Color *pixel = &ctx.image(line.x, line.y);
+  Real *depth = &ctx.zBuffer(line.x, line.y);
+  const Real steps = line.steps;
+  for (int i = 0; i < line.count; ++i) {
+    // the same 1/z as the end points at the end points
+    Real p = line.steps ? (line.first + i) / steps : 0.0;
+    Real one_over_z = (1.0 - p) / z0 + p / z1;
+    if (one_over_z < *depth) {
+      *pixel = c;
+      *depth = one_over_z;
     }
-  } else if (m < -1.0) {
-    int num = y0 - y1;
-    for (int i = 0; i <= (y0 - y1); ++i) {
-      int x = round(x0 - i / m);
-      int y = y0 - i;
-      draw_pixel(ctx, x, y, z0, z1, i, num, color);
+
+    pixel += pixelMajor;
+    depth += depthMajor;
+    if (line.next()) {
+      pixel += pixelMinor;
+      depth += depthMinor;
     }
   }
 }
@@ -316,10 +351,157 @@ std::pair<GFX::Point2D, GFX::Point2D> get_min_max(const GFX::Mesh &mesh, const G
   return std::make_pair(GFX::Point2D(minX, minY), GFX::Point2D(maxX, maxY));
 }
 
-void screen_coordinate(const Ctx &ctx, GFX::vec4 &v, Real d, Real cx, Real cy)
+std::pair<GFX::Point2D, GFX::Point2D> get_min_max(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes, const GFX::mat4 &project,
+    const std::vector<Instances> &instances)
+{
+  std::pair<Point2D, Point2D> minMax = std::make_pair(Point2D(std::numeric_limits<Real>::max(), std::numeric_limits<Real>::max()),
+                                                      Point2D(std::numeric_limits<Real>::min(), std::numeric_limits<Real>::min()));
+
+  for (std::size_t i = 0; i < meshes.size(); ++i)
+    for (std::size_t j = 0; j < instances[i].size(); ++j) {
+      std::pair<Point2D, Point2D> meshMinMax = get_min_max(*meshes[i], project * instances[i][j]);
+      if (meshMinMax.first.x < minMax.first.x)
+        minMax.first.x = meshMinMax.first.x;
+      if (meshMinMax.first.y < minMax.first.y)
+        minMax.first.y = meshMinMax.first.y;
+      if (meshMinMax.second.x > minMax.second.x)
+        minMax.second.x = meshMinMax.second.x;
+      if (meshMinMax.second.y > minMax.second.y)
+        minMax.second.y = meshMinMax.second.y;
+    }
+
+  return minMax;
+}
+
+VertexStage::VertexStage(bool withNormals_) : withNormals(withNormals_)
+{
+  clear();
+}
+
+void VertexStage::clear()
+{
+  eye.clear();
+  screen.clear();
+  normal.clear();
+  first.clear();
+  bounds.clear();
+  minMax = std::make_pair(Point2D(std::numeric_limits<Real>::max(), std::numeric_limits<Real>::max()),
+                          Point2D(std::numeric_limits<Real>::min(), std::numeric_limits<Real>::min()));
+}
+
+std::size_t VertexStage::add(const GFX::Mesh &mesh, const GFX::mat4 &T)
+{
+  std::size_t offset = eye.size();
+  eye.resize(offset + mesh.vertices().size());
+  if (withNormals)
+    normal.resize(eye.size());
+
+  first.push_back(offset);
+  bounds.push_back(transform(mesh, T, offset));
+  merge(bounds.back());
+
+  return offset;
+}
+
+std::pair<Point2D, Point2D> VertexStage::transform(const GFX::Mesh &mesh, const GFX::mat4 &T, std::size_t offset)
+{
+  const std::vector<GFX::vec4> &vertices = mesh.vertices();
+
+  std::pair<Point2D, Point2D> meshMinMax = std::make_pair(Point2D(std::numeric_limits<Real>::max(), std::numeric_limits<Real>::max()),
+                                                          Point2D(-std::numeric_limits<Real>::max(), -std::numeric_limits<Real>::max()));
+
+  for (std::size_t i = 0; i < vertices.size(); ++i) {
+    // transform vertex
+    GFX::vec4 &p = eye[offset + i];
+    p = T * vertices[i];
+    // project using d = 1
+    Real x = p.x() / -p.z();
+    Real y = p.y() / -p.z();
+    meshMinMax.first.x = std::min(meshMinMax.first.x, x);
+    meshMinMax.first.y = std::min(meshMinMax.first.y, y);
+    meshMinMax.second.x = std::max(meshMinMax.second.x, x);
+    meshMinMax.second.y = std::max(meshMinMax.second.y, y);
+  }
+
+  if (withNormals) {
+    // normals are transformed by the inverse transpose
+    // the meshes are copied with vertex normals for VertexLighting (see
+    // with_vertex_normals()), the count alone is enough even when it is also
+    // the number of faces
+    const std::vector<GFX::vec4> &normals = mesh.normals();
+    bool vertexNormals = normals.size() == vertices.size();
+    GFX::mat3 N = T.topLeftCorner<3, 3>().inverse().transpose();
+    for (std::size_t i = 0; i < vertices.size(); ++i)
+      normal[offset + i] = vertexNormals ? GFX::vec3((N * normals[i].head<3>()).normalized()) : GFX::vec3::Zero();
+  }
+
+  return meshMinMax;
+}
+
+void VertexStage::merge(const std::pair<Point2D, Point2D> &meshMinMax)
 {
-  v.x() = d * v.x() / -v.z() + ctx.zBuffer.width() / 2.0 - cx;
-  v.y() = d * v.y() / -v.z() + ctx.zBuffer.height() / 2.0 - cy;
+  // empty meshes have inverted bounds
+  if (meshMinMax.first.x > meshMinMax.second.x)
+    return;
+
+  if (meshMinMax.first.x < minMax.first.x)
+    minMax.first.x = meshMinMax.first.x;
+  if (meshMinMax.first.y < minMax.first.y)
+    minMax.first.y = meshMinMax.first.y;
+  if (meshMinMax.second.x > minMax.second.x)
+    minMax.second.x = meshMinMax.second.x;
+  if (meshMinMax.second.y > minMax.second.y)
+    minMax.second.y = meshMinMax.second.y;
+}
+
+void VertexStage::add(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes, const GFX::mat4 &project,
+    const std::vector<Instances> &instances, unsigned int numThreads)
+{
+  // the offsets for all instances
+  std::vector<const GFX::Mesh*> instanceMeshes;
+  std::vector<GFX::mat4> transforms;
+  std::size_t numVertices = eye.size();
+  for (std::size_t i = 0; i < meshes.size(); ++i)
+    for (std::size_t k = 0; k < instances[i].size(); ++k) {
+      instanceMeshes.push_back(meshes[i].get());
+      transforms.push_back(project * instances[i][k]);
+      first.push_back(numVertices);
+      numVertices += meshes[i]->vertices().size();
+    }
+
+  std::size_t firstInstance = bounds.size();
+  eye.resize(numVertices);
+  if (withNormals)
+    normal.resize(numVertices);
+  bounds.resize(first.size());
+
+  // transform the instances in parallel
+  GFX::parallel_for(0, instanceMeshes.size(), [&] (std::size_t n) {
+    std::size_t instance = firstInstance + n;
+    bounds[instance] = transform(*instanceMeshes[n], transforms[n], first[instance]);
+  }, 16, numThreads);
+
+  for (std::size_t n = firstInstance; n < bounds.size(); ++n)
+    merge(bounds[n]);
+}
+
+void VertexStage::project(int width, int height, Real d, Real cx, Real cy, unsigned int numThreads)
+{
+  screen.resize(eye.size());
+  GFX::parallel_for(0, eye.size(), [&] (std::size_t i) {
+    screen[i] = GFX::vec2(d * eye[i].x() / -eye[i].z() + width / 2.0 - cx,
+                          d * eye[i].y() / -eye[i].z() + height / 2.0 - cy);
+  }, 4096, numThreads);
+}
+
+/**
+ * @brief Combine an eye space vertex with its screen coordinates.
+ *
+ * The result has x and y in screen space and z in eye space.
+ */
+inline GFX::vec4 screen_vertex(const GFX::vec4 &eye, const GFX::vec2 &screen)
+{
+  return GFX::vec4(screen.x(), screen.y(), eye.z(), eye.w());
 }
 
 void screen_coordinate(int width, int height, GFX::vec4 &v, Real d, Real cx, Real cy)
@@ -328,116 +510,989 @@ void screen_coordinate(int width, int height, GFX::vec4 &v, Real d, Real cx, Rea
   v.y() = d * v.y() / -v.z() + height / 2.0 - cy;
 }
 
-void draw_zbuffered_triangle(Ctx &ctx, const GFX::vec4 &vA, const GFX::vec4 &vB, const GFX::vec4 &vC,
-    const GFX::mat4 &T, Real d, Real cx, Real cy, const GFX::Color &color)
+/**
+ * @brief Call a fragment function for every pixel of the spans from
+ * rasterize_triangle().
+ */
+template<typename Fragment>
+struct PixelFragments
 {
-  // apply model-view matrix (Model space -> Word Space -> View space)
-  GFX::vec4 A = T * vA;
-  GFX::vec4 B = T * vB;
-  GFX::vec4 C = T * vC;
+  PixelFragments(Real dzdx_, const Fragment &fragment_) : dzdx(dzdx_), fragment(fragment_)
+  {
+  }
 
-  GFX::vec3 u = GFX::vec3(B.data()) - GFX::vec3(A.data());
-  GFX::vec3 v = GFX::vec3(C.data()) - GFX::vec3(A.data());
-  GFX::vec3 w = u.cross(v);
+  void operator()(int x, int y, int n, Real w, int k)
+  {
+    for (int i = 0; i < n; ++i)
+      fragment(x + i, y, w + (k + i) * dzdx);
+  }
+
+  Real dzdx;
+  Fragment fragment;
+};
+
+template<typename Fragment>
+PixelFragments<Fragment> pixel_fragments(Real dzdx, const Fragment &fragment)
+{
+  return PixelFragments<Fragment>(dzdx, fragment);
+}
+
+/**
+ * @brief Draw the pixels of a single scanline.
+ *
+ * The x range follows from the intersections of the scanline with the
+ * triangle edges (see impl::compute_x_range()). The span is relative to the
+ * start of the range so the offsets do not depend on the tile.
+ */
+template<typename Span>
+void rasterize_scanline(int y, const GFX::vec4 &A, const GFX::vec4 &B, const GFX::vec4 &C,
+    Real xG, Real yG, Real dzdx, Real dzdy, const Tile &tile, Span &span)
+{
+  std::pair<int, int> xRange = impl::compute_x_range(y, A, B, C);
+  int first = std::max(xRange.first, tile.x0);
+  int last = std::min(xRange.second, tile.x1 - 1);
+
+  if (first <= last)
+    span(first, y, last - first + 1, (xRange.first - xG) * dzdx + (y - yG) * dzdy, first - xRange.first);
+}
 
-  GFX::Real k = w.dot(GFX::vec3(A.data()));
-  GFX::Real dzdx = -w.x() / (d * k);
-  GFX::Real dzdy = -w.y() / (d * k);
+/**
+ * @brief Edge function for the fixed-point rasterizer.
+ *
+ * The value is the cross product (Q - P) x (X - P) for a pixel X, in units
+ * of 2^-32 pixels^2. It is positive inside the triangle.
+ */
+struct EdgeFunction
+{
+  static const int subpixelBits = 16;
 
-  GFX::Real zG = 1.0 / (3.0 * A.z()) + 1.0 / (3.0 * B.z()) + 1.0 / (3.0 * C.z());
+  EdgeFunction(int64_t px, int64_t py, int64_t qx, int64_t qy, int x, int y, int sign)
+  {
+    int64_t dx = qx - px;
+    int64_t dy = qy - py;
+    value = sign * (dx * ((static_cast<int64_t>(y) << subpixelBits) - py) - dy * ((static_cast<int64_t>(x) << subpixelBits) - px));
+    stepX = sign * -dy * (1 << subpixelBits);
+    stepY = sign * dx * (1 << subpixelBits);
+  }
 
-  // project (View Space -> Screen space)
-  screen_coordinate(ctx, A, d, cx, cy);
-  screen_coordinate(ctx, B, d, cx, cy);
-  screen_coordinate(ctx, C, d, cx, cy);
+  int64_t value; //!< The value for the first pixel.
+  int64_t stepX; //!< The change for a step along the x axis.
+  int64_t stepY; //!< The change for a step along the y axis.
+  int64_t bound; //!< Values in [-bound, bound] may have the wrong sign.
+};
 
-  GFX::Real xG = (A.x() + B.x() + C.x()) / 3.0;
-  GFX::Real yG = (A.y() + B.y() + C.y()) / 3.0;
+/**
+ * @brief Rasterize a triangle in screen space using edge functions.
+ *
+ * The vertices are snapped to 1/65536 pixels and the edge functions are
+ * evaluated incrementally in 64 bit integers. The screen is traversed in
+ * 8x8 blocks: blocks outside an edge are skipped, blocks inside all edges
+ * are filled without per pixel tests.
+ *
+ * The covered pixels are the same as for scanline rasterization with
+ * impl::compute_x_range(). The error due to snapping is bounded, pixels
+ * closer to an edge than this bound and scanlines through a vertex use the
+ * scanline rules directly. Triangles outside the fixed-point range are
+ * drawn using scanlines only.
+ *
+ * Only the pixels inside @p tile are drawn. The tile corners have to be
+ * multiples of the block size (or the image size) so the blocks and the
+ * interpolated values are the same for every tile.
+ *
+ * @param span Function called as span(x, y, n, w, k) for runs of pixels.
+ * Pixel x + i (0 <= i < n) has the offset w + (k + i) * dzdx, the offset is
+ * (x - xG) * dzdx + (y - yG) * dzdy. Use pixel_fragments() to get single
+ * pixels.
+ */
+template<typename Span>
+void rasterize_triangle(const GFX::vec4 &A, const GFX::vec4 &B, const GFX::vec4 &C,
+    Real xG, Real yG, Real dzdx, Real dzdy, const Tile &tile, Span span)
+{
+  // largest coordinate for which the edge functions fit in 64 bits
+  const Real maxCoordinate = 8192.0;
+  // scanlines closer to a vertex use the scanline rules
+  const Real vertexEpsilon = 10e-6;
+  const int blockSize = 8;
 
   // determine y range in screen coordinates
   int minY = nearest(std::min(A.y(), std::min(B.y(), C.y())) + 0.5);
   int maxY = nearest(std::max(A.y(), std::max(B.y(), C.y())) - 0.5);
+  minY = std::max(minY, tile.y0);
+  maxY = std::min(maxY, tile.y1 - 1);
+  if (minY > maxY)
+    return;
 
-  for (int y = minY; y <= maxY; ++y) {
-    // compute x range in screen coordinates
-    std::pair<int, int> xRange = impl::compute_x_range(y, A, B, C);
-    int xL = xRange.first;
-    int xR = xRange.second;
+  Real xMin = std::min(A.x(), std::min(B.x(), C.x()));
+  Real xMax = std::max(A.x(), std::max(B.x(), C.x()));
+  Real yMin = std::min(A.y(), std::min(B.y(), C.y()));
+  Real yMax = std::max(A.y(), std::max(B.y(), C.y()));
 
-    for (int x = xL; x <= xR; ++x) {
+  if (!(xMin >= 1.0 && yMin >= 1.0 && xMax < maxCoordinate && yMax < maxCoordinate)) {
+    for (int y = minY; y <= maxY; ++y)
+      rasterize_scanline(y, A, B, C, xG, yG, dzdx, dzdy, tile, span);
+    return;
+  }
 
-      // interpolate 1/z
-      GFX::Real z = 1.0001 * zG + (x - xG) * dzdx + (y - yG) * dzdy;
+  // fixed-point vertices (the coordinates are positive, round to nearest)
+  const Real one = 1 << EdgeFunction::subpixelBits;
+  int64_t ax = static_cast<int64_t>(A.x() * one + 0.5), ay = static_cast<int64_t>(A.y() * one + 0.5);
+  int64_t bx = static_cast<int64_t>(B.x() * one + 0.5), by = static_cast<int64_t>(B.y() * one + 0.5);
+  int64_t cx = static_cast<int64_t>(C.x() * one + 0.5), cy = static_cast<int64_t>(C.y() * one + 0.5);
 
-      // draw the pixel
-      ctx.drawPixel(x, y, z, color);
+  // the blocks covering the triangle (inside the tile)
+  int minX = std::max(static_cast<int>(xMin) & ~(blockSize - 1), tile.x0);
+  int maxX = std::min(static_cast<int>(xMax) + 1, tile.x1 - 1);
+  if (minX > maxX)
+    return;
+  int firstY = minY & ~(blockSize - 1);
+
+  int64_t area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+  int sign = area < 0 ? -1 : 1;
+  EdgeFunction edges[3] = {
+    EdgeFunction(ax, ay, bx, by, minX, firstY, sign),
+    EdgeFunction(bx, by, cx, cy, minX, firstY, sign),
+    EdgeFunction(cx, cy, ax, ay, minX, firstY, sign)
+  };
+
+  // Moving the vertices by at most h changes the edge functions by at most
+  // h * (2 * (|X - P|_1) + |Q - P|_1) + 4 * h^2 for pixels X in the blocks.
+  // A pixel must also be further than vertexEpsilon from the intersection
+  // of the scanline with the edge.
+  const Real h = 0.5 / one;
+  Real extent = 2.0 * (xMax - xMin + yMax - yMin + 2 * blockSize + 2);
+  const GFX::vec4 *vertices[4] = { &A, &B, &C, &A };
+  for (int i = 0; i < 3; ++i) {
+    Real dx = std::abs(vertices[i + 1]->x() - vertices[i]->x());
+    Real dy = std::abs(vertices[i + 1]->y() - vertices[i]->y());
+    Real bound = h * (extent + dx + dy) + 4.0 * h * h + vertexEpsilon * dy;
+    edges[i].bound = static_cast<int64_t>(std::ceil(bound * one * one)) + 1;
+  }
+
+  // the orientation is not certain for (nearly) degenerate triangles
+  if (std::abs(area) <= edges[0].bound) {
+    for (int y = minY; y <= maxY; ++y)
+      rasterize_scanline(y, A, B, C, xG, yG, dzdx, dzdy, tile, span);
+    return;
+  }
+
+  // Scanlines through a vertex, for these compute_x_range() is not the
+  // intersection of the scanline and the triangle. Only the nearest integer
+  // can be closer than vertexEpsilon to a vertex.
+  int vertexRows[3];
+  for (int i = 0; i < 3; ++i) {
+    int y = nearest(vertices[i]->y());
+    vertexRows[i] = std::abs(y - vertices[i]->y()) < vertexEpsilon ? y : minY - 1;
+    if (vertexRows[i] >= minY && vertexRows[i] <= maxY && (i < 1 || vertexRows[i] != vertexRows[0]) &&
+        (i < 2 || vertexRows[i] != vertexRows[1]))
+      rasterize_scanline(vertexRows[i], A, B, C, xG, yG, dzdx, dzdy, tile, span);
+  }
+
+  // Bias the edge functions so the pixels certainly inside an edge have a
+  // value >= 0 and pixels which are not certainly outside have a value
+  // >= -margin.
+  const int last = blockSize - 1;
+  int64_t margin[3], blockLo[3], blockHi[3], rowLo[3], rowHi[3];
+  for (int i = 0; i < 3; ++i) {
+    edges[i].value -= edges[i].bound + 1;
+    margin[i] = 2 * edges[i].bound + 1;
+    rowLo[i] = std::min<int64_t>(0, last * edges[i].stepX);
+    rowHi[i] = std::max<int64_t>(0, last * edges[i].stepX) + margin[i];
+    blockLo[i] = std::min<int64_t>(0, last * edges[i].stepX) + std::min<int64_t>(0, last * edges[i].stepY);
+    blockHi[i] = std::max<int64_t>(0, last * edges[i].stepX) + std::max<int64_t>(0, last * edges[i].stepY) + margin[i];
+  }
+
+  for (int blockY = firstY; blockY <= maxY; blockY += blockSize) {
+    int y0 = std::max(blockY, minY);
+    int y1 = std::min(blockY + last, maxY);
+
+    int64_t e[3];
+    for (int i = 0; i < 3; ++i)
+      e[i] = edges[i].value + (blockY - firstY) * edges[i].stepY;
+
+    for (int blockX = minX; blockX <= maxX; blockX += blockSize) {
+      // classify the block using the edge functions at its corners
+      int64_t hi = (e[0] + blockHi[0]) | (e[1] + blockHi[1]) | (e[2] + blockHi[2]);
+      int64_t lo = (e[0] + blockLo[0]) | (e[1] + blockLo[1]) | (e[2] + blockLo[2]);
+
+      if (hi >= 0) {
+        for (int y = y0; y <= y1; ++y) {
+          if (y == vertexRows[0] || y == vertexRows[1] || y == vertexRows[2])
+            continue;
+
+          Real w = (blockX - xG) * dzdx + (y - yG) * dzdy;
+
+          if (lo >= 0) {
+            span(blockX, y, blockSize, w, 0);
+            continue;
+          }
+
+          int64_t e0 = e[0] + (y - blockY) * edges[0].stepY;
+          int64_t e1 = e[1] + (y - blockY) * edges[1].stepY;
+          int64_t e2 = e[2] + (y - blockY) * edges[2].stepY;
+
+          // classify the row of the block
+          if (((e0 + rowHi[0]) | (e1 + rowHi[1]) | (e2 + rowHi[2])) < 0)
+            continue;
+          if (((e0 + rowLo[0]) | (e1 + rowLo[1]) | (e2 + rowLo[2])) >= 0) {
+            span(blockX, y, blockSize, w, 0);
+            continue;
+          }
+
+          // the run of covered pixels (the covered pixels of a row are contiguous)
+          int runFirst = blockSize, runLast = -1;
+          for (int i = 0; i < blockSize; ++i) {
+            bool inside = (e0 | e1 | e2) >= 0;
+            if (!inside && ((e0 + margin[0]) | (e1 + margin[1]) | (e2 + margin[2])) >= 0) {
+              // too close to an edge, use the scanline rules
+              std::pair<int, int> xRange = impl::compute_x_range(y, A, B, C);
+              inside = xRange.first <= blockX + i && blockX + i <= xRange.second;
+            }
+
+            if (inside) {
+              runFirst = std::min(runFirst, i);
+              runLast = i;
+            }
+
+            e0 += edges[0].stepX;
+            e1 += edges[1].stepX;
+            e2 += edges[2].stepX;
+          }
+
+          if (runFirst <= runLast)
+            span(blockX + runFirst, y, runLast - runFirst + 1, w, runFirst);
+        }
+      }
+
+      for (int i = 0; i < 3; ++i)
+        e[i] += blockSize * edges[i].stepX;
+    }
+  }
+}
+
+/**
+ * @brief The screen space vertices and the plane of 1/z for a triangle.
+ *
+ * The depth of pixel (x, y) is z0 + (x - xG) * dzdx + (y - yG) * dzdy (see
+ * rasterize_triangle()).
+ */
+struct TrianglePlane
+{
+  TrianglePlane()
+  {
+  }
+
+  TrianglePlane(const GFX::vec4 &eyeA, const GFX::vec4 &eyeB, const GFX::vec4 &eyeC,
+      const GFX::vec2 &screenA, const GFX::vec2 &screenB, const GFX::vec2 &screenC, Real d)
+  {
+    GFX::vec3 u = GFX::vec3(eyeB.data()) - GFX::vec3(eyeA.data());
+    GFX::vec3 v = GFX::vec3(eyeC.data()) - GFX::vec3(eyeA.data());
+    GFX::vec3 w = u.cross(v);
+
+    Real k = w.dot(GFX::vec3(eyeA.data()));
+    dzdx = -w.x() / (d * k);
+    dzdy = -w.y() / (d * k);
+
+    zG = 1.0 / (3.0 * eyeA.z()) + 1.0 / (3.0 * eyeB.z()) + 1.0 / (3.0 * eyeC.z());
+
+    // projected vertices (View Space -> Screen space)
+    A = screen_vertex(eyeA, screenA);
+    B = screen_vertex(eyeB, screenB);
+    C = screen_vertex(eyeC, screenC);
+
+    xG = (A.x() + B.x() + C.x()) / 3.0;
+    yG = (A.y() + B.y() + C.y()) / 3.0;
+    z0 = 1.0001 * zG;
+  }
+
+  GFX::vec4 A, B, C; // screen space vertices (z in eye space)
+  Real xG, yG, zG, z0, dzdx, dzdy;
+};
+
+void draw_zbuffered_triangle(Ctx &ctx, const GFX::vec4 &eyeA, const GFX::vec4 &eyeB, const GFX::vec4 &eyeC,
+    const GFX::vec2 &screenA, const GFX::vec2 &screenB, const GFX::vec2 &screenC, Real d, const GFX::Color &color,
+    const Tile &tile)
+{
+  const TrianglePlane plane(eyeA, eyeB, eyeC, screenA, screenB, screenC, d);
+  const img::Color pixel(color.r, color.g, color.b);
+  rasterize_triangle(plane.A, plane.B, plane.C, plane.xG, plane.yG, plane.dzdx, plane.dzdy, tile,
+      [&] (int x, int y, int n, GFX::Real w, int k) {
+    // interpolate 1/z and draw the pixels
+    ctx.drawSpan(x, y, n, plane.z0, w, plane.dzdx, k, pixel);
+  });
+}
+
+/**
+ * @brief Draw a triangle in a z-buffer only (no colors).
+ */
+void draw_depth_triangle(GFX::Buffer<Real> &zBuffer, const GFX::vec4 &eyeA, const GFX::vec4 &eyeB, const GFX::vec4 &eyeC,
+    const GFX::vec2 &screenA, const GFX::vec2 &screenB, const GFX::vec2 &screenC, Real d, const Tile &tile)
+{
+  const TrianglePlane plane(eyeA, eyeB, eyeC, screenA, screenB, screenC, d);
+  rasterize_triangle(plane.A, plane.B, plane.C, plane.xG, plane.yG, plane.dzdx, plane.dzdy, tile,
+      [&] (int x, int y, int n, GFX::Real w, int k) {
+    // interpolate 1/z and keep the nearest depth
+    GFX::drawDepthSpan(&zBuffer(x, y), n, plane.z0, w, plane.dzdx, k);
+  });
+}
+
+std::vector<std::vector<std::shared_ptr<const GFX::Mesh> > > select_levels_of_detail(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes,
+    const VertexStage &stage, const std::vector<Instances> &instances, GFX::Real d, GFX::Real tolerance)
+{
+  std::vector<std::vector<std::shared_ptr<const GFX::Mesh> > > levels(meshes.size());
+
+  std::size_t n = 0;
+  for (std::size_t i = 0; i < meshes.size(); ++i) {
+    // the size of the mesh in object space
+    const std::vector<GFX::vec4> &vertices = meshes[i]->vertices();
+    if (vertices.empty()) {
+      levels[i].assign(instances[i].size(), meshes[i]);
+      n += instances[i].size();
+      continue;
+    }
+    GFX::vec4 lo = vertices.front(), hi = vertices.front();
+    for (std::size_t j = 1; j < vertices.size(); ++j) {
+      lo = lo.cwiseMin(vertices[j]);
+      hi = hi.cwiseMax(vertices[j]);
+    }
+    Real extent = (hi - lo).head<3>().maxCoeff();
+
+    for (std::size_t k = 0; k < instances[i].size(); ++k) {
+      // the size of the instance on screen
+      const std::pair<Point2D, Point2D> &minMax = stage.bounds[n++];
+      Real pixels = d * std::max(minMax.second.x - minMax.first.x, minMax.second.y - minMax.first.y);
+      Real maxError = pixels > 0.0 ? tolerance * extent / pixels : std::numeric_limits<Real>::max();
+      levels[i].push_back(GFX::MeshCache::instance().levelOfDetail(meshes[i], maxError));
     }
   }
 
+  return levels;
 }
 
 img::EasyImage draw_zbuffered_mesh(const GFX::Mesh &mesh, const GFX::mat4 &T, const GFX::Color &color, int size, const img::Color &bgColor)
 {
-  // compute some properties for the lines
-  std::pair<Point2D, Point2D> minMax = get_min_max(mesh, T);
-  std::pair<int, int> imageSizes = get_image_sizes(minMax, size);
-  Real d = get_scale_factor(minMax, imageSizes.first);
-  Point2D center = get_center(minMax, d);
+  // transform the vertices and compute some properties for the mesh
+  VertexStage stage;
+  stage.add(mesh, T);
+  std::pair<int, int> imageSizes = get_image_sizes(stage.minMax, size);
+  Real d = get_scale_factor(stage.minMax, imageSizes.first);
+  Point2D center = get_center(stage.minMax, d);
 
   Ctx ctx(imageSizes.first, imageSizes.second, bgColor);
+  stage.project(imageSizes.first, imageSizes.second, d, center.x, center.y);
+
+  const std::vector<GFX::vec4> &eye = stage.eye;
+  const std::vector<GFX::vec2> &screen = stage.screen;
 
   for (std::size_t i = 0; i < mesh.faces().size(); ++i) {
     const std::vector<int> &face = mesh.faces()[i];
     assert(face.size() == 3);
 
-    const GFX::vec4 &A = mesh.vertices()[face[0]];
-    const GFX::vec4 &B = mesh.vertices()[face[1]];
-    const GFX::vec4 &C = mesh.vertices()[face[2]];
-
-    draw_zbuffered_triangle(ctx, A, B, C, T, d, center.x, center.y, color);
+    draw_zbuffered_triangle(ctx, eye[face[0]], eye[face[1]], eye[face[2]],
+        screen[face[0]], screen[face[1]], screen[face[2]], d, color, ctx.area());
   }
 
   return ctx.image;
 }
 
-img::EasyImage draw_zbuffered_meshes(const std::vector<std::shared_ptr<GFX::Mesh> > &meshes, const GFX::mat4 &project,
-    const std::vector<GFX::mat4> &modelMatrices, const std::vector<GFX::Color> &colors, int size, const img::Color &bgColor)
+/**
+ * @brief A sphere containing all vertices of a mesh.
+ */
+struct BoundingSphere
 {
-  // compute some properties for the lines
-  std::pair<Point2D, Point2D> minMax = std::make_pair(Point2D(std::numeric_limits<Real>::max(), std::numeric_limits<Real>::max()),
-                                                      Point2D(std::numeric_limits<Real>::min(), std::numeric_limits<Real>::min()));
+  GFX::vec3 center;
+  Real radius;
+};
 
-  for (std::size_t i = 0; i < meshes.size(); ++i) {
-    std::pair<Point2D, Point2D> meshMinMax = get_min_max(*meshes[i], project * modelMatrices[i]);
-    if (meshMinMax.first.x < minMax.first.x)
-      minMax.first.x = meshMinMax.first.x;
-    if (meshMinMax.first.y < minMax.first.y)
-      minMax.first.y = meshMinMax.first.y;
-    if (meshMinMax.second.x > minMax.second.x)
-      minMax.second.x = meshMinMax.second.x;
-    if (meshMinMax.second.y > minMax.second.y)
-      minMax.second.y = meshMinMax.second.y;
+BoundingSphere bounding_sphere(const GFX::Mesh &mesh)
+{
+  const std::vector<GFX::vec4> &vertices = mesh.vertices();
+
+  BoundingSphere sphere;
+  sphere.center = GFX::vec3::Zero();
+  sphere.radius = 0.0;
+  if (vertices.empty())
+    return sphere;
+
+  // the center of the bounding box
+  GFX::vec3 lo(vertices[0].data()), hi(vertices[0].data());
+  for (std::size_t i = 1; i < vertices.size(); ++i) {
+    lo = lo.cwiseMin(GFX::vec3(vertices[i].data()));
+    hi = hi.cwiseMax(GFX::vec3(vertices[i].data()));
   }
+  sphere.center = 0.5 * (lo + hi);
 
-  std::pair<int, int> imageSizes = get_image_sizes(minMax, size);
-  Real d = get_scale_factor(minMax, imageSizes.first);
-  Point2D center = get_center(minMax, d);
+  for (std::size_t i = 0; i < vertices.size(); ++i)
+    sphere.radius = std::max(sphere.radius, (GFX::vec3(vertices[i].data()) - sphere.center).norm());
 
-  Ctx ctx(imageSizes.first, imageSizes.second, bgColor);
+  return sphere;
+}
 
-  for (std::size_t i = 0; i < meshes.size(); ++i) {
-    for (std::size_t j = 0; j < meshes[i]->faces().size(); ++j) {
-      const std::vector<int> &face = meshes[i]->faces()[j];
-      assert(face.size() == 3);
+/**
+ * @brief The part of eye space that is drawn in the image.
+ *
+ * A point is visible if it is in front of the eye and it projects inside the
+ * image (see VertexStage::project()). The frustum is bounded by 5 planes
+ * through the eye.
+ */
+struct Frustum
+{
+  Frustum(int width, int height, Real d, Real cx, Real cy)
+  {
+    // the projected x = d * x / -z + width / 2 - cx must be in [-1, width + 1]
+    Real left = cx - width / 2.0 - 1.0;
+    Real right = cx + width / 2.0 + 1.0;
+    Real bottom = cy - height / 2.0 - 1.0;
+    Real top = cy + height / 2.0 + 1.0;
+
+    // a point p is inside if normals[i].dot(p) >= 0 for all planes
+    normals[0] = GFX::vec3(d, 0.0, left).normalized();
+    normals[1] = GFX::vec3(-d, 0.0, -right).normalized();
+    normals[2] = GFX::vec3(0.0, d, bottom).normalized();
+    normals[3] = GFX::vec3(0.0, -d, -top).normalized();
+    normals[4] = GFX::vec3(0.0, 0.0, -1.0);
+  }
 
-      const GFX::vec4 &A = meshes[i]->vertices()[face[0]];
-      const GFX::vec4 &B = meshes[i]->vertices()[face[1]];
-      const GFX::vec4 &C = meshes[i]->vertices()[face[2]];
+  /**
+   * @brief Check if (part of) a sphere in eye space may be visible.
+   */
+  bool intersects(const GFX::vec3 &center, Real radius) const
+  {
+    for (int i = 0; i < 5; ++i)
+      if (normals[i].dot(center) < -radius)
+        return false;
+    return true;
+  }
 
-      draw_zbuffered_triangle(ctx, A, B, C, project * modelMatrices[i], d, center.x, center.y, colors[i]);
+  GFX::vec3 normals[5];
+};
+
+/**
+ * @brief Check if a triangle in eye space faces away from the eye.
+ *
+ * The vertices of a front facing triangle are in counterclockwise order
+ * (seen from the eye at the origin). This is the sign of w = u x v from the
+ * triangle setup (see draw_zbuffered_triangle()).
+ */
+inline bool is_back_facing(const GFX::vec4 &A, const GFX::vec4 &B, const GFX::vec4 &C)
+{
+  GFX::vec3 u = GFX::vec3(B.data()) - GFX::vec3(A.data());
+  GFX::vec3 v = GFX::vec3(C.data()) - GFX::vec3(A.data());
+  GFX::vec3 w = u.cross(v);
+  return w.dot(GFX::vec3(A.data())) >= 0.0;
+}
+
+/**
+ * @brief The screen bounding box of a triangle (or instance) and a lower
+ * bound for its depth values.
+ */
+struct Bounds
+{
+  Bounds() : box(0, 0, 0, 0), depth(std::numeric_limits<Real>::max())
+  {
+  }
+
+  Tile box;
+  Real depth;
+};
+
+/**
+ * @brief Compute the bounds for a triangle.
+ *
+ * The pixels drawn for the triangle (see draw_zbuffered_triangle()) are inside
+ * the box (clamped to the image) and their depth values (the biased
+ * interpolated 1/z) are not less than depth. Triangles with a vertex behind
+ * the eye get the lowest possible depth so they are never culled.
+ */
+Bounds triangle_bounds(const GFX::vec4 &eyeA, const GFX::vec4 &eyeB, const GFX::vec4 &eyeC,
+    const GFX::vec2 &A, const GFX::vec2 &B, const GFX::vec2 &C, int width, int height)
+{
+  Bounds bounds;
+
+  Real xMin = std::min(A.x(), std::min(B.x(), C.x())) - 1.0;
+  Real xMax = std::max(A.x(), std::max(B.x(), C.x())) + 2.0;
+  Real yMin = std::min(A.y(), std::min(B.y(), C.y())) - 1.0;
+  Real yMax = std::max(A.y(), std::max(B.y(), C.y())) + 2.0;
+  if (!(xMin <= xMax && yMin <= yMax)) {
+    // invalid coordinates (e.g. NaN)
+    bounds.box = Tile(0, 0, width, height);
+    bounds.depth = -std::numeric_limits<Real>::max();
+    return bounds;
+  }
+
+  bounds.box = Tile(static_cast<int>(std::max(0.0, std::min<Real>(width, xMin))),
+                    static_cast<int>(std::max(0.0, std::min<Real>(height, yMin))),
+                    static_cast<int>(std::max(0.0, std::min<Real>(width, xMax))),
+                    static_cast<int>(std::max(0.0, std::min<Real>(height, yMax))));
+
+  if (!(eyeA.z() < 0.0 && eyeB.z() < 0.0 && eyeC.z() < 0.0)) {
+    bounds.depth = -std::numeric_limits<Real>::max();
+    return bounds;
+  }
+
+  // 1/z is linear in screen space
+  Real zA = 1.0 / eyeA.z();
+  Real zB = 1.0 / eyeB.z();
+  Real zC = 1.0 / eyeC.z();
+  Real area = (B.x() - A.x()) * (C.y() - A.y()) - (C.x() - A.x()) * (B.y() - A.y());
+  Real dzdx = ((zB - zA) * (C.y() - A.y()) - (zC - zA) * (B.y() - A.y())) / area;
+  Real dzdy = ((zC - zA) * (B.x() - A.x()) - (zB - zA) * (C.x() - A.x())) / area;
+  Real slope = std::abs(dzdx) + std::abs(dzdy);
+  if (!(slope < std::numeric_limits<Real>::max())) {
+    // degenerate triangle
+    bounds.depth = -std::numeric_limits<Real>::max();
+    return bounds;
+  }
+
+  // the depth of a pixel is 1/z + 0.0001 * zG (zG is the mean of 1/z at the
+  // vertices), allow pixel centers slightly outside the triangle and rounding
+  Real zMin = std::min(zA, std::min(zB, zC));
+  bounds.depth = 1.0001 * zMin - 2.0 * slope - 1e-9 * std::abs(zMin);
+
+  return bounds;
+}
+
+/**
+ * @brief The triangles of all instances of a frame.
+ *
+ * The vertices of the full meshes are taken from the VertexStage for the
+ * frame, the vertices of the simplified meshes are kept in lodStage. The
+ * instances are sorted roughly front to back so hidden triangles are more
+ * likely to be culled by the HiZ buffer (see draw_frame()). The triangles of
+ * an instance are consecutive.
+ */
+struct Frame
+{
+  struct Triangle
+  {
+    std::size_t figure; // the index in meshes
+    const GFX::vec4 *eye[3];
+    const GFX::vec2 *screen[3];
+    const GFX::ColorF *color[3]; // the vertex colors (see shadeVertices()), 0 if there are none
+  };
+
+  /**
+   * @brief Collect the triangles for all instances.
+   *
+   * Instances with a bounding sphere outside the view frustum are skipped.
+   *
+   * @param levels The mesh for every instance (see select_levels_of_detail()),
+   * empty to draw the full meshes.
+   * @param backFaceCulling Skip the back facing triangles of a mesh (closed
+   * meshes only), empty to draw all triangles.
+   */
+  Frame(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes, const GFX::mat4 &project,
+      const std::vector<Instances> &instances, const VertexStage &stage,
+      const std::vector<std::vector<std::shared_ptr<const GFX::Mesh> > > &levels, const std::vector<bool> &backFaceCulling,
+      int width, int height, Real d, Real cx, Real cy, unsigned int numThreads)
+  {
+    lodStage.withNormals = stage.withNormals;
+    m_numColors = 0;
+    Frustum frustum(width, height, d, cx, cy);
+    std::map<const GFX::Mesh*, BoundingSphere> spheres;
+
+    std::vector<std::size_t> lodFirst;
+    std::vector<Real> distance; // the distance to the eye along the view direction
+    for (std::size_t i = 0; i < meshes.size(); ++i)
+      for (std::size_t k = 0; k < instances[i].size(); ++k) {
+        GFX::mat4 T = project * instances[i][k];
+        Instance instance;
+        instance.figure = i;
+        instance.mesh = levels.empty() ? meshes[i].get() : levels[i][k].get();
+        // a mirroring transformation reverses the order of the vertices
+        instance.mirrored = T.topLeftCorner<3, 3>().determinant() < 0.0;
+
+        // transform the bounding sphere to eye space
+        std::map<const GFX::Mesh*, BoundingSphere>::iterator sphere = spheres.find(instance.mesh);
+        if (sphere == spheres.end())
+          sphere = spheres.insert(std::make_pair(instance.mesh, bounding_sphere(*instance.mesh))).first;
+        GFX::vec4 center = T * GFX::vec4(sphere->second.center.x(), sphere->second.center.y(), sphere->second.center.z(), 1.0);
+        Real scale = std::max(T.col(0).head<3>().norm(), std::max(T.col(1).head<3>().norm(), T.col(2).head<3>().norm()));
+        instance.visible = frustum.intersects(GFX::vec3(center.data()), scale * sphere->second.radius);
+        distance.push_back(-center.z());
+
+        m_instances.push_back(instance);
+        bool lod = instance.visible && instance.mesh != meshes[i].get();
+        lodFirst.push_back(lod ? lodStage.add(*instance.mesh, T) : 0);
+      }
+    lodStage.project(width, height, d, cx, cy, numThreads);
+
+    // front to back
+    std::vector<std::size_t> order(m_instances.size());
+    for (std::size_t n = 0; n < order.size(); ++n)
+      order[n] = n;
+    std::stable_sort(order.begin(), order.end(), [&] (std::size_t a, std::size_t b) {
+      return distance[a] < distance[b];
+    });
+
+    for (std::size_t n : order) {
+      Instance &instance = m_instances[n];
+      if (!instance.visible)
+        continue;
+
+      bool full = instance.mesh == meshes[instance.figure].get();
+      const VertexStage &vertices = full ? stage : lodStage;
+      std::size_t offset = full ? stage.first[n] : lodFirst[n];
+      instance.eye = vertices.eye.data() + offset;
+      instance.screen = vertices.screen.data() + offset;
+      instance.normal = vertices.withNormals ? vertices.normal.data() + offset : 0;
+      instance.firstColor = m_numColors;
+      m_numColors += instance.mesh->vertices().size();
+
+      bool cull = !backFaceCulling.empty() && backFaceCulling[instance.figure];
+      for (std::size_t j = 0; j < instance.mesh->faces().size(); ++j) {
+        const std::vector<int> &face = instance.mesh->faces()[j];
+        assert(face.size() == 3);
+        if (cull && is_back_facing(instance.eye[face[0]], instance.eye[face[1]], instance.eye[face[2]]) != instance.mirrored)
+          continue;
+        m_triangles.push_back(std::make_pair(n, j));
+      }
+    }
+
+    m_bounds.resize(m_triangles.size());
+    GFX::parallel_for(0, m_triangles.size(), [&] (std::size_t t) {
+      Triangle triangle = this->triangle(t);
+      m_bounds[t] = triangle_bounds(*triangle.eye[0], *triangle.eye[1], *triangle.eye[2],
+          *triangle.screen[0], *triangle.screen[1], *triangle.screen[2], width, height);
+    }, 1024, numThreads);
+
+    // the bounds of the instances contain the bounds of their triangles
+    for (std::size_t t = 0; t < m_triangles.size(); ++t) {
+      Bounds &bounds = m_instances[m_triangles[t].first].bounds;
+      const Bounds &triangle = m_bounds[t];
+      if (bounds.box.x0 == bounds.box.x1)
+        bounds = triangle;
+      else {
+        bounds.box = Tile(std::min(bounds.box.x0, triangle.box.x0), std::min(bounds.box.y0, triangle.box.y0),
+                          std::max(bounds.box.x1, triangle.box.x1), std::max(bounds.box.y1, triangle.box.y1));
+        bounds.depth = std::min(bounds.depth, triangle.depth);
+      }
+    }
+  }
+
+  std::size_t size() const
+  {
+    return m_triangles.size();
+  }
+
+  Triangle triangle(std::size_t t) const
+  {
+    const Instance &instance = m_instances[m_triangles[t].first];
+    const std::vector<int> &face = instance.mesh->faces()[m_triangles[t].second];
+
+    Triangle triangle;
+    triangle.figure = instance.figure;
+    for (int i = 0; i < 3; ++i) {
+      triangle.eye[i] = instance.eye + face[i];
+      triangle.screen[i] = instance.screen + face[i];
+      triangle.color[i] = m_colors.empty() ? 0 : &m_colors[instance.firstColor + face[i]];
     }
+    return triangle;
+  }
+
+  /**
+   * @brief Compute a color for every vertex of the visible instances.
+   *
+   * The vertex stage must have the normals (see VertexStage::withNormals).
+   *
+   * @param shade Function called as shade(figure, eye, screen, normal) for
+   * every vertex, returns the color.
+   */
+  template<typename Shade>
+  void shadeVertices(Shade shade, unsigned int numThreads)
+  {
+    m_colors.resize(m_numColors);
+    GFX::parallel_for(0, m_instances.size(), [&] (std::size_t n) {
+      const Instance &instance = m_instances[n];
+      if (!instance.visible)
+        return;
+      assert(instance.normal);
+      for (std::size_t i = 0; i < instance.mesh->vertices().size(); ++i)
+        m_colors[instance.firstColor + i] = shade(instance.figure, instance.eye[i], instance.screen[i], instance.normal[i]);
+    }, 1, numThreads);
+  }
+
+  /**
+   * @brief Get the instance of triangle t.
+   */
+  std::size_t instance(std::size_t t) const
+  {
+    return m_triangles[t].first;
+  }
+
+  const Bounds& triangleBounds(std::size_t t) const
+  {
+    return m_bounds[t];
   }
 
+  const Bounds& instanceBounds(std::size_t n) const
+  {
+    return m_instances[n].bounds;
+  }
+
+  VertexStage lodStage;
+
+private:
+  struct Instance
+  {
+    std::size_t figure;
+    const GFX::Mesh *mesh;
+    const GFX::vec4 *eye;
+    const GFX::vec2 *screen;
+    const GFX::vec3 *normal; // 0 without normals
+    std::size_t firstColor; // the color of the first vertex in m_colors
+    Bounds bounds;
+    bool mirrored;
+    bool visible;
+  };
+
+  std::vector<Instance> m_instances;
+  std::vector<GFX::ColorF> m_colors; // the vertex colors of the visible instances
+  std::size_t m_numColors; // the number of vertices of the visible instances
+  std::vector<std::pair<std::size_t, std::size_t> > m_triangles; // (instance, face)
+  std::vector<Bounds> m_bounds; // the bounds for every triangle
+};
+
+/**
+ * @brief A hierarchical z-buffer for occlusion culling.
+ *
+ * Level 0 has the max. depth for every 8x8 block of pixels in a z-buffer,
+ * level 1 the max. depth for every 8x8 blocks (the 64x64 tiles of
+ * draw_frame()). Drawing only lowers depth values so old values are still
+ * upper bounds. Blocks are marked dirty when drawn and only recomputed when
+ * the old value can not reject a triangle. Different threads can use
+ * different 64x64 tiles at the same time.
+ */
+class HiZ
+{
+public:
+  HiZ(const GFX::Buffer<Real> &zBuffer) : m_zBuffer(zBuffer), m_blocksX((zBuffer.width() + 7) / 8),
+      m_blocksY((zBuffer.height() + 7) / 8), m_cellsX((m_blocksX + 7) / 8), m_cellsY((m_blocksY + 7) / 8),
+      m_blocks(m_blocksX * m_blocksY, std::numeric_limits<Real>::max()), m_dirty(m_blocksX * m_blocksY, 1),
+      m_cells(m_cellsX * m_cellsY, std::numeric_limits<Real>::max()), m_dirtyBlocks(m_cellsX * m_cellsY, 0)
+  {
+    // all blocks are dirty until the z-buffer is read
+    for (int by = 0; by < m_blocksY; ++by)
+      for (int bx = 0; bx < m_blocksX; ++bx)
+        ++m_dirtyBlocks[(by / 8) * m_cellsX + bx / 8];
+  }
+
+  /**
+   * @brief Check if no pixel in @p box with a depth of at least @p depth
+   * can pass the depth test.
+   */
+  bool occluded(const Tile &box, Real depth)
+  {
+    if (box.x0 >= box.x1 || box.y0 >= box.y1)
+      return true;
+
+    int bx0 = box.x0 / 8, bx1 = (box.x1 - 1) / 8;
+    int by0 = box.y0 / 8, by1 = (box.y1 - 1) / 8;
+    for (int cy = by0 / 8; cy <= by1 / 8; ++cy)
+      for (int cx = bx0 / 8; cx <= bx1 / 8; ++cx) {
+        int cell = cy * m_cellsX + cx;
+        if (depth >= m_cells[cell])
+          continue;
+
+        for (int by = std::max(by0, 8 * cy); by <= std::min(by1, 8 * cy + 7); ++by)
+          for (int bx = std::max(bx0, 8 * cx); bx <= std::min(bx1, 8 * cx + 7); ++bx) {
+            int block = by * m_blocksX + bx;
+            if (depth >= m_blocks[block])
+              continue;
+            if (m_dirty[block])
+              update(bx, by, cell);
+            if (depth < m_blocks[block])
+              return false;
+          }
+      }
+
+    return true;
+  }
+
+  /**
+   * @brief Mark the blocks overlapping @p box as dirty after drawing.
+   */
+  void invalidate(const Tile &box)
+  {
+    if (box.x0 >= box.x1 || box.y0 >= box.y1)
+      return;
+
+    for (int by = box.y0 / 8; by <= (box.y1 - 1) / 8; ++by)
+      for (int bx = box.x0 / 8; bx <= (box.x1 - 1) / 8; ++bx) {
+        int block = by * m_blocksX + bx;
+        if (!m_dirty[block]) {
+          m_dirty[block] = 1;
+          ++m_dirtyBlocks[(by / 8) * m_cellsX + bx / 8];
+        }
+      }
+  }
+
+private:
+  void update(int bx, int by, int cell)
+  {
+    Real max = -std::numeric_limits<Real>::max();
+    for (int y = 8 * by; y < std::min(m_zBuffer.height(), 8 * by + 8); ++y) {
+      const Real *row = &m_zBuffer(8 * bx, y);
+      for (int x = 0; x < std::min(8, m_zBuffer.width() - 8 * bx); ++x)
+        max = std::max(max, row[x]);
+    }
+
+    int block = by * m_blocksX + bx;
+    m_blocks[block] = max;
+    m_dirty[block] = 0;
+
+    // update the cell once all its blocks are up to date
+    if (--m_dirtyBlocks[cell])
+      return;
+    int cx = cell % m_cellsX, cy = cell / m_cellsX;
+    max = -std::numeric_limits<Real>::max();
+    for (int y = 8 * cy; y < std::min(m_blocksY, 8 * cy + 8); ++y)
+      for (int x = 8 * cx; x < std::min(m_blocksX, 8 * cx + 8); ++x)
+        max = std::max(max, m_blocks[y * m_blocksX + x]);
+    m_cells[cell] = max;
+  }
+
+  const GFX::Buffer<Real> &m_zBuffer;
+  int m_blocksX, m_blocksY;
+  int m_cellsX, m_cellsY;
+  std::vector<Real> m_blocks; // level 0
+  std::vector<unsigned char> m_dirty; // for every block
+  std::vector<Real> m_cells; // level 1
+  std::vector<int> m_dirtyBlocks; // the number of dirty blocks in every cell
+};
+
+inline Tile intersect(const Tile &a, const Tile &b)
+{
+  return Tile(std::max(a.x0, b.x0), std::max(a.y0, b.y0), std::min(a.x1, b.x1), std::min(a.y1, b.y1));
+}
+
+/**
+ * @brief Draw the triangles of a tile that are not hidden.
+ *
+ * The triangles are triangleAt(i) for i in [begin, end). Before drawing the
+ * first triangle of an instance, the
+ * bounds of the instance are tested against the HiZ buffer, then the bounds
+ * of every triangle. Hidden instances and triangles are skipped.
+ */
+template<typename TriangleAt, typename DrawTriangle>
+void draw_tile(const Frame &frame, HiZ &hiZ, const Tile &tile, std::size_t begin, std::size_t end,
+    const TriangleAt &triangleAt, const DrawTriangle &draw)
+{
+  std::size_t instance = std::numeric_limits<std::size_t>::max();
+  bool hidden = false;
+  for (std::size_t i = begin; i < end; ++i) {
+    std::size_t t = triangleAt(i);
+    if (frame.instance(t) != instance) {
+      instance = frame.instance(t);
+      const Bounds &bounds = frame.instanceBounds(instance);
+      hidden = hiZ.occluded(intersect(bounds.box, tile), bounds.depth);
+    }
+    if (hidden)
+      continue;
+
+    const Bounds &bounds = frame.triangleBounds(t);
+    Tile box = intersect(bounds.box, tile);
+    if (hiZ.occluded(box, bounds.depth))
+      continue;
+
+    draw(t, tile);
+    hiZ.invalidate(box);
+  }
+}
+
+/**
+ * @brief Draw the triangles of a frame.
+ *
+ * With a single thread the triangles are drawn one by one. With more threads
+ * the image is divided in 64x64 tiles and every triangle is added to the bins
+ * of the tiles overlapping its bounding box, in the same order. The tiles are
+ * then drawn in parallel, every tile by a single thread. Since the triangles
+ * covering a pixel are drawn in the same order, the image is the same.
+ * Instances and triangles hidden behind the pixels drawn so far are skipped
+ * (see HiZ).
+ *
+ * @param numThreads The number of threads, 0 to use all cores.
+ * @param draw Function called as draw(t, tile) to draw the pixels of
+ * triangle t inside the tile. It may only lower the depth values in
+ * @p zBuffer inside the bounds of the triangle.
+ */
+template<typename DrawTriangle>
+void draw_frame(const GFX::Buffer<Real> &zBuffer, const Frame &frame, unsigned int numThreads, const DrawTriangle &draw)
+{
+  HiZ hiZ(zBuffer);
+
+  if (GFX::threadCount(numThreads) <= 1) {
+    draw_tile(frame, hiZ, Tile(0, 0, zBuffer.width(), zBuffer.height()), 0, frame.size(), [] (std::size_t i) { return i; }, draw);
+    return;
+  }
+
+  const int tileSize = 64;
+  const int width = zBuffer.width();
+  const int height = zBuffer.height();
+  const int tilesX = (width + tileSize - 1) / tileSize;
+  const int tilesY = (height + tileSize - 1) / tileSize;
+
+  // the range of tiles overlapped by every triangle
+  std::vector<Tile> ranges(frame.size(), Tile(0, 0, 0, 0));
+  GFX::parallel_for(0, frame.size(), [&] (std::size_t t) {
+    const Tile &box = frame.triangleBounds(t).box;
+    if (box.x0 < box.x1 && box.y0 < box.y1)
+      ranges[t] = Tile(box.x0 / tileSize, box.y0 / tileSize, (box.x1 - 1) / tileSize + 1, (box.y1 - 1) / tileSize + 1);
+  }, 1024, numThreads);
+
+  // bin the triangles (counting sort keeps the order within each tile)
+  std::vector<std::size_t> binStart(tilesX * tilesY + 1, 0);
+  for (std::size_t t = 0; t < ranges.size(); ++t)
+    for (int ty = ranges[t].y0; ty < ranges[t].y1; ++ty)
+      for (int tx = ranges[t].x0; tx < ranges[t].x1; ++tx)
+        ++binStart[ty * tilesX + tx + 1];
+  for (std::size_t i = 1; i < binStart.size(); ++i)
+    binStart[i] += binStart[i - 1];
+
+  std::vector<std::size_t> bins(binStart.back());
+  std::vector<std::size_t> binEnd(binStart.begin(), binStart.end() - 1);
+  for (std::size_t t = 0; t < ranges.size(); ++t)
+    for (int ty = ranges[t].y0; ty < ranges[t].y1; ++ty)
+      for (int tx = ranges[t].x0; tx < ranges[t].x1; ++tx)
+        bins[binEnd[ty * tilesX + tx]++] = t;
+
+  // every thread draws complete tiles
+  GFX::parallel_for(0, tilesX * tilesY, [&] (std::size_t i) {
+    int tx = i % tilesX;
+    int ty = i / tilesX;
+    Tile tile(tx * tileSize, ty * tileSize, std::min(width, (tx + 1) * tileSize), std::min(height, (ty + 1) * tileSize));
+
+    draw_tile(frame, hiZ, tile, binStart[i], binStart[i + 1], [&] (std::size_t b) { return bins[b]; }, draw);
+  }, 1, numThreads);
+}
+
+img::EasyImage draw_zbuffered_meshes(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes, const GFX::mat4 &project,
+    const std::vector<Instances> &instances, const std::vector<GFX::Color> &colors, int size, const img::Color &bgColor,
+    GFX::Real lodTolerance, unsigned int numThreads, const std::vector<bool> &backFaceCulling)
+{
+  // transform the vertices and compute some properties for the meshes
+  VertexStage stage;
+  stage.add(meshes, project, instances, numThreads);
+
+  std::pair<int, int> imageSizes = get_image_sizes(stage.minMax, size);
+  Real d = get_scale_factor(stage.minMax, imageSizes.first);
+  Point2D center = get_center(stage.minMax, d);
+
+  Ctx ctx(imageSizes.first, imageSizes.second, bgColor);
+  stage.project(imageSizes.first, imageSizes.second, d, center.x, center.y, numThreads);
+
+  // simplified meshes for small instances
+  std::vector<std::vector<std::shared_ptr<const GFX::Mesh> > > levels;
+  if (lodTolerance > 0.0)
+    levels = select_levels_of_detail(meshes, stage, instances, d, lodTolerance);
+
+  Frame frame(meshes, project, instances, stage, levels, backFaceCulling, imageSizes.first, imageSizes.second, d, center.x, center.y, numThreads);
+
+  draw_frame(ctx.zBuffer, frame, numThreads, [&] (std::size_t t, const Tile &tile) {
+    Frame::Triangle triangle = frame.triangle(t);
+    draw_zbuffered_triangle(ctx, *triangle.eye[0], *triangle.eye[1], *triangle.eye[2],
+        *triangle.screen[0], *triangle.screen[1], *triangle.screen[2], d, colors[triangle.figure], tile);
+  });
+
   return ctx.image;
 }
 
@@ -451,345 +1506,947 @@ img::EasyImage draw_zbuffered_meshes(const std::vector<std::shared_ptr<GFX::Mesh
 ////////////////////////////////////////////////////////////////////////////////
 
 
-void draw_zbuffered_triangle(Ctx &ctx, const GFX::vec4 &vA, const GFX::vec4 &vB, const GFX::vec4 &vC,
-    const GFX::mat4 &T, Real d, Real cx, Real cy, const std::vector<Light> &lights, const Material &material)
+/**
+ * @brief Lookup table for pow(x, exponent) with 0 <= x <= 1 (FastLighting).
+ *
+ * The values in between are interpolated linearly. Larger exponents use
+ * more entries so the error stays around 1e-4 for exponents >= 1.
+ */
+struct PowerTable
 {
-  // apply model-view matrix (Model space -> Word Space -> View space)
-  GFX::vec4 A = T * vA;
-  GFX::vec4 B = T * vB;
-  GFX::vec4 C = T * vC;
-
-  GFX::vec3 u = GFX::vec3(B.data()) - GFX::vec3(A.data());
-  GFX::vec3 v = GFX::vec3(C.data()) - GFX::vec3(A.data());
-  GFX::vec3 w = u.cross(v);
-
-  // normal
-  const GFX::vec3 n = w.normalized();
-
-  GFX::Real k = w.dot(GFX::vec3(A.data()));
-  GFX::Real dzdx = -w.x() / (d * k);
-  GFX::Real dzdy = -w.y() / (d * k);
+  PowerTable(Real exponent = 1.0)
+  {
+    int size = std::min(std::max(static_cast<int>(32 * exponent), 256), 65536);
+    scale = size;
+    values.resize(size + 2);
+    for (int i = 0; i <= size; ++i)
+      values[i] = std::pow(static_cast<Real>(i) / size, exponent);
+    // x = 1 interpolates between the last two entries
+    values[size + 1] = values[size];
+  }
 
-  GFX::Real zG = 1.0 / (3.0 * A.z()) + 1.0 / (3.0 * B.z()) + 1.0 / (3.0 * C.z());
+  Real operator()(Real x) const
+  {
+    Real p = std::min(x, 1.0) * scale;
+    int i = static_cast<int>(p);
+    Real alpha = p - i;
+    return values[i] + alpha * (values[i + 1] - values[i]);
+  }
 
-  // project (View Space -> Screen space)
-  screen_coordinate(ctx, A, d, cx, cy);
-  screen_coordinate(ctx, B, d, cx, cy);
-  screen_coordinate(ctx, C, d, cx, cy);
+  std::vector<Real> values;
+  Real scale; // the number of steps between 0 and 1
+};
 
-  GFX::Real xG = (A.x() + B.x() + C.x()) / 3.0;
-  GFX::Real yG = (A.y() + B.y() + C.y()) / 3.0;
+/**
+ * @brief Approximate 1 / sqrt(x[i]) for 4 values (FastLighting).
+ *
+ * The estimate of the SSE rsqrt instruction is refined with one Newton-Raphson
+ * step, the relative error is about 1e-7.
+ */
+inline void fast_rsqrt4(const Real x[4], Real result[4])
+{
+#ifdef __SSE2__
+  __m128 v = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(x)), _mm_cvtpd_ps(_mm_loadu_pd(x + 2)));
+  __m128 r = _mm_rsqrt_ps(v);
+  // r * (1.5 - 0.5 * v * r * r)
+  r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), v), _mm_mul_ps(r, r))));
+  _mm_storeu_pd(result, _mm_cvtps_pd(r));
+  _mm_storeu_pd(result + 2, _mm_cvtps_pd(_mm_movehl_ps(r, r)));
+#else
+  for (int i = 0; i < 4; ++i)
+    result[i] = 1.0 / std::sqrt(x[i]);
+#endif
+}
 
-  // determine y range in screen coordinates
-  int minY = nearest(std::min(A.y(), std::min(B.y(), C.y())) + 0.5);
-  int maxY = nearest(std::max(A.y(), std::max(B.y(), C.y())) - 0.5);
+/**
+ * @brief Approximate v.normalized() (FastLighting).
+ */
+inline GFX::vec3 fast_normalized(const GFX::vec3 &v)
+{
+  Real x[4] = { v.squaredNorm(), 1.0, 1.0, 1.0 }, r[4];
+  fast_rsqrt4(x, r);
+  return v * r[0];
+}
 
-  // compute ambient light
-  GFX::ColorF ambient = GFX::Color::black();
-  for (auto light : lights) {
-    ambient.r += material.ambient.r * light.ambient.r;
-    ambient.g += material.ambient.g * light.ambient.g;
-    ambient.b += material.ambient.b * light.ambient.b;
+/**
+ * @brief The lights of one type with every property in its own array.
+ */
+struct LightArrays
+{
+  void add(const Light &light, std::size_t i)
+  {
+    x.push_back(light.vec().x());
+    y.push_back(light.vec().y());
+    z.push_back(light.vec().z());
+    diffuse.push_back(light.diffuse);
+    specular.push_back(light.specular);
+    squaredRange.push_back(light.range > 0.0 ? light.range * light.range : std::numeric_limits<Real>::infinity());
+    index.push_back(i);
   }
 
-  // compute diffuse light
-  bool doPerPixelLighting = material.reflection != 0.0;
-  GFX::ColorF diffuse = GFX::Color::black();
-  for (auto light : lights) {
-    if (light.type == Light::InfLight) {
-      GFX::Real cos_alpha = n.dot(-light.dir());
-      if (cos_alpha > 0.0) {
-        diffuse.r += material.diffuse.r * light.diffuse.r * cos_alpha;
-        diffuse.g += material.diffuse.g * light.diffuse.g * cos_alpha;
-        diffuse.b += material.diffuse.b * light.diffuse.b * cos_alpha;
-      }
-    } else
-      doPerPixelLighting = true;
+  std::size_t size() const
+  {
+    return index.size();
   }
 
-  GFX::ColorF triangle_color(ambient.r + diffuse.r,
-                             ambient.g + diffuse.g,
-                             ambient.b + diffuse.b);
+  /**
+   * @brief The position (point lights) or direction (infinite lights) of light i.
+   */
+  GFX::vec3 vec(std::size_t i) const
+  {
+    return GFX::vec3(x[i], y[i], z[i]);
+  }
 
-  if (!doPerPixelLighting) {
+  std::vector<Real> x, y, z;
+  std::vector<GFX::ColorF> diffuse;
+  std::vector<GFX::ColorF> specular;
+  std::vector<Real> squaredRange; // infinity for lights without a range
+  std::vector<std::size_t> index; // the index in Lighting::lights (and the shadow masks)
+};
 
-    for (int y = minY; y <= maxY; ++y) {
-      // compute x range in screen coordinates
-      std::pair<int, int> xRange = impl::compute_x_range(y, A, B, C);
-      int xL = xRange.first;
-      int xR = xRange.second;
+/**
+ * @brief The attenuation of a point light at squared distance @p squaredDistance
+ * (see Light::range).
+ */
+inline Real attenuation(Real squaredDistance, Real squaredRange)
+{
+  if (squaredDistance >= squaredRange)
+    return 0.0;
+  Real a = 1.0 - squaredDistance / squaredRange;
+  return a * a;
+}
 
-      for (int x = xL; x <= xR; ++x) {
-        // interpolate 1/z
-        GFX::Real z = 1.0001 * zG + (x - xG) * dzdx + (y - yG) * dzdy;
-        // draw the pixel
-        ctx.drawPixel(x, y, z, triangle_color);
-      }
-    }
+/**
+ * @brief The lights (and shadow masks) for drawing a frame.
+ */
+struct Lighting
+{
+  Lighting(const std::vector<Light> &lights_, const std::vector<ShadowMask> &shadowMasks_, const GFX::mat4 &invProject,
+      const std::vector<Material> &materials, LightingAccuracy accuracy_, int width_, int height_, Real d_, Real cx_, Real cy_)
+    : lights(lights_), shadowMasks(shadowMasks_), lightRanges(false), accuracy(accuracy_), tilesX(0), width(width_),
+      height(height_), d(d_), cx(cx_), cy(cy_)
+  {
+    assert(shadowMasks.empty() || lights.size() == shadowMasks.size());
 
-  } else {
+    if (accuracy == FastLighting)
+      for (const Material &material : materials)
+        powerTables.push_back(material.reflection != 0.0 ? PowerTable(material.reflection) : PowerTable());
 
-    std::vector<GFX::vec4> lightPos(lights.size(), GFX::vec4::Zero());
     for (std::size_t i = 0; i < lights.size(); ++i)
       if (lights[i].type == Light::PointLight) {
-        lightPos[i] = lights[i].vec();
-      }
+        pointLights.add(lights[i], i);
+        lightRanges |= lights[i].range > 0.0;
+      } else
+        infLights.add(lights[i], i);
+
+    // pixel (x, y) with 1/z = q in eye space is z * (a, b, 1, q) with
+    // a = -(x - width / 2 + cx) / d and b = -(y - height / 2 + cy) / d
+    GFX::mat4 unproject = GFX::mat4::Zero();
+    unproject(0, 0) = -1.0 / d;
+    unproject(0, 2) = (width / 2.0 - cx) / d;
+    unproject(1, 1) = -1.0 / d;
+    unproject(1, 2) = (height / 2.0 - cy) / d;
+    unproject(2, 2) = 1.0;
+    unproject(3, 3) = 1.0;
+
+    for (const ShadowMask &shadowMask : shadowMasks) {
+      GFX::mat4 T = shadowMask.view * invProject * unproject;
+      // apply the projection of the light to the rows for x and y (see screen_coordinate())
+      GFX::mat4 M = GFX::mat4::Zero();
+      M.row(0) = shadowMask.d * T.row(0) - (shadowMask.mask.width() / 2.0 - shadowMask.dx) * T.row(2);
+      M.row(1) = shadowMask.d * T.row(1) - (shadowMask.mask.height() / 2.0 - shadowMask.dy) * T.row(2);
+      M.row(2) = T.row(2);
+      shadowTransforms.push_back(M);
+    }
+  }
 
-    for (int y = minY; y <= maxY; ++y) {
-      // compute x range in screen coordinates
-      std::pair<int, int> xRange = impl::compute_x_range(y, A, B, C);
-      int xL = xRange.first;
-      int xR = xRange.second;
-
-      for (int x = xL; x <= xR; ++x) {
-        // interpolate 1/z
-        GFX::Real one_over_z = 1.0001 * zG + (x - xG) * dzdx + (y - yG) * dzdy;
-        GFX::Real z = 1.0 / one_over_z;
-
-        GFX::ColorF color = triangle_color;
-        for (std::size_t i = 0; i < lights.size(); ++i)
-          if (lights[i].type == Light::PointLight) {
-            // convert pixel back to eye-coordinates and compute light dir
-            GFX::vec3 pixel(-z * (x - ctx.zBuffer.width() / 2.0 + cx) / d, -z * (y - ctx.zBuffer.height() / 2.0 + cy) / d, z);
-            GFX::vec3 dir = GFX::vec3(lightPos[i].x(), lightPos[i].y(), lightPos[i].z()) - pixel;
-            GFX::Real cos_alpha = n.dot(dir.normalized());
-
-            if (cos_alpha > 0.0) {
-              color.r += material.diffuse.r * lights[i].diffuse.r * cos_alpha;
-              color.g += material.diffuse.g * lights[i].diffuse.g * cos_alpha;
-              color.b += material.diffuse.b * lights[i].diffuse.b * cos_alpha;
-            }
+  /**
+   * @brief The specular power table for material i, 0 for ExactLighting.
+   */
+  const PowerTable* powerTable(std::size_t i) const
+  {
+    return powerTables.empty() ? 0 : &powerTables[i];
+  }
 
-            // do specular lighting if needed
-            if (material.reflection != 0.0) {
-              GFX::vec3 r = 2.0 * cos_alpha * n - dir.normalized();
-              GFX::Real cos_beta = r.dot((GFX::vec3(0.0, 0.0, d) - pixel).normalized());
+  /**
+   * @brief Convert a pixel back to eye coordinates.
+   */
+  GFX::vec3 eye(int x, int y, Real z) const
+  {
+    return GFX::vec3(-z * (x - width / 2.0 + cx) / d, -z * (y - height / 2.0 + cy) / d, z);
+  }
 
-              if (cos_beta > 0.0 ) {
-                cos_beta = std::pow(cos_beta, material.reflection);
+  /**
+   * @brief Find the point lights that reach the visible pixels of every tile
+   * (only needed with lightRanges).
+   *
+   * @param depth The 1/z used to light every pixel (see
+   * TriangleShading::lightingDepth()), the largest Real for the background.
+   * @param numThreads The number of threads, 0 to use all cores.
+   */
+  void cullLights(const GFX::Buffer<Real> &depth, unsigned int numThreads);
+
+  /**
+   * @brief The point lights for the tile of pixel (x, y) in increasing order
+   * (see cullLights()).
+   *
+   * @param count Set to the number of lights.
+   *
+   * @return The indices in pointLights.
+   */
+  const unsigned int* tileLights(int x, int y, std::size_t &count) const
+  {
+    std::size_t tile = (y / tileSize) * tilesX + x / tileSize;
+    count = tileStart[tile + 1] - tileStart[tile];
+    return tileLightIndices.data() + tileStart[tile];
+  }
 
-                color.r += material.specular.r * lights[i].specular.r * cos_beta;
-                color.g += material.specular.g * lights[i].specular.g * cos_beta;
-                color.b += material.specular.b * lights[i].specular.b * cos_beta;
-              }
-            }
+  enum { tileSize = 16 }; // the size of the tiles for the light culling
+
+  const std::vector<Light> &lights;
+  const std::vector<ShadowMask> &shadowMasks; // empty to draw without shadows
+  LightArrays pointLights;
+  LightArrays infLights;
+  bool lightRanges; // true if some point lights have a range (RangeKernel)
+  LightingAccuracy accuracy;
+  std::vector<PowerTable> powerTables; // for every material (FastLighting)
+  // for every shadow mask: pixel (x, y) with 1/z = q -> M * (x, y, 1, q) = (u, v, w, 0)
+  // with (-u / w, -v / w) in the screen space of the light and 1/z = q / w in
+  // eye space of the light
+  std::vector<GFX::mat4> shadowTransforms;
+  // the point lights for every tile (see cullLights()), the lights of tile t
+  // are tileLightIndices[tileStart[t]] up to tileLightIndices[tileStart[t + 1]]
+  std::vector<std::size_t> tileStart;
+  std::vector<unsigned int> tileLightIndices;
+  int tilesX;
+  int width, height;
+  Real d, cx, cy;
+};
 
+void Lighting::cullLights(const GFX::Buffer<Real> &depth, unsigned int numThreads)
+{
+  assert(depth.width() == width && depth.height() == height);
+  tilesX = (width + tileSize - 1) / tileSize;
+  const int tilesY = (height + tileSize - 1) / tileSize;
+
+  std::vector<std::vector<unsigned int> > lists(tilesX * tilesY);
+  GFX::parallel_for(0, lists.size(), [&] (std::size_t t) {
+    const int x0 = (t % tilesX) * tileSize, x1 = std::min(width, x0 + tileSize);
+    const int y0 = (t / tilesX) * tileSize, y1 = std::min(height, y0 + tileSize);
+
+    // the depth range of the visible pixels
+    Real lo = std::numeric_limits<Real>::max(), hi = -std::numeric_limits<Real>::max();
+    for (int y = y0; y < y1; ++y)
+      for (int x = x0; x < x1; ++x)
+        if (depth(x, y) < std::numeric_limits<Real>::max()) {
+          lo = std::min(lo, depth(x, y));
+          hi = std::max(hi, depth(x, y));
+        }
+    if (lo > hi)
+      return;
+
+    // the box around the pixels between these depths in eye space, eye() is
+    // monotonic in x, y and z so the corners bound the lit points exactly
+    GFX::vec3 boxMin = GFX::vec3::Constant(std::numeric_limits<Real>::max());
+    GFX::vec3 boxMax = -boxMin;
+    for (Real one_over_z : { lo, hi })
+      for (int x : { x0, x1 - 1 })
+        for (int y : { y0, y1 - 1 }) {
+          GFX::vec3 p = eye(x, y, 1.0 / one_over_z);
+          boxMin = boxMin.cwiseMin(p);
+          boxMax = boxMax.cwiseMax(p);
+        }
 
-          } else {
-            // do specular lighting if needed
-            if (material.reflection != 0.0) {
-              // convert pixel back to eye-coordinates and compute light dir
-              GFX::vec3 pixel(-z * (x - ctx.zBuffer.width() / 2.0 + cx) / d, -z * (y - ctx.zBuffer.height() / 2.0 + cy) / d, z);
-              //GFX::vec3 dir = GFX::vec3(lightPos[i].x(), lightPos[i].y(), lightPos[i].z()) - pixel;
-              GFX::Real cos_alpha = n.dot(-lights[i].dir());
+    // the lights with the range sphere overlapping the box
+    for (std::size_t i = 0; i < pointLights.size(); ++i) {
+      GFX::vec3 light = pointLights.vec(i);
+      GFX::vec3 nearest = light.cwiseMax(boxMin).cwiseMin(boxMax);
+      if ((light - nearest).squaredNorm() < pointLights.squaredRange[i])
+        lists[t].push_back(i);
+    }
+  }, 16, numThreads);
+
+  tileStart.assign(lists.size() + 1, 0);
+  for (std::size_t t = 0; t < lists.size(); ++t)
+    tileStart[t + 1] = tileStart[t] + lists[t].size();
+  tileLightIndices.resize(tileStart.back());
+  for (std::size_t t = 0; t < lists.size(); ++t)
+    std::copy(lists[t].begin(), lists[t].end(), tileLightIndices.begin() + tileStart[t]);
+}
 
-              GFX::vec3 r = 2.0 * cos_alpha * n + lights[i].dir();
-              GFX::Real cos_beta = r.dot((GFX::vec3(0.0, 0.0, d) - pixel).normalized());
+/**
+ * @brief Find the pixels and the weight for linear interpolation at p.
+ *
+ * Coordinates outside [0, size - 1] use the pixels at the edge.
+ */
+inline void interpolation_pixels(Real p, int size, int &i0, int &i1, Real &alpha)
+{
+  if (p > 0.0 && p < size - 1.0) {
+    i0 = static_cast<int>(p);
+    i1 = p > i0 ? i0 + 1 : i0;
+    alpha = p - i0;
+    return;
+  }
 
-              if (cos_beta > 0.0 ) {
-                cos_beta = std::pow(cos_beta, material.reflection);
+  i0 = i1 = p <= 0.0 ? 0 : size - 1;
+  alpha = p - std::floor(p);
+}
 
-                color.r += material.specular.r * lights[i].specular.r * cos_beta;
-                color.g += material.specular.g * lights[i].specular.g * cos_beta;
-                color.b += material.specular.b * lights[i].specular.b * cos_beta;
-              }
-            }
+/**
+ * @brief Bilinear interpolation of the depth in a shadow mask at (x, y).
+ *
+ * The mask contains 1/z so the reciprocal values are interpolated.
+ */
+inline Real shadow_mask_depth(const GFX::DepthMap &mask, Real x, Real y)
+{
+  int x0, x1, y0, y1;
+  Real alpha_x, alpha_y;
+  interpolation_pixels(x, mask.width(), x0, x1, alpha_x);
+  interpolation_pixels(y, mask.height(), y0, y1, alpha_y);
+
+  Real z[4];
+  mask.fetch(x0, x1, y0, y1, z);
+  Real zA = z[2];
+  Real zB = z[3];
+  Real zC = z[0];
+  Real zD = z[1];
+
+#ifdef __SSE2__
+  // the same operations as below, two at a time
+  const __m128d weights_x = _mm_set_pd(alpha_x, 1.0 - alpha_x);
+  __m128d AB = _mm_div_pd(weights_x, _mm_set_pd(zB, zA));
+  __m128d CD = _mm_div_pd(weights_x, _mm_set_pd(zD, zC));
+  __m128d EF = _mm_add_pd(_mm_unpacklo_pd(AB, CD), _mm_unpackhi_pd(AB, CD));
+  __m128d shadow = _mm_div_pd(_mm_set_pd(alpha_y, 1.0 - alpha_y), EF);
+  return _mm_cvtsd_f64(_mm_add_sd(shadow, _mm_unpackhi_pd(shadow, shadow)));
+#else
+  Real zE = (1.0 - alpha_x) / zA + alpha_x / zB;
+  Real zF = (1.0 - alpha_x) / zC + alpha_x / zD;
+  return (1.0 - alpha_y) / zE + alpha_y / zF;
+#endif
+}
 
-          }
+/**
+ * @brief Check if pixel (x, y) with 1/z = one_over_z is visible from light i
+ * (see the shadow masks).
+ */
+inline bool is_lit(const Lighting &lighting, std::size_t i, Real x, Real y, Real one_over_z)
+{
+  // determine visibility from light source
+  GFX::vec4 P = lighting.shadowTransforms[i] * GFX::vec4(x, y, 1.0, one_over_z);
+  Real inv_w = 1.0 / P.z();
+  Real zShadow = shadow_mask_depth(lighting.shadowMasks[i].mask, -P.x() * inv_w, -P.y() * inv_w);
 
-        // draw the pixel
-        ctx.drawPixel(x, y, one_over_z, color);
-      }
-    }
+  Real delta = std::abs(zShadow - one_over_z * inv_w);
+  return !(delta > shadowEpsilon);
+}
 
+/**
+ * @brief Compute the color for a vertex (VertexLighting).
+ *
+ * This uses the same light model as TriangleShading but with the vertex
+ * normal. With shadows, only the point lights visible at the vertex are used.
+ *
+ * @param eye The vertex in eye space.
+ * @param screen The vertex in screen space (for the shadow masks).
+ * @param normal The vertex normal in eye space.
+ */
+GFX::ColorF shade_vertex(const Lighting &lighting, const Material &material, const GFX::vec4 &eye, const GFX::vec2 &screen,
+    const GFX::vec3 &normal)
+{
+  const GFX::vec3 vertex(eye.data());
+  const GFX::vec3 toEye = (GFX::vec3(0.0, 0.0, lighting.d) - vertex).normalized();
+  const bool shadows = !lighting.shadowMasks.empty();
+
+  GFX::ColorF result = GFX::Color::black();
+  for (const Light &light : lighting.lights) {
+    result.r += material.ambient.r * light.ambient.r;
+    result.g += material.ambient.g * light.ambient.g;
+    result.b += material.ambient.b * light.ambient.b;
   }
 
-}
-
+  auto addLight = [&] (const GFX::ColorF &diffuse, const GFX::ColorF &specular, Real cos_alpha, const GFX::vec3 &r,
+      Real attenuation) {
+    if (cos_alpha > 0.0) {
+      result.r += material.diffuse.r * diffuse.r * cos_alpha * attenuation;
+      result.g += material.diffuse.g * diffuse.g * cos_alpha * attenuation;
+      result.b += material.diffuse.b * diffuse.b * cos_alpha * attenuation;
+    }
 
+    Real cos_beta = r.dot(toEye);
+    if (material.reflection != 0.0 && cos_beta > 0.0) {
+      cos_beta = std::pow(cos_beta, material.reflection) * attenuation;
+      result.r += material.specular.r * specular.r * cos_beta;
+      result.g += material.specular.g * specular.g * cos_beta;
+      result.b += material.specular.b * specular.b * cos_beta;
+    }
+  };
+
+  // with shadows, only point lights are used
+  const LightArrays &infLights = lighting.infLights;
+  for (std::size_t i = 0; !shadows && i < infLights.size(); ++i) {
+    GFX::vec3 dir = infLights.vec(i);
+    Real cos_alpha = normal.dot(-dir);
+    addLight(infLights.diffuse[i], infLights.specular[i], cos_alpha, 2.0 * cos_alpha * normal + dir, 1.0);
+  }
 
+  const LightArrays &pointLights = lighting.pointLights;
+  for (std::size_t i = 0; i < pointLights.size(); ++i) {
+    GFX::vec3 dir = pointLights.vec(i) - vertex;
+    Real squaredNorm = dir.squaredNorm();
+    Real a = attenuation(squaredNorm, pointLights.squaredRange[i]);
+    if (a == 0.0)
+      continue;
+    if (shadows && !is_lit(lighting, pointLights.index[i], screen.x(), screen.y(), 1.0 / eye.z()))
+      continue;
+    dir /= std::sqrt(squaredNorm);
+    Real cos_alpha = normal.dot(dir);
+    addLight(pointLights.diffuse[i], pointLights.specular[i], cos_alpha, 2.0 * cos_alpha * normal - dir, a);
+  }
 
+  return result;
+}
 
-void draw_zbuffered_triangle(Ctx &ctx, const GFX::vec4 &vA, const GFX::vec4 &vB, const GFX::vec4 &vC,
-    const GFX::mat4 &invT, const GFX::mat4 &T, Real d, Real cx, Real cy, const std::vector<Light> &lights, const Material &material,
-    const std::vector<ShadowMask> &shadowMasks)
+/**
+ * @brief The lighting for the pixels of a triangle.
+ *
+ * The constructor computes everything that is the same for all pixels of the
+ * triangle, shade() computes the color for a single pixel. Both the forward
+ * and the deferred renderer use this so the colors are exactly the same.
+ */
+struct TriangleShading : TrianglePlane
 {
-  assert(lights.size() == shadowMasks.size());
+  /**
+   * @brief The specialized shade functions, a combination of the flags.
+   */
+  enum Kernel {
+    FlatKernel = 0, //!< Only color.
+    PointLightsKernel = 1, //!< Diffuse light for the point lights.
+    SpecularKernel = 2, //!< Specular light for all lights.
+    ShadowsKernel = 4, //!< Only the point lights visible in the shadow masks.
+    FastKernel = 8, //!< Power table and approximate normalization (FastLighting).
+    RangeKernel = 16, //!< Only the point lights of the tile (see Lighting::cullLights()), with attenuation.
+    NumKernels = 32,
+    GouraudKernel = NumKernels //!< Interpolate the vertex colors (VertexLighting).
+  };
+
+  TriangleShading() : material(0), power(0), kernel(FlatKernel)
+  {
+  }
 
-  // apply model-view matrix (Model space -> Word Space -> View space)
-  GFX::vec4 A = T * vA;
-  GFX::vec4 B = T * vB;
-  GFX::vec4 C = T * vC;
+  /**
+   * @brief Interpolate the colors of the vertices (VertexLighting).
+   */
+  TriangleShading(const Lighting &lighting, const GFX::vec4 &eyeA, const GFX::vec4 &eyeB, const GFX::vec4 &eyeC,
+      const GFX::vec2 &screenA, const GFX::vec2 &screenB, const GFX::vec2 &screenC, const GFX::ColorF &colorA,
+      const GFX::ColorF &colorB, const GFX::ColorF &colorC)
+    : TrianglePlane(eyeA, eyeB, eyeC, screenA, screenB, screenC, lighting.d), material(0), power(0), kernel(GouraudKernel)
+  {
+    // the color is a linear function of the screen coordinates
+    const GFX::vec3 cA(colorA.r, colorA.g, colorA.b);
+    const GFX::vec3 cB(colorB.r, colorB.g, colorB.b);
+    const GFX::vec3 cC(colorC.r, colorC.g, colorC.b);
+    Real det = (B.x() - A.x()) * (C.y() - A.y()) - (C.x() - A.x()) * (B.y() - A.y());
+    dcdx = dcdy = GFX::vec3::Zero();
+    if (det != 0.0) {
+      dcdx = ((cB - cA) * (C.y() - A.y()) - (cC - cA) * (B.y() - A.y())) / det;
+      dcdy = ((cC - cA) * (B.x() - A.x()) - (cB - cA) * (C.x() - A.x())) / det;
+    }
+    cG = (cA + cB + cC) / 3.0;
+  }
 
-  GFX::vec3 u = GFX::vec3(B.data()) - GFX::vec3(A.data());
-  GFX::vec3 v = GFX::vec3(C.data()) - GFX::vec3(A.data());
-  GFX::vec3 w = u.cross(v);
+  TriangleShading(const Lighting &lighting, const GFX::vec4 &eyeA, const GFX::vec4 &eyeB, const GFX::vec4 &eyeC,
+      const GFX::vec2 &screenA, const GFX::vec2 &screenB, const GFX::vec2 &screenC, const Material &material_,
+      const PowerTable *power_ = 0)
+    : TrianglePlane(eyeA, eyeB, eyeC, screenA, screenB, screenC, lighting.d), material(&material_), power(power_)
+  {
+    // normal
+    GFX::vec3 u = GFX::vec3(eyeB.data()) - GFX::vec3(eyeA.data());
+    GFX::vec3 v = GFX::vec3(eyeC.data()) - GFX::vec3(eyeA.data());
+    n = u.cross(v).normalized();
+
+    // compute ambient light
+    color = GFX::Color::black();
+    for (const Light &light : lighting.lights) {
+      color.r += material->ambient.r * light.ambient.r;
+      color.g += material->ambient.g * light.ambient.g;
+      color.b += material->ambient.b * light.ambient.b;
+    }
 
-  // normal
-  const GFX::vec3 n = w.normalized();
+    const bool pointLights = lighting.pointLights.size();
+    const bool specular = material->reflection != 0.0;
+    const int fast = lighting.accuracy == FastLighting ? FastKernel : 0;
+    const int range = lighting.lightRanges ? RangeKernel : 0;
 
-  GFX::Real k = w.dot(GFX::vec3(A.data()));
-  GFX::Real dzdx = -w.x() / (d * k);
-  GFX::Real dzdy = -w.y() / (d * k);
+    // with shadows, only point lights are used (per pixel)
+    if (!lighting.shadowMasks.empty()) {
+      kernel = pointLights ? ShadowsKernel | PointLightsKernel | (specular ? SpecularKernel : 0) | fast | range : FlatKernel;
+      return;
+    }
 
-  GFX::Real zG = 1.0 / (3.0 * A.z()) + 1.0 / (3.0 * B.z()) + 1.0 / (3.0 * C.z());
+    // compute diffuse light
+    const LightArrays &infLights = lighting.infLights;
+    for (std::size_t i = 0; i < infLights.size(); ++i) {
+      Real cos_alpha = n.dot(-infLights.vec(i));
+      if (cos_alpha > 0.0) {
+        color.r += material->diffuse.r * infLights.diffuse[i].r * cos_alpha;
+        color.g += material->diffuse.g * infLights.diffuse[i].g * cos_alpha;
+        color.b += material->diffuse.b * infLights.diffuse[i].b * cos_alpha;
+      }
+    }
 
-  // project (View Space -> Screen space)
-  screen_coordinate(ctx, A, d, cx, cy);
-  screen_coordinate(ctx, B, d, cx, cy);
-  screen_coordinate(ctx, C, d, cx, cy);
+    kernel = (pointLights ? PointLightsKernel | range : 0) | (specular ? SpecularKernel : 0);
+    if (kernel != FlatKernel)
+      kernel |= fast;
+  }
 
-  GFX::Real xG = (A.x() + B.x() + C.x()) / 3.0;
-  GFX::Real yG = (A.y() + B.y() + C.y()) / 3.0;
+  /**
+   * @brief The 1/z used to light the pixel with offset @p w (see
+   * rasterize_triangle()).
+   */
+  Real lightingDepth(Real w) const
+  {
+    return (kernel & ShadowsKernel ? zG : z0) + w;
+  }
 
-  // determine y range in screen coordinates
-  int minY = nearest(std::min(A.y(), std::min(B.y(), C.y())) + 0.5);
-  int maxY = nearest(std::max(A.y(), std::max(B.y(), C.y())) - 0.5);
+  /**
+   * @brief Compute the color for pixel (x, y).
+   *
+   * This selects the kernel for every call, use shadePixel() for all pixels
+   * of a triangle.
+   *
+   * @param w The offset for 1/z (see rasterize_triangle()).
+   */
+  GFX::ColorF shade(const Lighting &lighting, int x, int y, Real w) const;
+
+  /**
+   * @brief The interpolated vertex color at pixel (x, y) (GouraudKernel).
+   */
+  GFX::vec3 vertexColor(int x, int y) const
+  {
+    return rowColor(y) + (x - xG) * dcdx;
+  }
 
-  // compute ambient light
-  GFX::ColorF ambient = GFX::Color::black();
-  for (auto light : lights) {
-    ambient.r += material.ambient.r * light.ambient.r;
-    ambient.g += material.ambient.g * light.ambient.g;
-    ambient.b += material.ambient.b * light.ambient.b;
+  /**
+   * @brief The part of vertexColor() that is the same for a row of pixels.
+   */
+  GFX::vec3 rowColor(int y) const
+  {
+    return cG + (y - yG) * dcdy;
   }
 
-  std::vector<GFX::vec4> lightPos(lights.size(), GFX::vec4::Zero());
-  for (std::size_t i = 0; i < lights.size(); ++i)
-    if (lights[i].type == Light::PointLight) {
-      lightPos[i] = lights[i].vec();
+  /**
+   * @brief Compute the color for pixel (x, y) with the kernel for the flags.
+   *
+   * The flags must match kernel. With shadows, only the point lights are
+   * used.
+   */
+  template<int Kernel>
+  GFX::ColorF shadePixel(const Lighting &lighting, int x, int y, Real w) const
+  {
+    const bool Specular = Kernel & SpecularKernel;
+    const bool Shadows = Kernel & ShadowsKernel;
+    const bool Fast = Kernel & FastKernel;
+    const bool Range = Kernel & RangeKernel;
+
+    // convert pixel back to eye-coordinates (see lightingDepth())
+    const Real one_over_z = Shadows ? zG + w : z0 + w;
+    const GFX::vec3 pixel = lighting.eye(x, y, 1.0 / one_over_z);
+    // direction to the eye for the specular light
+    GFX::vec3 toEye;
+    if (Specular)
+      toEye = Fast ? fast_normalized(GFX::vec3(0.0, 0.0, lighting.d) - pixel) : GFX::vec3((GFX::vec3(0.0, 0.0, lighting.d) - pixel).normalized());
+
+    GFX::ColorF result = color;
+
+    if (Kernel & PointLightsKernel) {
+      const LightArrays &pointLights = lighting.pointLights;
+      // the lights of the tile or all lights
+      std::size_t numLights = pointLights.size();
+      const unsigned int *tileLights = Range ? lighting.tileLights(x, y, numLights) : 0;
+
+      if (Fast) {
+        // normalize the light directions 4 at a time
+        for (std::size_t begin = 0; begin < numLights; begin += 4) {
+          std::size_t count = std::min<std::size_t>(numLights - begin, 4);
+          std::size_t light[4];
+          GFX::vec3 dir[4];
+          Real squaredNorm[4] = { 1.0, 1.0, 1.0, 1.0 }, inverseNorm[4];
+          for (std::size_t j = 0; j < count; ++j) {
+            light[j] = Range ? tileLights[begin + j] : begin + j;
+            dir[j] = pointLights.vec(light[j]) - pixel;
+            squaredNorm[j] = dir[j].squaredNorm();
+          }
+          fast_rsqrt4(squaredNorm, inverseNorm);
+
+          for (std::size_t j = 0; j < count; ++j) {
+            Real a = Range ? attenuation(squaredNorm[j], pointLights.squaredRange[light[j]]) : 1.0;
+            if (a > 0.0)
+              addPointLight<Kernel>(lighting, light[j], x, y, one_over_z, dir[j] * inverseNorm[j], a, toEye, result);
+          }
+        }
+      } else if (Range) {
+        for (std::size_t j = 0; j < numLights; ++j) {
+          std::size_t i = tileLights[j];
+          GFX::vec3 dir = pointLights.vec(i) - pixel;
+          Real squaredNorm = dir.squaredNorm();
+          Real a = attenuation(squaredNorm, pointLights.squaredRange[i]);
+          if (a > 0.0)
+            addPointLight<Kernel>(lighting, i, x, y, one_over_z, dir / std::sqrt(squaredNorm), a, toEye, result);
+        }
+      } else {
+        for (std::size_t i = 0; i < pointLights.size(); ++i)
+          addPointLight<Kernel>(lighting, i, x, y, one_over_z, (pointLights.vec(i) - pixel).normalized(), 1.0, toEye, result);
+      }
     }
 
+    // infinite lights only add specular light per pixel (and none with shadows)
+    const LightArrays &infLights = lighting.infLights;
+    for (std::size_t i = 0; Specular && !Shadows && i < infLights.size(); ++i) {
+      GFX::vec3 dir = infLights.vec(i);
+      Real cos_alpha = n.dot(-dir);
+      addSpecular<Fast>(infLights.specular[i], 2.0 * cos_alpha * n + dir, toEye, result);
+    }
 
-  for (int y = minY; y <= maxY; ++y) {
-    // compute x range in screen coordinates
-    std::pair<int, int> xRange = impl::compute_x_range(y, A, B, C);
-    int xL = xRange.first;
-    int xR = xRange.second;
-
-    for (int x = xL; x <= xR; ++x) {
-      // interpolate 1/z
-      GFX::Real one_over_z = 1.0001 * zG + (x - xG) * dzdx + (y - yG) * dzdy;
-      GFX::Real z = 1.0 / (zG + (x - xG) * dzdx + (y - yG) * dzdy);
-
-      GFX::ColorF color = ambient;
-      for (std::size_t i = 0; i < lights.size(); ++i)
-        if (lights[i].type == Light::PointLight) {
-          // convert pixel back to eye-coordinates
-          GFX::vec3 pixel(-z * (x - ctx.zBuffer.width() / 2.0 + cx) / d, -z * (y - ctx.zBuffer.height() / 2.0 + cy) / d, z);
-
-          // determine visibility from light source
-          GFX::vec4 P(-z * (x - ctx.zBuffer.width() / 2.0 + cx) / d,
-                      -z * (y - ctx.zBuffer.height() / 2.0 + cy) / d,
-                      z, 1.0);
-          P = invT * P;
-          P = shadowMasks[i].view * P;
-          screen_coordinate(shadowMasks[i].mask.width(), shadowMasks[i].mask.height(), P, shadowMasks[i].d, shadowMasks[i].dx, shadowMasks[i].dy);
-
-          // interpolate shadow mask depth
-          GFX::Real floor_x = std::max(0.0, std::min(shadowMasks[i].mask.width() - 1.0, std::floor(P.x())));
-          GFX::Real ceil_x = std::max(0.0, std::min(shadowMasks[i].mask.width() - 1.0, std::ceil(P.x())));
-          GFX::Real floor_y = std::max(0.0, std::min(shadowMasks[i].mask.height() - 1.0, std::floor(P.y())));
-          GFX::Real ceil_y = std::max(0.0, std::min(shadowMasks[i].mask.height() - 1.0, std::ceil(P.y())));
-
-          GFX::Real zA = shadowMasks[i].mask(floor_x, ceil_y);
-          GFX::Real zB = shadowMasks[i].mask(ceil_x, ceil_y);
-          GFX::Real zC = shadowMasks[i].mask(floor_x, floor_y);
-          GFX::Real zD = shadowMasks[i].mask(ceil_x, floor_y);
-
-          GFX::Real alpha_x = P.x() - std::floor(P.x());
-          GFX::Real alpha_y = P.y() - std::floor(P.y());
-          GFX::Real zE = (1.0 - alpha_x) / zA + alpha_x / zB;
-          GFX::Real zF = (1.0 - alpha_x) / zC + alpha_x / zD;
-          GFX::Real zShadow = (1.0 - alpha_y) / zE + alpha_y / zF;
-
-          GFX::Real delta = std::abs(zShadow - 1.0 / P.z());
-          if (delta > shadowEpsilon)
-            continue;
+    return result;
+  }
 
-          // compute light dir
-          GFX::vec3 dir = GFX::vec3(lightPos[i].x(), lightPos[i].y(), lightPos[i].z()) - pixel;
-          GFX::Real cos_alpha = n.dot(dir.normalized());
+  GFX::vec3 n; // normal
+  GFX::ColorF color; // the color for the whole triangle (ambient + diffuse for infinite lights)
+  const Material *material;
+  const PowerTable *power; // pow(x, material->reflection) for FastKernel
+  int kernel; // the Kernel flags, FlatKernel if color is used for all pixels
+  GFX::vec3 cG, dcdx, dcdy; // the vertex color at the center and its gradient (GouraudKernel)
+
+private:
+  template<bool Fast>
+  void addSpecular(const GFX::ColorF &specular, const GFX::vec3 &r, const GFX::vec3 &toEye, GFX::ColorF &result,
+      Real attenuation = 1.0) const
+  {
+    Real cos_beta = r.dot(toEye);
 
-          if (cos_alpha > 0.0) {
-            color.r += material.diffuse.r * lights[i].diffuse.r * cos_alpha;
-            color.g += material.diffuse.g * lights[i].diffuse.g * cos_alpha;
-            color.b += material.diffuse.b * lights[i].diffuse.b * cos_alpha;
-          }
+    if (cos_beta > 0.0 ) {
+      cos_beta = (Fast ? (*power)(cos_beta) : std::pow(cos_beta, material->reflection)) * attenuation;
 
-          // do specular lighting if needed
-          if (material.reflection != 0.0) {
-            GFX::vec3 r = 2.0 * cos_alpha * n - dir.normalized();
-            GFX::Real cos_beta = r.dot((GFX::vec3(0.0, 0.0, d) - pixel).normalized());
+      result.r += material->specular.r * specular.r * cos_beta;
+      result.g += material->specular.g * specular.g * cos_beta;
+      result.b += material->specular.b * specular.b * cos_beta;
+    }
+  }
 
-            if (cos_beta > 0.0 ) {
-              cos_beta = std::pow(cos_beta, material.reflection);
+  /**
+   * @brief Add the light from point light i with normalized direction @p dir
+   * and @p attenuation (1 without RangeKernel).
+   */
+  template<int Kernel>
+  void addPointLight(const Lighting &lighting, std::size_t i, int x, int y, Real one_over_z, const GFX::vec3 &dir,
+      Real attenuation, const GFX::vec3 &toEye, GFX::ColorF &result) const
+  {
+    const LightArrays &pointLights = lighting.pointLights;
+    if ((Kernel & ShadowsKernel) && !is_lit(lighting, pointLights.index[i], x, y, one_over_z))
+      return;
 
-              color.r += material.specular.r * lights[i].specular.r * cos_beta;
-              color.g += material.specular.g * lights[i].specular.g * cos_beta;
-              color.b += material.specular.b * lights[i].specular.b * cos_beta;
-            }
-          }
+    Real cos_alpha = n.dot(dir);
+
+    if (cos_alpha > 0.0) {
+      Real diffuse = Kernel & RangeKernel ? cos_alpha * attenuation : cos_alpha;
+      result.r += material->diffuse.r * pointLights.diffuse[i].r * diffuse;
+      result.g += material->diffuse.g * pointLights.diffuse[i].g * diffuse;
+      result.b += material->diffuse.b * pointLights.diffuse[i].b * diffuse;
+    }
 
+    if (Kernel & SpecularKernel)
+      addSpecular<(Kernel & FastKernel) != 0>(pointLights.specular[i], 2.0 * cos_alpha * n - dir, toEye, result,
+          Kernel & RangeKernel ? attenuation : 1.0);
+  }
+};
 
-        }
+typedef GFX::ColorF (TriangleShading::*ShadeFunction)(const Lighting&, int, int, Real) const;
+
+/**
+ * @brief TriangleShading::shadePixel() for every kernel.
+ */
+const ShadeFunction shadeFunctions[TriangleShading::NumKernels] = {
+  &TriangleShading::shadePixel<0>, &TriangleShading::shadePixel<1>, &TriangleShading::shadePixel<2>,
+  &TriangleShading::shadePixel<3>, &TriangleShading::shadePixel<4>, &TriangleShading::shadePixel<5>,
+  &TriangleShading::shadePixel<6>, &TriangleShading::shadePixel<7>, &TriangleShading::shadePixel<8>,
+  &TriangleShading::shadePixel<9>, &TriangleShading::shadePixel<10>, &TriangleShading::shadePixel<11>,
+  &TriangleShading::shadePixel<12>, &TriangleShading::shadePixel<13>, &TriangleShading::shadePixel<14>,
+  &TriangleShading::shadePixel<15>, &TriangleShading::shadePixel<16>, &TriangleShading::shadePixel<17>,
+  &TriangleShading::shadePixel<18>, &TriangleShading::shadePixel<19>, &TriangleShading::shadePixel<20>,
+  &TriangleShading::shadePixel<21>, &TriangleShading::shadePixel<22>, &TriangleShading::shadePixel<23>,
+  &TriangleShading::shadePixel<24>, &TriangleShading::shadePixel<25>, &TriangleShading::shadePixel<26>,
+  &TriangleShading::shadePixel<27>, &TriangleShading::shadePixel<28>, &TriangleShading::shadePixel<29>,
+  &TriangleShading::shadePixel<30>, &TriangleShading::shadePixel<31>
+};
 
-      // draw the pixel
-      ctx.drawPixel(x, y, one_over_z, color);
-    }
+GFX::ColorF TriangleShading::shade(const Lighting &lighting, int x, int y, Real w) const
+{
+  if (kernel == FlatKernel)
+    return color;
+  if (kernel == GouraudKernel) {
+    GFX::vec3 c = vertexColor(x, y);
+    return GFX::ColorF(c.x(), c.y(), c.z());
   }
+  return (this->*shadeFunctions[kernel])(lighting, x, y, w);
+}
+
+/**
+ * @brief Draw the pixels of a triangle using the kernel for the flags.
+ */
+template<int Kernel>
+void draw_shaded_triangle(Ctx &ctx, const Lighting &lighting, const TriangleShading &shading, const Tile &tile)
+{
+  rasterize_triangle(shading.A, shading.B, shading.C, shading.xG, shading.yG, shading.dzdx, shading.dzdy, tile,
+      pixel_fragments(shading.dzdx, [&] (int x, int y, GFX::Real w) {
+    // interpolate 1/z, only shade the pixel if it passes the depth test
+    GFX::Real one_over_z = shading.z0 + w;
+    if (one_over_z < ctx.zBuffer(x, y))
+      ctx.drawPixel(x, y, one_over_z, shading.shadePixel<Kernel>(lighting, x, y, w));
+  }));
+}
 
+typedef void (*DrawShadedFunction)(Ctx&, const Lighting&, const TriangleShading&, const Tile&);
+
+/**
+ * @brief draw_shaded_triangle() for every kernel.
+ */
+const DrawShadedFunction drawShadedFunctions[TriangleShading::NumKernels] = {
+  &draw_shaded_triangle<0>, &draw_shaded_triangle<1>, &draw_shaded_triangle<2>, &draw_shaded_triangle<3>,
+  &draw_shaded_triangle<4>, &draw_shaded_triangle<5>, &draw_shaded_triangle<6>, &draw_shaded_triangle<7>,
+  &draw_shaded_triangle<8>, &draw_shaded_triangle<9>, &draw_shaded_triangle<10>, &draw_shaded_triangle<11>,
+  &draw_shaded_triangle<12>, &draw_shaded_triangle<13>, &draw_shaded_triangle<14>, &draw_shaded_triangle<15>,
+  &draw_shaded_triangle<16>, &draw_shaded_triangle<17>, &draw_shaded_triangle<18>, &draw_shaded_triangle<19>,
+  &draw_shaded_triangle<20>, &draw_shaded_triangle<21>, &draw_shaded_triangle<22>, &draw_shaded_triangle<23>,
+  &draw_shaded_triangle<24>, &draw_shaded_triangle<25>, &draw_shaded_triangle<26>, &draw_shaded_triangle<27>,
+  &draw_shaded_triangle<28>, &draw_shaded_triangle<29>, &draw_shaded_triangle<30>, &draw_shaded_triangle<31>
+};
 
+/**
+ * @brief Draw a triangle with interpolated vertex colors (GouraudKernel).
+ */
+void draw_gouraud_triangle(Ctx &ctx, const TriangleShading &shading, const Tile &tile)
+{
+  rasterize_triangle(shading.A, shading.B, shading.C, shading.xG, shading.yG, shading.dzdx, shading.dzdy, tile,
+      [&] (int x, int y, int n, GFX::Real w, int k) {
+    // the color along the span (the same as vertexColor() for deferred shading)
+    const GFX::vec3 row = shading.rowColor(y);
+    for (int i = 0; i < n; ++i) {
+      GFX::Real one_over_z = shading.z0 + (w + (k + i) * shading.dzdx);
+      if (one_over_z < ctx.zBuffer(x + i, y)) {
+        GFX::vec3 c = row + (x + i - shading.xG) * shading.dcdx;
+        ctx.drawPixel(x + i, y, one_over_z, GFX::ColorF(c.x(), c.y(), c.z()));
+      }
+    }
+  });
 }
 
+void draw_zbuffered_triangle(Ctx &ctx, const Lighting &lighting, const TriangleShading &shading, const Tile &tile)
+{
+  if (shading.kernel == TriangleShading::GouraudKernel) {
+    draw_gouraud_triangle(ctx, shading, tile);
+    return;
+  }
 
+  if (shading.kernel != TriangleShading::FlatKernel) {
+    drawShadedFunctions[shading.kernel](ctx, lighting, shading, tile);
+    return;
+  }
 
+  const GFX::Color color = shading.color;
+  const img::Color pixel(color.r, color.g, color.b);
+  rasterize_triangle(shading.A, shading.B, shading.C, shading.xG, shading.yG, shading.dzdx, shading.dzdy, tile,
+      [&] (int x, int y, int n, GFX::Real w, int k) {
+    // interpolate 1/z and draw the pixels
+    ctx.drawSpan(x, y, n, shading.z0, w, shading.dzdx, k, pixel);
+  });
+}
 
+/**
+ * @brief The visible triangle for every pixel (deferred shading).
+ */
+struct GBuffer
+{
+  static const unsigned int none = std::numeric_limits<unsigned int>::max();
 
+  GBuffer(int width, int height) : triangle(width, height), w(width, height)
+  {
+    triangle.clear(std::numeric_limits<unsigned int>::max());
+  }
 
+  GFX::Buffer<unsigned int> triangle; // the triangle in the frame, none for the background
+  GFX::Buffer<Real> w; // the offset for 1/z (see rasterize_triangle())
+};
 
-img::EasyImage draw_zbuffered_meshes(const std::vector<std::shared_ptr<GFX::Mesh> > &meshes, const GFX::mat4 &project,
-    const std::vector<GFX::mat4> &modelMatrices, const std::vector<Light> &lights, const std::vector<Material> &materials,
-    const std::vector<ShadowMask> &shadowMasks, int size, const img::Color &bgColor)
+/**
+ * @brief Check if a mesh has a normal for every vertex (and not for every face).
+ */
+inline bool has_vertex_normals(const GFX::Mesh &mesh)
 {
-  // compute some properties for the lines
-  std::pair<Point2D, Point2D> minMax = std::make_pair(Point2D(std::numeric_limits<Real>::max(), std::numeric_limits<Real>::max()),
-                                                      Point2D(std::numeric_limits<Real>::min(), std::numeric_limits<Real>::min()));
+  return mesh.normals().size() == mesh.vertices().size() && mesh.normals().size() != mesh.faces().size();
+}
 
-  for (std::size_t i = 0; i < meshes.size(); ++i) {
-    std::pair<Point2D, Point2D> meshMinMax = get_min_max(*meshes[i], project * modelMatrices[i]);
-    if (meshMinMax.first.x < minMax.first.x)
-      minMax.first.x = meshMinMax.first.x;
-    if (meshMinMax.first.y < minMax.first.y)
-      minMax.first.y = meshMinMax.first.y;
-    if (meshMinMax.second.x > minMax.second.x)
-      minMax.second.x = meshMinMax.second.x;
-    if (meshMinMax.second.y > minMax.second.y)
-      minMax.second.y = meshMinMax.second.y;
+/**
+ * @brief Get a mesh with a normal for every vertex.
+ *
+ * Meshes without vertex normals get normals that are only smooth across edges
+ * where the faces meet at less than 30 degrees (see
+ * GFX::Mesh::computeCreaseNormals()). Curved surfaces such as cylinder sides,
+ * cones and tori are smooth while the edges of cubes, platonic solids, Menger
+ * sponges and cylinder caps stay sharp. Spheres come with exact normals (see
+ * GFX::Mesh::sphere()).
+ *
+ * @param copies The copies with normals made so far, a mesh is only copied once.
+ */
+std::shared_ptr<const GFX::Mesh> with_vertex_normals(const std::shared_ptr<const GFX::Mesh> &mesh,
+    std::map<const GFX::Mesh*, std::shared_ptr<const GFX::Mesh> > &copies)
+{
+  if (has_vertex_normals(*mesh))
+    return mesh;
+
+  std::shared_ptr<const GFX::Mesh> &copy = copies[mesh.get()];
+  if (!copy) {
+    std::shared_ptr<GFX::Mesh> smooth = std::make_shared<GFX::Mesh>(*mesh);
+    smooth->computeCreaseNormals(GFX::deg2rad(30.0));
+    copy = smooth;
   }
+  return copy;
+}
 
-  std::pair<int, int> imageSizes = get_image_sizes(minMax, size);
-  Real d = get_scale_factor(minMax, imageSizes.first);
-  Point2D center = get_center(minMax, d);
+img::EasyImage draw_zbuffered_meshes(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes_, const GFX::mat4 &project,
+    const std::vector<Instances> &instances, const std::vector<Light> &lights, const std::vector<Material> &materials,
+    const std::vector<ShadowMask> &shadowMasks, int size, const img::Color &bgColor, GFX::Real lodTolerance,
+    unsigned int numThreads, bool deferredShading, const std::vector<bool> &backFaceCulling, LightingAccuracy accuracy,
+    LightingMode mode)
+{
+  // per vertex lighting needs smooth normals
+  const bool vertexLighting = mode == VertexLighting;
+  std::map<const GFX::Mesh*, std::shared_ptr<const GFX::Mesh> > smoothMeshes;
+  std::vector<std::shared_ptr<const GFX::Mesh> > meshes(meshes_);
+  if (vertexLighting)
+    for (std::shared_ptr<const GFX::Mesh> &mesh : meshes)
+      mesh = with_vertex_normals(mesh, smoothMeshes);
+
+  // transform the vertices and compute some properties for the meshes
+  VertexStage stage(vertexLighting);
+  stage.add(meshes, project, instances, numThreads);
+
+  std::pair<int, int> imageSizes = get_image_sizes(stage.minMax, size);
+  Real d = get_scale_factor(stage.minMax, imageSizes.first);
+  Point2D center = get_center(stage.minMax, d);
 
   Ctx ctx(imageSizes.first, imageSizes.second, bgColor);
-
-  for (std::size_t i = 0; i < meshes.size(); ++i) {
-    for (std::size_t j = 0; j < meshes[i]->faces().size(); ++j) {
-      const std::vector<int> &face = meshes[i]->faces()[j];
-      assert(face.size() == 3);
-
-      const GFX::vec4 &A = meshes[i]->vertices()[face[0]];
-      const GFX::vec4 &B = meshes[i]->vertices()[face[1]];
-      const GFX::vec4 &C = meshes[i]->vertices()[face[2]];
-
-      if (shadowMasks.empty())
-        draw_zbuffered_triangle(ctx, A, B, C, project * modelMatrices[i], d, center.x, center.y, lights, materials[i]);
-      else
-        draw_zbuffered_triangle(ctx, A, B, C, project.inverse(), project * modelMatrices[i], d, center.x, center.y, lights, materials[i], shadowMasks);
+  stage.project(imageSizes.first, imageSizes.second, d, center.x, center.y, numThreads);
+
+  // simplified meshes for small instances, not with shadows since the shadow
+  // masks are drawn from the full meshes and would shadow the simplified ones
+  std::vector<std::vector<std::shared_ptr<const GFX::Mesh> > > levels;
+  if (lodTolerance > 0.0 && shadowMasks.empty())
+    levels = select_levels_of_detail(meshes, stage, instances, d, lodTolerance);
+  if (vertexLighting)
+    for (std::vector<std::shared_ptr<const GFX::Mesh> > &level : levels)
+      for (std::shared_ptr<const GFX::Mesh> &mesh : level)
+        mesh = with_vertex_normals(mesh, smoothMeshes);
+
+  // eye space -> world space for the shadow masks
+  GFX::mat4 invProject = GFX::mat4::Identity();
+  if (!shadowMasks.empty())
+    invProject = project.inverse();
+
+  Lighting lighting(lights, shadowMasks, invProject, materials, accuracy, imageSizes.first, imageSizes.second, d, center.x, center.y);
+  Frame frame(meshes, project, instances, stage, levels, backFaceCulling, imageSizes.first, imageSizes.second, d, center.x, center.y, numThreads);
+
+  if (vertexLighting)
+    frame.shadeVertices([&] (std::size_t figure, const GFX::vec4 &eye, const GFX::vec2 &screen, const GFX::vec3 &normal) {
+      return shade_vertex(lighting, materials[figure], eye, screen, normal);
+    }, numThreads);
+
+  auto triangleShading = [&] (std::size_t t) {
+    Frame::Triangle triangle = frame.triangle(t);
+    if (vertexLighting)
+      return TriangleShading(lighting, *triangle.eye[0], *triangle.eye[1], *triangle.eye[2],
+          *triangle.screen[0], *triangle.screen[1], *triangle.screen[2], *triangle.color[0], *triangle.color[1], *triangle.color[2]);
+    return TriangleShading(lighting, *triangle.eye[0], *triangle.eye[1], *triangle.eye[2],
+        *triangle.screen[0], *triangle.screen[1], *triangle.screen[2], materials[triangle.figure],
+        lighting.powerTable(triangle.figure));
+  };
+
+  // tiled light culling for point lights with a range (not needed for vertex lighting)
+  const bool cullLights = lighting.lightRanges && !vertexLighting;
+
+  if (!deferredShading) {
+    if (cullLights) {
+      // depth pre-pass: the lighting depth of the visible pixels
+      GFX::Buffer<Real> zBuffer(imageSizes.first, imageSizes.second);
+      GFX::Buffer<Real> lightingDepth(imageSizes.first, imageSizes.second);
+      zBuffer.clear(std::numeric_limits<Real>::max());
+      lightingDepth.clear(std::numeric_limits<Real>::max());
+      draw_frame(zBuffer, frame, numThreads, [&] (std::size_t t, const Tile &tile) {
+        const TriangleShading shading = triangleShading(t);
+        rasterize_triangle(shading.A, shading.B, shading.C, shading.xG, shading.yG, shading.dzdx, shading.dzdy, tile,
+            pixel_fragments(shading.dzdx, [&] (int x, int y, GFX::Real w) {
+          GFX::Real one_over_z = shading.z0 + w;
+          if (one_over_z < zBuffer(x, y)) {
+            zBuffer(x, y) = one_over_z;
+            lightingDepth(x, y) = shading.lightingDepth(w);
+          }
+        }));
+      });
+      lighting.cullLights(lightingDepth, numThreads);
     }
+
+    draw_frame(ctx.zBuffer, frame, numThreads, [&] (std::size_t t, const Tile &tile) {
+      draw_zbuffered_triangle(ctx, lighting, triangleShading(t), tile);
+    });
+
+    return ctx.image;
+  }
+
+  assert(frame.size() < GBuffer::none);
+
+  // set up all triangles once
+  std::vector<TriangleShading> shadings(frame.size());
+  GFX::parallel_for(0, frame.size(), [&] (std::size_t t) {
+    shadings[t] = triangleShading(t);
+  }, 1024, numThreads);
+
+  // visibility pass: only store the nearest triangle for every pixel
+  GBuffer gBuffer(imageSizes.first, imageSizes.second);
+  draw_frame(ctx.zBuffer, frame, numThreads, [&] (std::size_t t, const Tile &tile) {
+    const TriangleShading &shading = shadings[t];
+    rasterize_triangle(shading.A, shading.B, shading.C, shading.xG, shading.yG, shading.dzdx, shading.dzdy, tile,
+        pixel_fragments(shading.dzdx, [&] (int x, int y, GFX::Real w) {
+      GFX::Real one_over_z = shading.z0 + w;
+      if (one_over_z < ctx.zBuffer(x, y)) {
+        ctx.zBuffer(x, y) = one_over_z;
+        gBuffer.triangle(x, y) = t;
+        gBuffer.w(x, y) = w;
+      }
+    }));
+  });
+
+  if (cullLights) {
+    GFX::Buffer<Real> lightingDepth(imageSizes.first, imageSizes.second);
+    GFX::parallel_for(0, imageSizes.first, [&] (std::size_t x) {
+      for (int y = 0; y < imageSizes.second; ++y) {
+        unsigned int t = gBuffer.triangle(x, y);
+        lightingDepth(x, y) = t == GBuffer::none ? std::numeric_limits<Real>::max() : shadings[t].lightingDepth(gBuffer.w(x, y));
+      }
+    }, 16, numThreads);
+    lighting.cullLights(lightingDepth, numThreads);
   }
 
+  // shading pass: every visible pixel is shaded exactly once
+  GFX::parallel_for(0, imageSizes.first, [&] (std::size_t x) {
+    for (int y = 0; y < imageSizes.second; ++y) {
+      unsigned int t = gBuffer.triangle(x, y);
+      if (t == GBuffer::none)
+        continue;
+      const GFX::Color color = shadings[t].shade(lighting, x, y, gBuffer.w(x, y));
+      ctx.image(x, y) = img::Color(color.r, color.g, color.b);
+    }
+  }, 16, numThreads);
+
   return ctx.image;
 }
 
@@ -806,46 +2463,57 @@ img::EasyImage draw_zbuffered_meshes(const std::vector<std::shared_ptr<GFX::Mesh
 
 
 
-ShadowMask draw_shadow_mask(const std::vector<std::shared_ptr<GFX::Mesh> > &meshes, const GFX::mat4 &project,
-    const std::vector<GFX::mat4> &modelMatrices, int size)
+ShadowMask draw_shadow_mask(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes, const GFX::mat4 &project,
+    const std::vector<Instances> &instances, int size, const std::vector<bool> &backFaceCulling, unsigned int numThreads,
+    GFX::DepthFormat format, GFX::DepthLayout layout)
 {
-  // compute some properties for the lines
-  std::pair<Point2D, Point2D> minMax = std::make_pair(Point2D(std::numeric_limits<Real>::max(), std::numeric_limits<Real>::max()),
-                                                      Point2D(std::numeric_limits<Real>::min(), std::numeric_limits<Real>::min()));
+  // transform the vertices and compute some properties for the meshes
+  VertexStage stage;
+  stage.add(meshes, project, instances, numThreads);
 
-  for (std::size_t i = 0; i < meshes.size(); ++i) {
-    std::pair<Point2D, Point2D> meshMinMax = get_min_max(*meshes[i], project * modelMatrices[i]);
-    if (meshMinMax.first.x < minMax.first.x)
-      minMax.first.x = meshMinMax.first.x;
-    if (meshMinMax.first.y < minMax.first.y)
-      minMax.first.y = meshMinMax.first.y;
-    if (meshMinMax.second.x > minMax.second.x)
-      minMax.second.x = meshMinMax.second.x;
-    if (meshMinMax.second.y > minMax.second.y)
-      minMax.second.y = meshMinMax.second.y;
-  }
+  std::pair<int, int> imageSizes = get_image_sizes(stage.minMax, size);
+  Real d = get_scale_factor(stage.minMax, imageSizes.first);
+  Point2D center = get_center(stage.minMax, d);
 
-  std::pair<int, int> imageSizes = get_image_sizes(minMax, size);
-  Real d = get_scale_factor(minMax, imageSizes.first);
-  Point2D center = get_center(minMax, d);
+  stage.project(imageSizes.first, imageSizes.second, d, center.x, center.y, numThreads);
 
-  Ctx ctx(imageSizes.first, imageSizes.second, img::Color());
+  Frame frame(meshes, project, instances, stage, std::vector<std::vector<std::shared_ptr<const GFX::Mesh> > >(), backFaceCulling,
+      imageSizes.first, imageSizes.second, d, center.x, center.y, numThreads);
 
-  std::vector<Light> dummyLights;
-  Material dummyMaterial;
+  // only the depth is needed
+  GFX::Buffer<Real> zBuffer(imageSizes.first, imageSizes.second);
+  zBuffer.clear(std::numeric_limits<Real>::max());
 
-  for (std::size_t i = 0; i < meshes.size(); ++i) {
-    for (std::size_t j = 0; j < meshes[i]->faces().size(); ++j) {
-      const std::vector<int> &face = meshes[i]->faces()[j];
-      assert(face.size() == 3);
+  draw_frame(zBuffer, frame, numThreads, [&] (std::size_t t, const Tile &tile) {
+    Frame::Triangle triangle = frame.triangle(t);
+    draw_depth_triangle(zBuffer, *triangle.eye[0], *triangle.eye[1], *triangle.eye[2],
+        *triangle.screen[0], *triangle.screen[1], *triangle.screen[2], d, tile);
+  });
+
+  return ShadowMask(GFX::DepthMap(zBuffer, format, layout), project, d, center.x, center.y);
+}
 
-      const GFX::vec4 &A = meshes[i]->vertices()[face[0]];
-      const GFX::vec4 &B = meshes[i]->vertices()[face[1]];
-      const GFX::vec4 &C = meshes[i]->vertices()[face[2]];
+std::vector<ShadowMask> draw_shadow_masks(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes,
+    const std::vector<Instances> &instances, const std::vector<Light> &lights, int size,
+    const std::vector<bool> &backFaceCulling, unsigned int numThreads, GFX::DepthFormat format, GFX::DepthLayout layout)
+{
+  std::vector<ShadowMask> shadowMasks(lights.size(), ShadowMask(GFX::DepthMap(), GFX::mat4::Identity(), 1.0, 0.0, 0.0));
 
-      draw_zbuffered_triangle(ctx, A, B, C, project * modelMatrices[i], d, center.x, center.y, dummyLights, dummyMaterial);
-    }
-  }
+  std::vector<std::size_t> pointLights;
+  for (std::size_t i = 0; i < lights.size(); ++i)
+    if (lights[i].type == Light::PointLight)
+      pointLights.push_back(i);
+
+  // one light per thread if there are enough lights, otherwise all threads for every light
+  unsigned int threads = GFX::threadCount(numThreads);
+  bool perLight = pointLights.size() >= threads;
+
+  GFX::parallel_for(0, pointLights.size(), [&] (std::size_t i) {
+    const Light &light = lights[pointLights[i]];
+    GFX::mat4 project = GFX::projectionMatrix(light.pos().x(), light.pos().y(), light.pos().z());
+    shadowMasks[pointLights[i]] = draw_shadow_mask(meshes, project, instances, size, backFaceCulling, perLight ? 1 : threads,
+        format, layout);
+  }, 1, perLight ? threads : 1);
 
-  return ShadowMask(ctx.zBuffer, project, d, center.x, center.y);
+  return shadowMasks;
 }
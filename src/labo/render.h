@@ -6,6 +6,7 @@
 #include <libgfx/line2d.h>
 #include <libgfx/line3d.h>
 #include <libgfx/buffer.h>
+#include <libgfx/depthmap.h>
 
 #include <memory>
 
@@ -43,8 +44,8 @@ struct Light
   };
 
   Light(int type_, const GFX::ColorF &ambient_ = GFX::Color::black(), const GFX::ColorF &diffuse_ = GFX::Color::black(),
-        const GFX::ColorF &specular_ = GFX::Color::black(), const GFX::vec4 &vec = GFX::vec4::Zero())
-    : type(type_), ambient(ambient_), diffuse(diffuse_), specular(specular_), m_vec(vec)
+        const GFX::ColorF &specular_ = GFX::Color::black(), const GFX::vec4 &vec = GFX::vec4::Zero(), GFX::Real range_ = 0.0)
+    : type(type_), ambient(ambient_), diffuse(diffuse_), specular(specular_), range(range_), m_vec(vec)
   {
   }
 
@@ -72,6 +73,9 @@ struct Light
   GFX::ColorF ambient;
   GFX::ColorF diffuse;
   GFX::ColorF specular;
+  // point lights only: the diffuse and specular light fade out as (1 - (r / range)^2)^2
+  // with the distance r and are zero beyond the range, 0 for no attenuation
+  GFX::Real range;
 private:
   GFX::vec4 m_vec;
 };
@@ -90,6 +94,8 @@ inline std::ostream& operator<<(std::ostream &os, const Light &light)
   else
     os << "    location: ";
   os << "(" << light.dir().x() << ", " << light.dir().y() << ", " << light.dir().z() << ")";
+  if (light.type == Light::PointLight && light.range > 0.0)
+    os << std::endl << "    range: " << light.range;
   return os;
 }
 
@@ -182,19 +188,116 @@ img::EasyImage draw_zbuffered_lines(GFX::Lines3D &lines, int size, const img::Co
 
 std::pair<GFX::Point2D, GFX::Point2D> get_min_max(const GFX::Mesh &mesh, const GFX::mat4 &T);
 
+/**
+ * @brief The model matrices for all instances of a mesh.
+ *
+ * A mesh that appears several times in a scene (e.g. the cubes of a Menger
+ * sponge) is stored once together with one model matrix per instance.
+ */
+typedef std::vector<GFX::mat4> Instances;
+
+/**
+ * @brief Find the min. and max. projected points for all instances of a set of meshes.
+ */
+std::pair<GFX::Point2D, GFX::Point2D> get_min_max(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes, const GFX::mat4 &project,
+    const std::vector<Instances> &instances);
+
+/**
+ * @brief Transformed vertices for the instances of a frame.
+ *
+ * Every vertex of every instance is transformed to eye space once per frame
+ * and the projected bounds (see get_min_max()) are computed in the same pass.
+ * Once the image size is known, project() computes the screen coordinates
+ * for all vertices so drawing a triangle only indexes into the buffers.
+ */
+struct VertexStage
+{
+  /**
+   * @param withNormals_ Also transform the vertex normals of meshes with a
+   * normal for every vertex.
+   */
+  VertexStage(bool withNormals_ = false);
+
+  /**
+   * @brief Remove all vertices (the memory is kept for reuse).
+   */
+  void clear();
+
+  /**
+   * @brief Transform the vertices of an instance and update the bounds.
+   *
+   * @return The index of the first vertex of the instance in eye.
+   */
+  std::size_t add(const GFX::Mesh &mesh, const GFX::mat4 &T);
+
+  /**
+   * @brief Add all instances of a set of meshes (mesh by mesh).
+   *
+   * @param numThreads The number of threads, 0 to use all cores.
+   */
+  void add(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes, const GFX::mat4 &project,
+      const std::vector<Instances> &instances, unsigned int numThreads = 1);
+
+  /**
+   * @brief Compute the screen coordinates for all vertices.
+   *
+   * @param numThreads The number of threads, 0 to use all cores.
+   */
+  void project(int width, int height, GFX::Real d, GFX::Real cx, GFX::Real cy, unsigned int numThreads = 1);
+
+  std::vector<GFX::vec4> eye; // eye space vertices
+  std::vector<GFX::vec2> screen; // screen coordinates (see project())
+  std::vector<GFX::vec3> normal; // eye space vertex normals (withNormals only, zero if the mesh has none)
+  std::vector<std::size_t> first; // the first vertex for every instance
+  std::vector<std::pair<GFX::Point2D, GFX::Point2D> > bounds; // the bounds for every instance
+  std::pair<GFX::Point2D, GFX::Point2D> minMax; // the bounds for all instances
+  bool withNormals;
+
+private:
+  std::pair<GFX::Point2D, GFX::Point2D> transform(const GFX::Mesh &mesh, const GFX::mat4 &T, std::size_t offset);
+  void merge(const std::pair<GFX::Point2D, GFX::Point2D> &meshMinMax);
+};
+
 img::EasyImage draw_zbuffered_mesh(const GFX::Mesh &mesh, const GFX::mat4 &T, const GFX::Color &color, int size, const img::Color &bgColor);
-img::EasyImage draw_zbuffered_meshes(const std::vector<std::shared_ptr<GFX::Mesh> > &meshes, const GFX::mat4 &T,
-    const std::vector<GFX::mat4> &modelMatrices, const std::vector<GFX::Color> &colors, int size, const img::Color &bgColor);
+/**
+ * @brief Select a simplified mesh for every instance.
+ *
+ * The size of an instance on screen follows from its bounds in @p stage
+ * (which contains the instances in the same order) and the scaling factor
+ * @p d. The coarsest level of detail (see GFX::MeshCache::levelOfDetail())
+ * with an error below @p tolerance pixels is used.
+ *
+ * @return The mesh to draw for every instance.
+ */
+std::vector<std::vector<std::shared_ptr<const GFX::Mesh> > > select_levels_of_detail(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes,
+    const VertexStage &stage, const std::vector<Instances> &instances, GFX::Real d, GFX::Real tolerance);
+
+/**
+ * @brief Draw meshes using a z-buffer.
+ *
+ * @param lodTolerance The allowed error in pixels for simplified meshes, 0 to
+ * always draw the full meshes.
+ * @param numThreads The number of threads, 0 to use all cores. With more than
+ * one thread, the triangles are binned into screen tiles which are drawn in
+ * parallel. The image is the same for any number of threads.
+ * @param backFaceCulling For every mesh, true to skip the triangles facing
+ * away from the eye. Only use this for closed meshes with the vertices of
+ * every face in counterclockwise order (seen from outside). Empty to draw
+ * all triangles. Instances outside the view are always skipped.
+ */
+img::EasyImage draw_zbuffered_meshes(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes, const GFX::mat4 &T,
+    const std::vector<Instances> &instances, const std::vector<GFX::Color> &colors, int size, const img::Color &bgColor,
+    GFX::Real lodTolerance = 0.0, unsigned int numThreads = 0, const std::vector<bool> &backFaceCulling = std::vector<bool>());
 
 
 struct ShadowMask
 {
-  ShadowMask(const GFX::Buffer<GFX::Real> &mask_, const GFX::mat4 &view_, GFX::Real d_, GFX::Real dx_, GFX::Real dy_)
+  ShadowMask(const GFX::DepthMap &mask_, const GFX::mat4 &view_, GFX::Real d_, GFX::Real dx_, GFX::Real dy_)
     : mask(mask_), view(view_), d(d_), dx(dx_), dy(dy_)
   {
   }
 
-  GFX::Buffer<GFX::Real> mask; // the shadow mask (z-buffer)
+  GFX::DepthMap mask; // the shadow mask (z-buffer)
   GFX::mat4 view; // view matrix for light position
   GFX::Real d; // distance from origin to camera (light position)
   GFX::Real dx; // x displacement to screen coords
@@ -204,13 +307,88 @@ struct ShadowMask
 
 extern GFX::Real shadowEpsilon;
 
-img::EasyImage draw_zbuffered_meshes(const std::vector<std::shared_ptr<GFX::Mesh> > &meshes, const GFX::mat4 &project,
-    const std::vector<GFX::mat4> &modelMatrices, const std::vector<Light> &lights, const std::vector<Material> &materials,
-    const std::vector<ShadowMask> &shadowMasks, int size, const img::Color &bgColor);
+/**
+ * @brief Where the lighting is computed.
+ */
+enum LightingMode {
+  PixelLighting, //!< For every pixel.
+  VertexLighting //!< For every vertex using smooth normals, the colors are interpolated (Gouraud).
+};
+
+/**
+ * @brief The accuracy of the per pixel lighting.
+ */
+enum LightingAccuracy {
+  ExactLighting, //!< std::pow and full square roots (the reference images).
+  FastLighting //!< Interpolated power tables and approximate reciprocal square roots.
+};
+
+/**
+ * @brief Draw lighted meshes using a z-buffer.
+ *
+ * @param shadowMasks The shadow mask for every light (see draw_shadow_mask()),
+ * empty to draw without shadows.
+ * @param lodTolerance The allowed error in pixels for simplified meshes, 0 to
+ * always draw the full meshes. Ignored with shadow masks, the masks are drawn
+ * from the full meshes.
+ * @param numThreads The number of threads, 0 to use all cores.
+ * @param deferredShading If true, the visible triangle is found for every
+ * pixel first and the lighting is computed once per visible pixel afterwards.
+ * The image is the same but hidden pixels are never shaded.
+ * @param backFaceCulling For every mesh, true to skip the back facing
+ * triangles (see above).
+ * @param accuracy FastLighting to approximate the specular exponent and the
+ * normalization of the light directions, the colors may differ by a unit.
+ * @param mode VertexLighting to light the vertices only. Meshes without a
+ * normal for every vertex are copied with smooth normals. With shadows, the
+ * vertex colors only include the point lights visible from the vertex.
+ *
+ * If some point lights have a range (see Light::range), the image is divided
+ * in tiles of 16x16 pixels and the pixels of a tile only loop over the point
+ * lights whose range overlaps the visible depth range of the tile (found with
+ * a depth pre-pass or with the visibility pass for deferred shading).
+ */
+img::EasyImage draw_zbuffered_meshes(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes, const GFX::mat4 &project,
+    const std::vector<Instances> &instances, const std::vector<Light> &lights, const std::vector<Material> &materials,
+    const std::vector<ShadowMask> &shadowMasks, int size, const img::Color &bgColor, GFX::Real lodTolerance = 0.0,
+    unsigned int numThreads = 0, bool deferredShading = false, const std::vector<bool> &backFaceCulling = std::vector<bool>(),
+    LightingAccuracy accuracy = ExactLighting, LightingMode mode = PixelLighting);
+
 
+/**
+ * @brief Draw the z-buffer seen from a light.
+ *
+ * @param backFaceCulling For every mesh, true to skip the triangles facing
+ * away from the light (see draw_zbuffered_meshes()).
+ * @param numThreads The number of threads, 0 to use all cores.
+ * @param format The storage for the depth values. The smaller formats use
+ * less memory and are faster to look up but the shadows may change slightly.
+ * @param layout The order of the pixels in memory.
+ */
+ShadowMask draw_shadow_mask(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes, const GFX::mat4 &project,
+    const std::vector<Instances> &instances, int size, const std::vector<bool> &backFaceCulling = std::vector<bool>(),
+    unsigned int numThreads = 0, GFX::DepthFormat format = GFX::DoubleDepthFormat,
+    GFX::DepthLayout layout = GFX::RowMajorDepthLayout);
 
-ShadowMask draw_shadow_mask(const std::vector<std::shared_ptr<GFX::Mesh> > &meshes, const GFX::mat4 &project,
-    const std::vector<GFX::mat4> &modelMatrices, int size);
+/**
+ * @brief Draw the shadow masks for a set of lights.
+ *
+ * Only point lights cast shadows, infinite lights get an empty mask. With at
+ * least as many point lights as threads, the masks are drawn concurrently
+ * (every light by a single thread with its own buffers). Otherwise the masks
+ * are drawn one after the other using all threads.
+ *
+ * @param lights The lights in world coordinates.
+ * @param numThreads The number of threads, 0 to use all cores.
+ * @param format The storage for the depth values (see draw_shadow_mask()).
+ * @param layout The order of the pixels in memory.
+ *
+ * @return The shadow mask for every light.
+ */
+std::vector<ShadowMask> draw_shadow_masks(const std::vector<std::shared_ptr<const GFX::Mesh> > &meshes,
+    const std::vector<Instances> &instances, const std::vector<Light> &lights, int size,
+    const std::vector<bool> &backFaceCulling = std::vector<bool>(), unsigned int numThreads = 0,
+    GFX::DepthFormat format = GFX::DoubleDepthFormat, GFX::DepthLayout layout = GFX::RowMajorDepthLayout);
 
 
 #endif
@@ -0,0 +1,37 @@
+#include <libgfx/meshio.h>
+
+#include <iostream>
+
+/**
+ * Convert an OBJ or PLY file to the native binary mesh format so it can be
+ * memory mapped by the engine (figure type "MeshFile" with a *.gfxm file).
+ * The mesh is triangulated and the triangles are reordered for vertex reuse.
+ */
+int main(int argc, char const* argv[])
+{
+        if(argc != 3)
+        {
+                std::cerr << "Usage: " << argv[0] << " <input.obj|input.ply> <output.gfxm>" << std::endl;
+                return 1;
+        }
+
+        std::shared_ptr<GFX::Mesh> mesh = GFX::readMesh(argv[1]);
+        if(!mesh)
+        {
+                std::cerr << "Could not read mesh file: " << argv[1] << std::endl;
+                return 1;
+        }
+
+        mesh->triangulate();
+        std::pair<GFX::Real, GFX::Real> acmr = mesh->optimizeVertexCache();
+        std::cout << "ACMR: " << acmr.first << " -> " << acmr.second << std::endl;
+
+        if(!GFX::writeBinaryMesh(*mesh, argv[2]))
+        {
+                std::cerr << "Could not write mesh file: " << argv[2] << std::endl;
+                return 1;
+        }
+
+        std::cout << mesh->vertices().size() << " vertices, " << mesh->faces().size() << " faces" << std::endl;
+        return 0;
+}
@@ -0,0 +1,85 @@
+#include <libgfx/depthmap.h>
+
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+
+using namespace GFX;
+
+/**
+ * The number of 2x2 fetches per second (in millions) for the positions.
+ */
+double lookupRate(const DepthMap &map, const std::vector<int> &positions)
+{
+  auto start = std::chrono::steady_clock::now();
+  Real sum = 0.0;
+  for (std::size_t i = 0; i < positions.size(); i += 2) {
+    int x = positions[i], y = positions[i + 1];
+    Real z[4];
+    map.fetch(x, x + 1, y, y + 1, z);
+    sum += 1.0 / z[0] + 1.0 / z[1] + 1.0 / z[2] + 1.0 / z[3];
+  }
+  std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+  // use the sum so the lookups are not optimized away
+  if (sum == 0.0)
+    std::cout << "empty map" << std::endl;
+  return positions.size() / 2 / seconds.count() / 1e6;
+}
+
+/**
+ * Benchmark for the shadow mask storage: the memory used by every format and
+ * layout and the number of 2x2 fetches per second at random positions and
+ * along the pixels of a frame.
+ *
+ * usage: benchdepthmap [size] [lookups]
+ */
+int main(int argc, char **argv)
+{
+  int size = argc > 1 ? std::atoi(argv[1]) : 2048;
+  int lookups = argc > 2 ? std::atoi(argv[2]) : 10000000;
+
+  // a smooth depth like a shadow mask, with some empty pixels
+  Buffer<Real> depth(size, size);
+  for (int y = 0; y < size; ++y)
+    for (int x = 0; x < size; ++x)
+      depth(x, y) = (x + y) % 97 ? -1.0 / (10.0 + 0.001 * x + 0.002 * y) : std::numeric_limits<Real>::max();
+
+  // random positions, every lookup is a cache miss for large maps
+  std::mt19937 gen(5);
+  std::uniform_int_distribution<int> posDist(0, size - 2);
+  std::vector<int> randomPositions(2 * lookups);
+  for (std::size_t i = 0; i < randomPositions.size(); ++i)
+    randomPositions[i] = posDist(gen);
+
+  // the rows of a screen seen rotated by 30 degrees from the light, like the
+  // shadow lookups for the pixels of a frame
+  std::vector<int> framePositions(2 * lookups);
+  int screen = static_cast<int>(std::sqrt(static_cast<double>(lookups)));
+  for (int i = 0; i < lookups; ++i) {
+    double u = static_cast<double>(i % screen) / screen - 0.5;
+    double v = static_cast<double>(i / screen % screen) / screen - 0.5;
+    framePositions[2 * i] = static_cast<int>((0.5 + 0.6 * (0.866 * u - 0.5 * v)) * (size - 2));
+    framePositions[2 * i + 1] = static_cast<int>((0.5 + 0.6 * (0.5 * u + 0.866 * v)) * (size - 2));
+  }
+
+  const char *formats[] = { "double", "float", "unorm16" };
+  const char *layouts[] = { "rows", "tiled" };
+
+  std::cout << "size " << size << "x" << size << ", " << lookups << " lookups" << std::endl;
+  for (int format = DoubleDepthFormat; format <= Unorm16DepthFormat; ++format)
+    for (int layout = RowMajorDepthLayout; layout <= TiledDepthLayout; ++layout) {
+      DepthMap map(depth, static_cast<DepthFormat>(format), static_cast<DepthLayout>(layout));
+
+      std::cout << std::left << std::setw(8) << formats[format] << std::setw(6) << layouts[layout]
+                << std::right << std::setw(8) << std::fixed << std::setprecision(1) << map.memoryUsage() / 1048576.0 << " MiB";
+      std::cout << std::setw(10) << lookupRate(map, randomPositions) << " M/s random";
+      std::cout << std::setw(10) << lookupRate(map, framePositions) << " M/s frame" << std::endl;
+    }
+
+  return 0;
+}
@@ -23,7 +23,7 @@ struct EasyImageCanvas
 void test_Render2D_drawLine()
 {
   EasyImageCanvas canvas(500, 500, Color::black());
-  Render2D<EasyImageCanvas> painter(canvas);
+  Render2D<EasyImageCanvas> painter(canvas, 500, 500);
 
   painter.drawLine(100, 100, 400, 100, Color::red());
   painter.drawLine(400, 200, 100, 200, Color::red());
@@ -37,6 +37,10 @@ void test_Render2D_drawLine()
   painter.drawLine(100, 100, 200, 400, Color::yellow());
   painter.drawLine(100, 400, 200, 100, Color::blue());
 
+  // clipped to the canvas
+  painter.drawLine(-100, 250, 600, 300, Color::white());
+  painter.drawLine(450, -50, 550, 550, Color::white());
+
   std::ofstream ofs("test_Render2D_drawLine.bmp", std::ios_base::out | std::ios_base::binary);
   ofs << canvas.image;
 }
@@ -0,0 +1,154 @@
+#include <libgfx/bresenham.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <utility>
+#include <cmath>
+
+using namespace GFX;
+
+typedef std::vector<std::pair<int, int> > Pixels;
+
+/**
+ * The pixels of the floating-point line drawer BresenhamLine replaced
+ * (EasyImage::draw_line(), Render2D::drawLine() and draw_zbuf_line() for the
+ * truncated end points), in the order BresenhamLine walks them.
+ */
+Pixels floatLinePixels(int x0, int y0, int x1, int y1)
+{
+  Pixels pixels;
+  if (x0 == x1) {
+    for (int i = std::min(y0, y1); i <= std::max(y0, y1); i++)
+      pixels.push_back(std::make_pair(x0, i));
+    // BresenhamLine walks from (x0, y0)
+    if (y1 < y0)
+      std::reverse(pixels.begin(), pixels.end());
+  } else if (y0 == y1) {
+    for (int i = std::min(x0, x1); i <= std::max(x0, x1); i++)
+      pixels.push_back(std::make_pair(i, y0));
+  } else {
+    if (x0 > x1) {
+      std::swap(x0, x1);
+      std::swap(y0, y1);
+    }
+    double m = ((double) y1 - (double) y0) / ((double) x1 - (double) x0);
+    if (-1.0 <= m && m <= 1.0) {
+      for (int i = 0; i <= (x1 - x0); i++)
+        pixels.push_back(std::make_pair(x0 + i, (int) round(y0 + m * i)));
+    } else if (m > 1.0) {
+      for (int i = 0; i <= (y1 - y0); i++)
+        pixels.push_back(std::make_pair((int) round(x0 + (i / m)), y0 + i));
+    } else if (m < -1.0) {
+      for (int i = 0; i <= (y0 - y1); i++)
+        pixels.push_back(std::make_pair((int) round(x0 - (i / m)), y0 - i));
+    }
+  }
+
+  return pixels;
+}
+
+/**
+ * Check the pixels of a line clipped to a rectangle against the pixels of the
+ * floating-point line inside the rectangle.
+ */
+bool checkLine(int x0, int y0, int x1, int y1, int xMin, int yMin, int xMax, int yMax)
+{
+  Pixels expected;
+  Pixels all = floatLinePixels(x0, y0, x1, y1);
+  int first = -1;
+  for (std::size_t i = 0; i < all.size(); ++i)
+    if (all[i].first >= xMin && all[i].first <= xMax && all[i].second >= yMin && all[i].second <= yMax) {
+      if (first < 0)
+        first = i;
+      expected.push_back(all[i]);
+    }
+
+  Pixels pixels;
+  BresenhamLine line(x0, y0, x1, y1, xMin, yMin, xMax, yMax);
+  for (int i = 0; i < line.count; ++i, line.next())
+    pixels.push_back(std::make_pair(line.x, line.y));
+
+  if (pixels != expected || (line.count && (line.first != first || line.steps != static_cast<int>(all.size()) - 1))) {
+    std::cerr << "line (" << x0 << ", " << y0 << ") - (" << x1 << ", " << y1 << "): " << pixels.size()
+              << " pixels instead of " << expected.size() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Count the pixels half way between two pixels that the floating-point line
+ * rounds towards its first pixel, so the tests are known to cover them.
+ */
+int roundedBack(int x0, int y0, int x1, int y1)
+{
+  if (x0 > x1) {
+    std::swap(x0, x1);
+    std::swap(y0, y1);
+  }
+  int dx = x1 - x0, dy = y1 - y0;
+  if (std::abs(dy) > dx || dy == 0)
+    return 0;
+  int count = 0;
+  double m = (double) dy / (double) dx;
+  for (int i = 0; i <= dx; i++) {
+    // y0 + q / 2 is half way if q = 2 * dy * i / dx is odd, away from the
+    // first pixel is y0 + (q + 1) / 2 if y increases
+    long long q = 2LL * dy * i / dx;
+    if ((2LL * dy * i) % dx == 0 && q % 2 != 0)
+      count += static_cast<long long>(round(y0 + m * i)) != y0 + (q + (dy > 0 ? 1 : -1)) / 2;
+  }
+  return count;
+}
+
+/**
+ * Draw random lines clipped to a rectangle and compare them with the
+ * floating-point lines, also for lines long enough for rounding errors of
+ * the slope.
+ */
+bool test_BresenhamLine()
+{
+  std::mt19937 gen(7);
+
+  struct Range { int coordMin, coordMax, xMin, yMin, xMax, yMax; };
+  const Range ranges[2] = { { -60, 100, 3, -5, 40, 30 }, { -500, 3000, 0, 0, 2047, 1535 } };
+  int back = 0;
+  for (const Range &range : ranges) {
+    std::uniform_int_distribution<int> coordDist(range.coordMin, range.coordMax);
+    for (int test = 0; test < 100000; ++test) {
+      int x0 = coordDist(gen), y0 = coordDist(gen);
+      int x1 = test % 10 ? coordDist(gen) : x0; // some vertical and horizontal lines
+      int y1 = test % 10 == 1 ? y0 : coordDist(gen);
+      back += roundedBack(x0, y0, x1, y1);
+
+      // clipped and completely visible
+      if (!checkLine(x0, y0, x1, y1, range.xMin, range.yMin, range.xMax, range.yMax) ||
+          !checkLine(x0, y0, x1, y1, range.coordMin, range.coordMin, range.coordMax, range.coordMax))
+        return false;
+    }
+  }
+
+  // lines with a slope of 1 / 6 where y0 + m * 3 is rounded down, clipped
+  // exactly at that pixel
+  for (int y0 = 0; y0 < 64; ++y0)
+    for (int x = 0; x <= 6; ++x)
+      for (int y = y0 - 1; y <= y0 + 2; ++y)
+        if (!checkLine(0, y0, 6, y0 + 1, x, y, 6, y0 + 1) || !checkLine(0, y0, 6, y0 + 1, 0, y0, x, y))
+          return false;
+
+  if (!back) {
+    std::cerr << "no pixels half way rounded back" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+int main()
+{
+  return test_BresenhamLine() ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+#include <libgfx/depthmap.h>
+
+#include <iostream>
+#include <random>
+#include <cmath>
+#include <limits>
+
+using namespace GFX;
+
+const char* formatName(DepthFormat format)
+{
+  switch (format) {
+    case FloatDepthFormat:
+      return "float";
+    case Unorm16DepthFormat:
+      return "unorm16";
+    default:
+      return "double";
+  }
+}
+
+/**
+ * Create a depth map with @p format and @p layout from a random z-buffer
+ * (with empty pixels) and compare the values. The sizes are not multiples of
+ * the tile size to test the padding.
+ */
+bool test_DepthMap(DepthFormat format, DepthLayout layout)
+{
+  std::mt19937 gen(13);
+  std::uniform_real_distribution<Real> depthDist(-2.0, -0.01);
+  std::uniform_int_distribution<int> emptyDist(0, 9);
+
+  const Real empty = std::numeric_limits<Real>::max();
+  const int width = 37, height = 21;
+
+  Buffer<Real> depth(width, height);
+  Real lo = empty, hi = -empty;
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+      depth(x, y) = emptyDist(gen) ? depthDist(gen) : empty;
+      if (depth(x, y) < empty) {
+        lo = std::min(lo, depth(x, y));
+        hi = std::max(hi, depth(x, y));
+      }
+    }
+
+  DepthMap map(depth, format, layout);
+  if (map.width() != width || map.height() != height) {
+    std::cerr << "wrong size" << std::endl;
+    return false;
+  }
+
+  // the largest error for a value
+  Real tolerance = 0.0;
+  if (format == FloatDepthFormat)
+    tolerance = 2.0 * std::numeric_limits<float>::epsilon();
+  else if (format == Unorm16DepthFormat)
+    tolerance = (hi - lo) / 65534 * 0.5 + 1e-12;
+
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+      Real expected = depth(x, y);
+      Real value = map(x, y);
+      if (expected == empty ? value != empty : std::abs(value - expected) > tolerance) {
+        std::cerr << formatName(format) << " depth map: pixel (" << x << ", " << y << ") is " << value
+                  << " instead of " << expected << std::endl;
+        return false;
+      }
+
+      // the 2x2 fetch returns the same values
+      int x1 = std::min(x + 1, width - 1);
+      int y1 = std::min(y + 1, height - 1);
+      Real z[4];
+      map.fetch(x, x1, y, y1, z);
+      if (z[0] != map(x, y) || z[1] != map(x1, y) || z[2] != map(x, y1) || z[3] != map(x1, y1)) {
+        std::cerr << formatName(format) << " depth map: fetch at (" << x << ", " << y << ") differs" << std::endl;
+        return false;
+      }
+    }
+
+  return true;
+}
+
+int main()
+{
+  bool ok = true;
+  for (int format = DoubleDepthFormat; format <= Unorm16DepthFormat; ++format) {
+    ok = test_DepthMap(static_cast<DepthFormat>(format), RowMajorDepthLayout) && ok;
+    ok = test_DepthMap(static_cast<DepthFormat>(format), TiledDepthLayout) && ok;
+  }
+  return ok ? 0 : 1;
+}
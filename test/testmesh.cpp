@@ -0,0 +1,263 @@
+#include <libgfx/mesh.h>
+
+#include <iostream>
+#include <cmath>
+#include <map>
+#include <string>
+#include <utility>
+
+using namespace GFX;
+
+/**
+ * Check that a triangle mesh is closed: every directed edge (a, b) has exactly
+ * one opposite edge (b, a) and there are no degenerate triangles. A T-junction
+ * (a vertex on the edge of another triangle) leaves edges without opposite.
+ */
+bool isWatertight(const Mesh &mesh)
+{
+  std::map<std::pair<int, int>, int> edges;
+  for (std::size_t i = 0; i < mesh.faces().size(); ++i) {
+    const Mesh::Face &face = mesh.faces()[i];
+    if (face.size() != 3) {
+      std::cerr << "face " << i << " is not a triangle" << std::endl;
+      return false;
+    }
+
+    vec4 e1 = mesh.vertices()[face[1]] - mesh.vertices()[face[0]];
+    vec4 e2 = mesh.vertices()[face[2]] - mesh.vertices()[face[0]];
+    vec3 n = vec3(e1.x(), e1.y(), e1.z()).cross(vec3(e2.x(), e2.y(), e2.z()));
+    if (n.norm() < 1e-12) {
+      std::cerr << "face " << i << " is degenerate" << std::endl;
+      return false;
+    }
+
+    for (int j = 0; j < 3; ++j)
+      ++edges[std::make_pair(face[j], face[(j + 1) % 3])];
+  }
+
+  for (auto &edge : edges) {
+    auto opposite = edges.find(std::make_pair(edge.first.second, edge.first.first));
+    if (edge.second != 1 || opposite == edges.end() || opposite->second != 1) {
+      std::cerr << "edge " << edge.first.first << "-" << edge.first.second << " is not shared by two faces" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * The area of the surface of a triangle mesh.
+ */
+Real surfaceArea(const Mesh &mesh)
+{
+  Real area = 0.0;
+  for (auto &face : mesh.faces())
+    for (std::size_t j = 1; j + 1 < face.size(); ++j) {
+      vec4 e1 = mesh.vertices()[face[j]] - mesh.vertices()[face[0]];
+      vec4 e2 = mesh.vertices()[face[j + 1]] - mesh.vertices()[face[0]];
+      area += 0.5 * vec3(e1.x(), e1.y(), e1.z()).cross(vec3(e2.x(), e2.y(), e2.z())).norm();
+    }
+  return area;
+}
+
+/**
+ * The merged Menger sponge has to be a closed surface (no T-junctions) with
+ * the area of all voxel faces between a filled and an empty voxel.
+ */
+bool test_Mesh_mengerSponge()
+{
+  for (int n = 0; n <= 3; ++n) {
+    std::shared_ptr<Mesh> sponge = Mesh::mengerSponge(n);
+    sponge->triangulate();
+    if (!isWatertight(*sponge)) {
+      std::cerr << "Menger sponge " << n << " is not watertight" << std::endl;
+      return false;
+    }
+
+    // count the voxel faces between a filled and an empty voxel, each has
+    // area (2 / 3^n)^2
+    int size = 1;
+    for (int i = 0; i < n; ++i)
+      size *= 3;
+    auto filled = [&] (int x, int y, int z) -> bool {
+      if (x < 0 || y < 0 || z < 0 || x >= size || y >= size || z >= size)
+        return false;
+      for (; x || y || z; x /= 3, y /= 3, z /= 3)
+        if ((x % 3 == 1) + (y % 3 == 1) + (z % 3 == 1) >= 2)
+          return false;
+      return true;
+    };
+    int faces = 0;
+    for (int x = -1; x < size; ++x)
+      for (int y = -1; y < size; ++y)
+        for (int z = -1; z < size; ++z) {
+          faces += filled(x, y, z) != filled(x + 1, y, z);
+          faces += filled(x, y, z) != filled(x, y + 1, z);
+          faces += filled(x, y, z) != filled(x, y, z + 1);
+        }
+    Real expected = faces * 4.0 / (size * size);
+    if (std::abs(surfaceArea(*sponge) - expected) > 1e-9 * expected) {
+      std::cerr << "Menger sponge " << n << " has area " << surfaceArea(*sponge) << " instead of " << expected << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Check that a simplified mesh is still a closed manifold with the topology of
+ * a sphere (V - E + F = 2) and finite vertices.
+ */
+bool isClosedSphere(const Mesh &mesh, const std::string &name)
+{
+  for (auto &v : mesh.vertices())
+    if (!std::isfinite(v.x()) || !std::isfinite(v.y()) || !std::isfinite(v.z())) {
+      std::cerr << name << " has a vertex that is not finite" << std::endl;
+      return false;
+    }
+
+  if (!isWatertight(mesh)) {
+    std::cerr << name << " is not watertight" << std::endl;
+    return false;
+  }
+
+  // every edge is shared by two triangles
+  long V = mesh.vertices().size(), F = mesh.faces().size(), E = 3 * F / 2;
+  if (V - E + F != 2) {
+    std::cerr << name << " has Euler characteristic " << V - E + F << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Simplify a tetrahedron (nothing can be collapsed) and a sphere.
+ */
+bool test_Mesh_simplify()
+{
+  std::shared_ptr<Mesh> tetrahedron = Mesh::tetrahedron();
+  Real error = -1.0;
+  std::shared_ptr<Mesh> simplified = tetrahedron->simplify(2, &error);
+  if (simplified->faces().size() != 4 || error != 0.0 || !isClosedSphere(*simplified, "simplified tetrahedron"))
+    return false;
+
+  std::shared_ptr<Mesh> sphere = Mesh::sphere(3);
+  for (std::size_t numFaces : { 1000, 200, 20 }) {
+    simplified = sphere->simplify(numFaces, &error);
+    if (simplified->faces().size() > numFaces || simplified->faces().size() < numFaces / 2) {
+      std::cerr << "simplified sphere has " << simplified->faces().size() << " faces instead of " << numFaces << std::endl;
+      return false;
+    }
+    if (!std::isfinite(error) || !isClosedSphere(*simplified, "simplified sphere"))
+      return false;
+
+    // the vertices stay close to the unit sphere
+    for (auto &v : simplified->vertices())
+      if (std::abs(v.head<3>().norm() - 1.0) > 0.5) {
+        std::cerr << "simplified sphere has a vertex at distance " << v.head<3>().norm() << std::endl;
+        return false;
+      }
+  }
+
+  return true;
+}
+
+/**
+ * Every level of detail of a sphere is closed and has about half the faces
+ * of the previous level with a larger error.
+ */
+bool test_Mesh_levelsOfDetail()
+{
+  std::shared_ptr<Mesh> sphere = Mesh::sphere(4);
+  std::vector<std::shared_ptr<Mesh> > levels;
+  std::vector<Real> errors;
+  sphere->levelsOfDetail(50, levels, errors);
+
+  if (levels.size() < 4 || levels.size() != errors.size()) {
+    std::cerr << levels.size() << " levels of detail" << std::endl;
+    return false;
+  }
+
+  std::size_t numFaces = sphere->faces().size();
+  Real error = 0.0;
+  for (std::size_t i = 0; i < levels.size(); ++i) {
+    if (levels[i]->faces().size() > numFaces / 2 || levels[i]->faces().size() < 50) {
+      std::cerr << "level " << i << " has " << levels[i]->faces().size() << " faces" << std::endl;
+      return false;
+    }
+    if (!std::isfinite(errors[i]) || errors[i] < error) {
+      std::cerr << "level " << i << " has error " << errors[i] << std::endl;
+      return false;
+    }
+    if (!isClosedSphere(*levels[i], "level of detail"))
+      return false;
+    numFaces = levels[i]->faces().size();
+    error = errors[i];
+  }
+
+  return true;
+}
+
+/**
+ * Crease normals keep the edges of a cube and an icosahedron sharp and a
+ * sphere smooth.
+ */
+bool test_Mesh_computeCreaseNormals()
+{
+  const Real creaseAngle = 30.0 * M_PI / 180.0;
+
+  // every corner of a face gets the face normal, the cube has 6 x 4 and the
+  // icosahedron 20 x 3 vertices
+  std::pair<std::shared_ptr<Mesh>, std::size_t> faceted[2] = {
+    std::make_pair(Mesh::cube(), 24), std::make_pair(Mesh::icosahedron(), 60)
+  };
+  for (auto &pair : faceted) {
+    std::shared_ptr<Mesh> mesh = pair.first;
+    mesh->triangulate();
+    mesh->computeCreaseNormals(creaseAngle);
+    if (mesh->vertices().size() != pair.second || mesh->normals().size() != mesh->vertices().size()) {
+      std::cerr << "faceted mesh has " << mesh->vertices().size() << " vertices" << std::endl;
+      return false;
+    }
+
+    for (auto &face : mesh->faces()) {
+      vec3 AB = (mesh->vertices()[face[1]] - mesh->vertices()[face[0]]).head<3>();
+      vec3 AC = (mesh->vertices()[face[2]] - mesh->vertices()[face[0]]).head<3>();
+      vec3 n = AB.cross(AC).normalized();
+      for (int v : face)
+        if ((mesh->normals()[v].head<3>() - n).norm() > 1e-12) {
+          std::cerr << "faceted mesh has a smooth normal" << std::endl;
+          return false;
+        }
+    }
+  }
+
+  // a sphere keeps its vertices and the normals are close to the exact ones
+  std::shared_ptr<Mesh> sphere = Mesh::sphere(2);
+  std::size_t numVertices = sphere->vertices().size();
+  sphere->computeCreaseNormals(creaseAngle);
+  if (sphere->vertices().size() != numVertices) {
+    std::cerr << "sphere has " << sphere->vertices().size() << " vertices instead of " << numVertices << std::endl;
+    return false;
+  }
+  for (std::size_t i = 0; i < numVertices; ++i)
+    if ((sphere->normals()[i].head<3>() - sphere->vertices()[i].head<3>()).norm() > 0.05) {
+      std::cerr << "sphere normal " << i << " is not smooth" << std::endl;
+      return false;
+    }
+
+  return true;
+}
+
+int main()
+{
+  bool ok = true;
+  ok &= test_Mesh_mengerSponge();
+  ok &= test_Mesh_simplify();
+  ok &= test_Mesh_levelsOfDetail();
+  ok &= test_Mesh_computeCreaseNormals();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,408 @@
+#include <libgfx/meshio.h>
+#include <libgfx/meshcache.h>
+#include <libgfx/parallel.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+
+using namespace GFX;
+
+void writeFile(const std::string &filename, const std::string &contents)
+{
+  std::ofstream ofs(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+  ofs.write(contents.data(), contents.size());
+}
+
+/**
+ * A random mesh with @p numVertices vertices and @p numFaces faces with 3 to
+ * 5 vertices. The coordinates are multiples of 1/8 so they are exact as
+ * floats.
+ */
+Mesh randomMesh(int numVertices, int numFaces, unsigned int seed)
+{
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> coordDist(-8000, 8000);
+  std::uniform_int_distribution<int> sizeDist(3, 5);
+  std::uniform_int_distribution<int> indexDist(0, numVertices - 1);
+
+  Mesh mesh;
+  for (int i = 0; i < numVertices; ++i)
+    mesh.addVertex(coordDist(gen) / 8.0, coordDist(gen) / 8.0, coordDist(gen) / 8.0);
+  for (int i = 0; i < numFaces; ++i) {
+    Mesh::Face face(sizeDist(gen));
+    for (std::size_t j = 0; j < face.size(); ++j)
+      face[j] = indexDist(gen);
+    mesh.addFace(face);
+  }
+  return mesh;
+}
+
+bool sameMesh(const std::shared_ptr<Mesh> &mesh, const Mesh &expected, const std::string &name)
+{
+  if (!mesh) {
+    std::cerr << name << ": not read" << std::endl;
+    return false;
+  }
+  if (mesh->vertices() != expected.vertices()) {
+    std::cerr << name << ": wrong vertices" << std::endl;
+    return false;
+  }
+  if (mesh->faces() != expected.faces()) {
+    std::cerr << name << ": wrong faces" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Check that a file is split in several chunks (1 MB or more) for
+ * @p numThreads threads and that some of the even split points fall inside a
+ * line (see splitLines() in meshio.cpp).
+ */
+bool splitsLines(const std::string &data, unsigned int numThreads)
+{
+  std::size_t numChunks = std::min<std::size_t>(4 * threadCount(numThreads), data.size() >> 20);
+  bool inside = false;
+  for (std::size_t i = 1; i < numChunks; ++i)
+    inside |= data[data.size() * i / numChunks - 1] != '\n';
+  return numChunks > 1 && inside;
+}
+
+enum ObjIndices {
+  ObjPositive, //!< f 1 2 3
+  ObjNegative, //!< f -3 -2 -1 (relative to the last vertex)
+  ObjSlashes //!< f 1/1/1 2//2 3/3
+};
+
+/**
+ * Write a mesh as OBJ. Every face follows the vertices it uses so relative
+ * indices can be used, comments and other keywords are mixed in.
+ */
+std::string toOBJ(const Mesh &mesh, ObjIndices indices, const char *newline)
+{
+  std::ostringstream os;
+  os.precision(17);
+  os << "# test mesh" << newline << "o mesh" << newline;
+
+  // the vertices a face needs
+  std::vector<std::size_t> lastVertex(mesh.faces().size());
+  for (std::size_t i = 0; i < mesh.faces().size(); ++i)
+    lastVertex[i] = *std::max_element(mesh.faces()[i].begin(), mesh.faces()[i].end());
+
+  std::size_t f = 0;
+  for (std::size_t v = 0; v <= mesh.vertices().size(); ++v) {
+    for (; f < mesh.faces().size() && lastVertex[f] < v; ++f) {
+      const Mesh::Face &face = mesh.faces()[f];
+      os << (f % 2 ? "f " : "  f\t");
+      for (std::size_t j = 0; j < face.size(); ++j) {
+        long index = indices == ObjNegative ? face[j] - static_cast<long>(v) : face[j] + 1;
+        os << index;
+        if (indices == ObjSlashes)
+          os << (j % 3 == 0 ? "/1/1" : (j % 3 == 1 ? "//1" : "/1"));
+        os << (j + 1 < face.size() ? " " : "");
+      }
+      os << newline;
+    }
+
+    if (v == mesh.vertices().size())
+      break;
+    const vec4 &p = mesh.vertices()[v];
+    os << "v " << p.x() << " " << p.y() << "  " << p.z() << newline;
+    if (v % 7 == 0)
+      os << "vn 0 0 1" << newline << "vt 0.5 0.5" << newline << newline;
+  }
+
+  return os.str();
+}
+
+/**
+ * Read OBJ files with all index forms and line endings.
+ */
+bool test_readOBJ()
+{
+  Mesh mesh = randomMesh(100, 150, 1);
+  const char *newlines[2] = { "\n", "\r\n" };
+  ObjIndices indices[3] = { ObjPositive, ObjNegative, ObjSlashes };
+
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 2; ++j) {
+      std::string obj = toOBJ(mesh, indices[i], newlines[j]);
+      writeFile("testmeshio.obj", obj);
+      if (!sameMesh(readOBJ("testmeshio.obj", 1), mesh, "OBJ"))
+        return false;
+
+      // no newline at the end of the file
+      writeFile("testmeshio.obj", obj.substr(0, obj.find_last_not_of("\r\n") + 1));
+      if (!sameMesh(readMesh("testmeshio.obj"), mesh, "OBJ without last newline"))
+        return false;
+    }
+
+  // a large file is split in chunks, the chunks have to start at a line
+  Mesh large = randomMesh(100000, 150000, 2);
+  std::string obj = toOBJ(large, ObjNegative, "\r\n");
+  if (!splitsLines(obj, 8)) {
+    std::cerr << "the chunks of the large OBJ start at a line" << std::endl;
+    return false;
+  }
+  writeFile("testmeshio.obj", obj);
+  for (unsigned int threads = 1; threads <= 8; threads *= 2)
+    if (!sameMesh(readOBJ("testmeshio.obj", threads), large, "large OBJ"))
+      return false;
+
+  // short lines and invalid indices
+  const char *invalid[] = {
+    "v 1 2\nv 1 2 3\nf 1 2 2\n",
+    "v 1 2 3\nv 1 2\r\nf 1 2 1\n",
+    "v 1 2 3\nv 1 2 x\nf 1 2 1\n",
+    "v 1 2 3\nv 1 2 3\nf 1 2 3\n",
+    "v 1 2 3\nv 1 2 3\nf 0 1 2\n",
+    "v 1 2 3\nv 1 2 3\nf -3 1 2\n",
+    "v 1 2 3\nv 1 2 3\nf 1 2 4294967297\n",
+    "v 1 2 3\nv 1 2 3\nf 1 2 99999999999999999999999999\n"
+  };
+  for (std::size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+    writeFile("testmeshio.obj", invalid[i]);
+    if (readOBJ("testmeshio.obj")) {
+      std::cerr << "invalid OBJ " << i << " was read" << std::endl;
+      return false;
+    }
+  }
+
+  std::remove("testmeshio.obj");
+  if (readOBJ("testmeshio.obj")) {
+    std::cerr << "missing OBJ was read" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Write a mesh as ASCII PLY with some extra properties and elements.
+ */
+std::string toAsciiPLY(const Mesh &mesh, const char *newline)
+{
+  std::ostringstream os;
+  os.precision(17);
+  os << "ply" << newline << "format ascii 1.0" << newline << "comment test mesh" << newline;
+  os << "element vertex " << mesh.vertices().size() << newline;
+  os << "property double x" << newline << "property uchar red" << newline;
+  os << "property double y" << newline << "property double z" << newline;
+  os << "element face " << mesh.faces().size() << newline;
+  os << "property list uchar float texcoord" << newline << "property list uchar int vertex_indices" << newline;
+  os << "element edge 1" << newline << "property int vertex1" << newline << "property int vertex2" << newline;
+  os << "end_header" << newline;
+
+  for (auto &p : mesh.vertices())
+    os << p.x() << " 255 " << p.y() << " " << p.z() << newline;
+  for (auto &face : mesh.faces()) {
+    os << "2 0.5 0.5 " << face.size();
+    for (auto index : face)
+      os << " " << index;
+    os << newline;
+  }
+  os << "0 1" << newline;
+
+  return os.str();
+}
+
+template<typename T>
+void writeValue(std::string &data, T value, bool bigEndian)
+{
+  char bytes[sizeof(T)];
+  std::memcpy(bytes, &value, sizeof(T));
+  const std::uint16_t one = 1;
+  if (bigEndian == (*reinterpret_cast<const unsigned char*>(&one) == 1))
+    std::reverse(bytes, bytes + sizeof(T));
+  data.append(bytes, sizeof(T));
+}
+
+/**
+ * Write a mesh as binary PLY with fixed size vertices (read in place).
+ */
+std::string toBinaryPLY(const Mesh &mesh, bool bigEndian, std::size_t numVertices)
+{
+  std::ostringstream os;
+  os << "ply\nformat " << (bigEndian ? "binary_big_endian" : "binary_little_endian") << " 1.0\n";
+  os << "element vertex " << numVertices << "\n";
+  os << "property float x\nproperty float y\nproperty float z\nproperty uchar red\n";
+  os << "element face " << mesh.faces().size() << "\n";
+  os << "property uchar flags\nproperty list uchar int vertex_indices\n";
+  os << "end_header\n";
+
+  std::string data = os.str();
+  for (auto &p : mesh.vertices()) {
+    writeValue<float>(data, p.x(), bigEndian);
+    writeValue<float>(data, p.y(), bigEndian);
+    writeValue<float>(data, p.z(), bigEndian);
+    writeValue<std::uint8_t>(data, 255, bigEndian);
+  }
+  for (auto &face : mesh.faces()) {
+    writeValue<std::uint8_t>(data, 0, bigEndian);
+    writeValue<std::uint8_t>(data, face.size(), bigEndian);
+    for (auto index : face)
+      writeValue<std::int32_t>(data, index, bigEndian);
+  }
+
+  return data;
+}
+
+/**
+ * Read ASCII and binary PLY files.
+ */
+bool test_readPLY()
+{
+  Mesh mesh = randomMesh(100, 150, 3);
+  Mesh large = randomMesh(100000, 150000, 4);
+
+  writeFile("testmeshio.ply", toAsciiPLY(mesh, "\n"));
+  if (!sameMesh(readPLY("testmeshio.ply"), mesh, "ASCII PLY"))
+    return false;
+  writeFile("testmeshio.ply", toAsciiPLY(mesh, "\r\n"));
+  if (!sameMesh(readMesh("testmeshio.ply"), mesh, "ASCII PLY with CRLF"))
+    return false;
+
+  // a large file is split in chunks
+  std::string ply = toAsciiPLY(large, "\n");
+  if (!splitsLines(ply, 8)) {
+    std::cerr << "the chunks of the large PLY start at a line" << std::endl;
+    return false;
+  }
+  writeFile("testmeshio.ply", ply);
+  for (unsigned int threads = 1; threads <= 8; threads *= 2)
+    if (!sameMesh(readPLY("testmeshio.ply", threads), large, "large ASCII PLY"))
+      return false;
+
+  for (int bigEndian = 0; bigEndian < 2; ++bigEndian) {
+    writeFile("testmeshio.ply", toBinaryPLY(large, bigEndian, large.vertices().size()));
+    if (!sameMesh(readPLY("testmeshio.ply"), large, "binary PLY"))
+      return false;
+  }
+
+  // short lines, truncated files and invalid counts
+  std::string ascii = toAsciiPLY(mesh, "\n");
+  std::string binary = toBinaryPLY(mesh, false, mesh.vertices().size());
+  std::string invalid[] = {
+    ascii.substr(0, ascii.size() - 6),
+    ascii.substr(0, ascii.find("end_header")),
+    "ply\nformat ascii 1.0\nelement vertex 2\nproperty float x\nproperty float y\nproperty float z\nend_header\n1 2 3\n1 2\n",
+    "ply\nformat ascii 1.0\nelement vertex 1\nproperty float x\nproperty float y\nproperty float z\n"
+        "element face 1\nproperty list uchar int vertex_indices\nend_header\n1 2 3\n3 0 0\n",
+    "ply\nformat ascii 1.0\nelement vertex 1\nproperty float x\nproperty float y\nproperty float z\n"
+        "element face 1\nproperty list uchar int vertex_indices\nend_header\n1 2 3\n3 0 0 1\n",
+    "ply\nformat ascii 1.0\nelement vertex 18446744073709551615\nproperty float x\nproperty float y\nproperty float z\n"
+        "element face 2\nproperty list uchar int vertex_indices\nend_header\n1 2 3\n",
+    binary.substr(0, binary.size() - 1),
+    // 2^60 vertices of 16 bytes wrap to 0 bytes
+    toBinaryPLY(Mesh(), false, std::size_t(1) << 60),
+    toBinaryPLY(Mesh(), false, std::size_t(-1))
+  };
+  for (std::size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+    writeFile("testmeshio.ply", invalid[i]);
+    if (readPLY("testmeshio.ply")) {
+      std::cerr << "invalid PLY " << i << " was read" << std::endl;
+      return false;
+    }
+  }
+
+  std::remove("testmeshio.ply");
+  return true;
+}
+
+/**
+ * Write and read the native binary format.
+ */
+bool test_readBinaryMesh()
+{
+  Mesh mesh = randomMesh(1000, 1500, 5);
+  if (!writeBinaryMesh(mesh, "testmeshio.gfxm") || !sameMesh(readMesh("testmeshio.gfxm"), mesh, "binary mesh"))
+    return false;
+
+  std::ifstream ifs("testmeshio.gfxm", std::ios_base::in | std::ios_base::binary);
+  std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+  // header: "GFXM", uint32 version, uint64 number of vertices, faces and indices
+  std::string badMagic = data;
+  badMagic[0] = 'X';
+  // 2^59 vertices of 32 bytes wrap to 0 bytes, the file only has the header and one offset
+  std::string wrapped(data.substr(0, 32) + std::string(8, '\0'));
+  std::uint64_t counts[3] = { std::uint64_t(1) << 59, 0, 0 };
+  std::memcpy(&wrapped[8], counts, sizeof(counts));
+  // a face offset past the indices
+  std::string badOffset = data;
+  std::uint64_t offset = std::uint64_t(1) << 40;
+  std::memcpy(&badOffset[32 + 32 * 1000 + 8], &offset, 8);
+  // a vertex index out of range
+  std::string badIndex = data;
+  std::int32_t index = 1000;
+  std::memcpy(&badIndex[data.size() - 4], &index, 4);
+  std::string invalid[] = { badMagic, data.substr(0, data.size() - 1), data + '\0', wrapped, badOffset, badIndex };
+
+  for (std::size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+    writeFile("testmeshio.gfxm", invalid[i]);
+    if (readBinaryMesh("testmeshio.gfxm")) {
+      std::cerr << "invalid binary mesh " << i << " was read" << std::endl;
+      return false;
+    }
+  }
+
+  std::remove("testmeshio.gfxm");
+  return true;
+}
+
+/**
+ * The cache reads a file again after it changed and does not keep meshes
+ * above the file capacity.
+ */
+bool test_MeshCache_file()
+{
+  MeshCache &cache = MeshCache::instance();
+  cache.clear();
+
+  writeFile("testmeshio.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n");
+  std::shared_ptr<const Mesh> mesh = cache.file("testmeshio.obj");
+  if (!mesh || cache.file("testmeshio.obj") != mesh) {
+    std::cerr << "file mesh is not cached" << std::endl;
+    return false;
+  }
+
+  // a different size
+  writeFile("testmeshio.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 0 0 1\nf 1 2 3\nf 1 2 4\n");
+  std::shared_ptr<const Mesh> changed = cache.file("testmeshio.obj");
+  if (!changed || changed == mesh || changed->faces().size() != 2) {
+    std::cerr << "changed file is not read again" << std::endl;
+    return false;
+  }
+
+  // too large to cache
+  std::size_t fileCapacity = cache.fileCapacity();
+  cache.setFileCapacity(16);
+  std::size_t size = cache.size();
+  mesh = cache.file("testmeshio.obj");
+  bool cached = cache.size() != size || cache.file("testmeshio.obj") == mesh;
+  cache.setFileCapacity(fileCapacity);
+  if (!mesh || cached) {
+    std::cerr << "file mesh above the capacity is cached" << std::endl;
+    return false;
+  }
+
+  std::remove("testmeshio.obj");
+  return !cache.file("testmeshio.obj");
+}
+
+int main()
+{
+  bool ok = true;
+  ok &= test_readOBJ();
+  ok &= test_readPLY();
+  ok &= test_readBinaryMesh();
+  ok &= test_MeshCache_file();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+#include <labo/render.h>
+
+#include <libgfx/meshcache.h>
+#include <libgfx/transform.h>
+
+#include <iostream>
+
+using namespace GFX;
+
+/**
+ * A small sphere next to a cube, lighted by a point light.
+ */
+struct Scene
+{
+  Scene() : project(projectionMatrix(20.0, 10.0, 15.0))
+  {
+    meshes.push_back(MeshCache::instance().sphere(5, true));
+    meshes.push_back(MeshCache::instance().cube(true));
+    instances.push_back(Instances(1, translationMatrix(0.0, 2.0, 0.0) * scaleMatrix(0.8)));
+    instances.push_back(Instances(1, mat4::Identity()));
+    materials.resize(2, Material(Color(40, 40, 40), Color(200, 150, 100), Color(255, 255, 255), 10.0));
+    culling.resize(2, true);
+    lights.push_back(Light(Light::PointLight, Color::black(), Color(255, 255, 255), Color::black(), vec4(5.0, 8.0, 10.0, 1.0)));
+  }
+
+  img::EasyImage draw(bool shadows, Real lodTolerance) const
+  {
+    std::vector<ShadowMask> shadowMasks;
+    if (shadows)
+      shadowMasks = draw_shadow_masks(meshes, instances, lights, 512, culling);
+
+    // the lights in eye coordinates
+    std::vector<Light> eyeLights(lights);
+    for (Light &light : eyeLights)
+      light.vec() = project * light.vec();
+
+    return draw_zbuffered_meshes(meshes, project, instances, eyeLights, materials, shadowMasks, 128,
+        img::Color(), lodTolerance, 0, false, culling);
+  }
+
+  mat4 project;
+  std::vector<std::shared_ptr<const Mesh> > meshes;
+  std::vector<Instances> instances;
+  std::vector<Material> materials;
+  std::vector<bool> culling;
+  std::vector<Light> lights;
+};
+
+bool sameImage(const img::EasyImage &a, const img::EasyImage &b)
+{
+  if (a.get_width() != b.get_width() || a.get_height() != b.get_height())
+    return false;
+  for (unsigned int x = 0; x < a.get_width(); ++x)
+    for (unsigned int y = 0; y < a.get_height(); ++y)
+      if (a(x, y).red != b(x, y).red || a(x, y).green != b(x, y).green || a(x, y).blue != b(x, y).blue)
+        return false;
+  return true;
+}
+
+/**
+ * The simplified meshes are drawn without shadows only, the shadow masks are
+ * drawn from the full meshes.
+ */
+bool test_draw_zbuffered_meshes_levelsOfDetail()
+{
+  Scene scene;
+
+  img::EasyImage full = scene.draw(false, 0.0);
+  if (sameImage(full, scene.draw(false, 3.0))) {
+    std::cerr << "no simplified meshes drawn" << std::endl;
+    return false;
+  }
+
+  img::EasyImage shadowed = scene.draw(true, 0.0);
+  if (sameImage(full, shadowed)) {
+    std::cerr << "no shadows drawn" << std::endl;
+    return false;
+  }
+  if (!sameImage(shadowed, scene.draw(true, 1.0)) || !sameImage(shadowed, scene.draw(true, 3.0))) {
+    std::cerr << "simplified meshes drawn with shadows" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+int main()
+{
+  bool ok = true;
+  ok &= test_draw_zbuffered_meshes_levelsOfDetail();
+  return ok ? 0 : 1;
+}
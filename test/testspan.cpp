@@ -0,0 +1,151 @@
+#include <libgfx/span.h>
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <cstring>
+#include <limits>
+
+using namespace GFX;
+
+const char* kernelName(SpanKernel kernel)
+{
+  switch (kernel) {
+    case SSE2SpanKernel:
+      return "SSE2";
+    case AVX2SpanKernel:
+      return "AVX2";
+    default:
+      return "scalar";
+  }
+}
+
+/**
+ * Draw random spans with the scalar kernel and @p kernel and compare the
+ * depth values and pixels bit for bit.
+ */
+bool test_drawFlatSpan(SpanKernel kernel)
+{
+  if (!isSpanKernelSupported(kernel)) {
+    std::cout << kernelName(kernel) << " kernel not supported, skipped" << std::endl;
+    return true;
+  }
+
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<Real> depthDist(0.0, 1.0);
+  std::uniform_real_distribution<Real> slopeDist(-0.01, 0.01);
+  std::uniform_int_distribution<int> sizeDist(0, 40);
+  std::uniform_int_distribution<int> byteDist(0, 255);
+
+  const int stride = 7; // bytes between pixels, like a column of an image
+  for (int test = 0; test < 100000; ++test) {
+    int n = sizeDist(gen);
+    int k = sizeDist(gen) % 8;
+    Real z0 = depthDist(gen);
+    Real w = slopeDist(gen);
+    Real dzdx = slopeDist(gen);
+    unsigned char color[3] = { static_cast<unsigned char>(byteDist(gen)), static_cast<unsigned char>(byteDist(gen)),
+                               static_cast<unsigned char>(byteDist(gen)) };
+
+    std::vector<Real> depth(n + 1);
+    for (int i = 0; i <= n; ++i) {
+      switch (byteDist(gen) % 4) {
+        case 0:
+          // the same depth value, the pixel must not be drawn
+          depth[i] = z0 + (w + (k + i) * dzdx);
+          break;
+        case 1:
+          depth[i] = std::numeric_limits<Real>::max();
+          break;
+        default:
+          depth[i] = depthDist(gen);
+          break;
+      }
+    }
+    std::vector<unsigned char> pixels((n + 1) * stride);
+    for (std::size_t i = 0; i < pixels.size(); ++i)
+      pixels[i] = byteDist(gen);
+
+    std::vector<Real> depthRef(depth), depthTest(depth);
+    std::vector<unsigned char> pixelsRef(pixels), pixelsTest(pixels);
+
+    setSpanKernel(ScalarSpanKernel);
+    drawFlatSpan(&depthRef[0], &pixelsRef[0], stride, n, z0, w, dzdx, k, color);
+    setSpanKernel(kernel);
+    drawFlatSpan(&depthTest[0], &pixelsTest[0], stride, n, z0, w, dzdx, k, color);
+
+    if (std::memcmp(&depthRef[0], &depthTest[0], depth.size() * sizeof(Real)) ||
+        std::memcmp(&pixelsRef[0], &pixelsTest[0], pixels.size())) {
+      std::cerr << kernelName(kernel) << " kernel differs from scalar kernel (n = " << n << ", k = " << k << ")" << std::endl;
+      return false;
+    }
+  }
+
+  setSpanKernel(bestSpanKernel());
+  return true;
+}
+
+/**
+ * Draw random depth spans with the scalar kernel and @p kernel and compare
+ * the depth values bit for bit.
+ */
+bool test_drawDepthSpan(SpanKernel kernel)
+{
+  if (!isSpanKernelSupported(kernel)) {
+    std::cout << kernelName(kernel) << " kernel not supported, skipped" << std::endl;
+    return true;
+  }
+
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<Real> depthDist(0.0, 1.0);
+  std::uniform_real_distribution<Real> slopeDist(-0.01, 0.01);
+  std::uniform_int_distribution<int> sizeDist(0, 40);
+
+  for (int test = 0; test < 100000; ++test) {
+    int n = sizeDist(gen);
+    int k = sizeDist(gen) % 8;
+    Real z0 = depthDist(gen);
+    Real w = slopeDist(gen);
+    Real dzdx = slopeDist(gen);
+
+    std::vector<Real> depth(n + 1);
+    for (int i = 0; i <= n; ++i) {
+      switch (sizeDist(gen) % 4) {
+        case 0:
+          depth[i] = z0 + (w + (k + i) * dzdx);
+          break;
+        case 1:
+          depth[i] = std::numeric_limits<Real>::max();
+          break;
+        default:
+          depth[i] = depthDist(gen);
+          break;
+      }
+    }
+
+    std::vector<Real> depthRef(depth), depthTest(depth);
+
+    setSpanKernel(ScalarSpanKernel);
+    drawDepthSpan(&depthRef[0], n, z0, w, dzdx, k);
+    setSpanKernel(kernel);
+    drawDepthSpan(&depthTest[0], n, z0, w, dzdx, k);
+
+    if (std::memcmp(&depthRef[0], &depthTest[0], depth.size() * sizeof(Real))) {
+      std::cerr << kernelName(kernel) << " depth kernel differs from scalar kernel (n = " << n << ", k = " << k << ")" << std::endl;
+      return false;
+    }
+  }
+
+  setSpanKernel(bestSpanKernel());
+  return true;
+}
+
+int main()
+{
+  bool ok = true;
+  ok = test_drawFlatSpan(SSE2SpanKernel) && ok;
+  ok = test_drawFlatSpan(AVX2SpanKernel) && ok;
+  ok = test_drawDepthSpan(SSE2SpanKernel) && ok;
+  ok = test_drawDepthSpan(AVX2SpanKernel) && ok;
+  return ok ? 0 : 1;
+}
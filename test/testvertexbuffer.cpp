@@ -0,0 +1,111 @@
+#include <libgfx/vertexbuffer.h>
+#include <libgfx/mesh.h>
+
+#include <iostream>
+#include <cmath>
+
+using namespace GFX;
+
+/**
+ * Compare the decoded buffer with Mesh::triangleAttributes(). Positions are
+ * rounded to float, normals to 16 bit.
+ */
+bool compareAttributes(const VertexBuffer &buffer, const Mesh &mesh)
+{
+  Mesh copy(mesh);
+  std::vector<Real> expected = copy.triangleAttributes(true, true);
+
+  std::size_t n = buffer.layout().numComponents();
+  if (buffer.size() * n != expected.size()) {
+    std::cerr << "buffer has " << buffer.size() << " vertices instead of " << expected.size() / n << std::endl;
+    return false;
+  }
+
+  std::vector<Real> attributes(n);
+  for (std::size_t i = 0; i < buffer.size(); ++i) {
+    buffer.decode(i, &attributes[0]);
+    for (std::size_t j = 0; j < n; ++j)
+      if (std::abs(attributes[j] - expected[i * n + j]) > 1e-4) {
+        std::cerr << "vertex " << i << " component " << j << " is " << attributes[j] << " instead of " << expected[i * n + j] << std::endl;
+        return false;
+      }
+  }
+
+  return true;
+}
+
+/**
+ * A mesh vertex buffer is only rebuilt after the mesh changed.
+ */
+bool test_VertexBuffer_update()
+{
+  std::shared_ptr<Mesh> mesh = Mesh::tetrahedron();
+  mesh->computeNormals();
+
+  VertexBuffer buffer(VertexBuffer::Triangles, true, true);
+  if (buffer.layout().stride() != 24) {
+    std::cerr << "stride is " << buffer.layout().stride() << std::endl;
+    return false;
+  }
+  if (!buffer.isDirty(*mesh) || !buffer.update(*mesh) || !compareAttributes(buffer, *mesh))
+    return false;
+
+  // nothing changed
+  if (buffer.isDirty(*mesh) || buffer.update(*mesh)) {
+    std::cerr << "buffer rebuilt for an unchanged mesh" << std::endl;
+    return false;
+  }
+
+  // a copy shares the revision until it is modified
+  Mesh copy(*mesh);
+  if (buffer.isDirty(copy)) {
+    std::cerr << "buffer is dirty for a copy" << std::endl;
+    return false;
+  }
+
+  // reading through the non-const accessors does not modify the mesh
+  std::vector<vec4> &vertices = mesh->vertices();
+  if (vertices.size() != 4 || mesh->faces()[0].size() != 3 || buffer.isDirty(*mesh)) {
+    std::cerr << "buffer is dirty after reading the mesh" << std::endl;
+    return false;
+  }
+
+  // modify a vertex through a reference obtained earlier
+  vertices[0] = vec4(0.5, 0.25, -0.5, 1.0);
+  mesh->markModified();
+  if (!buffer.isDirty(*mesh) || buffer.isDirty(copy)) {
+    std::cerr << "modified vertex does not change the revision" << std::endl;
+    return false;
+  }
+  mesh->computeNormals();
+  if (!buffer.update(*mesh) || !compareAttributes(buffer, *mesh))
+    return false;
+  std::vector<Real> position(buffer.layout().numComponents());
+  buffer.decode(0, &position[0]);
+  if (position[0] != 0.5 || position[1] != 0.25 || position[2] != -0.5) {
+    std::cerr << "modified vertex is not re-encoded" << std::endl;
+    return false;
+  }
+
+  // add a face
+  mesh->addVertex(2.0, 0.0, 0.0);
+  mesh->addFace(0, 1, 4);
+  mesh->computeNormals();
+  if (!buffer.update(*mesh) || buffer.size() != 15 || !compareAttributes(buffer, *mesh))
+    return false;
+
+  // per vertex colors
+  for (std::size_t i = 0; i < mesh->vertices().size(); ++i)
+    mesh->setVertexColor(i, Color(10 * i, 20 * i, 30 * i));
+  if (!buffer.update(*mesh) || !compareAttributes(buffer, *mesh))
+    return false;
+
+  return true;
+}
+
+int main()
+{
+  bool ok = true;
+  ok &= test_VertexBuffer_update();
+  return ok ? 0 : 1;
+}